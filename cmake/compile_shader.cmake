@@ -0,0 +1,45 @@
+# Compiles one GLSL shader to SPIR-V, run by the build as
+#   cmake -DGLSLANG_VALIDATOR=... -DSPIRV_OPT=... -DCONFIG=<build type>
+#         -DINPUT=<glsl file> -DOUTPUT=<spv file> -P compile_shader.cmake
+# Debug builds keep debug info and skip optimisation, Release builds are
+# optimised and stripped, other configurations are optimised only.
+
+if(CONFIG STREQUAL "Debug")
+    set(GLSLANG_FLAGS -g)
+else()
+    set(GLSLANG_FLAGS "")
+endif()
+
+set(UNOPTIMIZED "${OUTPUT}.unopt")
+execute_process(
+    COMMAND ${GLSLANG_VALIDATOR} -V ${GLSLANG_FLAGS} -o ${UNOPTIMIZED} ${INPUT}
+    RESULT_VARIABLE RESULT
+    OUTPUT_VARIABLE LOG
+    ERROR_VARIABLE LOG
+)
+if(NOT RESULT EQUAL 0)
+    file(REMOVE ${UNOPTIMIZED})
+    message(FATAL_ERROR "Could not compile shader ${INPUT}:\n${LOG}")
+endif()
+
+if(CONFIG STREQUAL "Debug" OR NOT SPIRV_OPT)
+    file(RENAME ${UNOPTIMIZED} ${OUTPUT})
+    return()
+endif()
+
+set(SPIRV_OPT_FLAGS -O)
+if(CONFIG STREQUAL "Release" OR CONFIG STREQUAL "MinSizeRel")
+    list(APPEND SPIRV_OPT_FLAGS --strip-debug)
+endif()
+
+execute_process(
+    COMMAND ${SPIRV_OPT} ${SPIRV_OPT_FLAGS} ${UNOPTIMIZED} -o ${OUTPUT}
+    RESULT_VARIABLE RESULT
+    OUTPUT_VARIABLE LOG
+    ERROR_VARIABLE LOG
+)
+file(REMOVE ${UNOPTIMIZED})
+if(NOT RESULT EQUAL 0)
+    file(REMOVE ${OUTPUT})
+    message(FATAL_ERROR "Could not optimise shader ${INPUT}:\n${LOG}")
+endif()
@@ -0,0 +1,49 @@
+# Generates a C++ source holding SPIR-V binaries as uint32_t arrays and
+# registering them with ShaderRegistry, run by the build as
+#   cmake -DPREFIX=<demo> -DSPIRV_FILES=<a.spv|b.spv> -DOUTPUT=<cpp file>
+#         -DHEADER=<path of shader_registry.h> -P embed_spirv.cmake
+# Shaders are registered as "<PREFIX>/<file name without .spv>".
+
+string(REPLACE "|" ";" SPIRV_FILES "${SPIRV_FILES}")
+
+set(WORD "0x[0-9a-f]+u, ")
+string(REPEAT "${WORD}" 5 LINE)
+
+set(ARRAYS "")
+set(ENTRIES "")
+set(INDEX 0)
+foreach(SPIRV ${SPIRV_FILES})
+    get_filename_component(FILE_NAME ${SPIRV} NAME)
+    string(REGEX REPLACE "\\.spv$" "" SHADER_NAME ${FILE_NAME})
+
+    # SPIR-V is a stream of little endian words
+    file(READ ${SPIRV} HEX HEX)
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u, " WORDS "${HEX}")
+    string(REGEX REPLACE "(${LINE})" "\\1\n    " WORDS "${WORDS}")
+    string(REGEX REPLACE " +\n" "\n" WORDS "${WORDS}")
+    string(REGEX REPLACE "[ ,\n]+$" "" WORDS "${WORDS}")
+
+    string(APPEND ARRAYS
+        "// ${SPIRV}\n"
+        "constexpr uint32_t kShader${INDEX}[] = {\n"
+        "    ${WORDS}};\n\n")
+    string(APPEND ENTRIES
+        "    {\"${PREFIX}/${SHADER_NAME}\", kShader${INDEX}, "
+        "sizeof(kShader${INDEX})},\n")
+    math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+file(WRITE ${OUTPUT}
+    "// Generated by cmake/embed_spirv.cmake, do not edit\n"
+    "#include \"${HEADER}\"\n"
+    "\n"
+    "namespace {\n"
+    "\n"
+    "${ARRAYS}"
+    "const EmbeddedShader kShaders[] = {\n"
+    "${ENTRIES}"
+    "};\n"
+    "\n"
+    "ShaderRegistrar registrar(kShaders, sizeof(kShaders) / sizeof(kShaders[0]));\n"
+    "\n"
+    "}  // namespace\n")
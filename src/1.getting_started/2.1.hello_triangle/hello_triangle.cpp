@@ -5,353 +5,76 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
 #include <iostream>
 
-bool HelloTriangle::CreateRenderPass() {
-  VkAttachmentDescription attachment_descriptions[] = {{
-      0,                             // VkAttachmentDescriptionFlags   flags
-      GetSwapChain().Format,         // VkFormat                       format
-      VK_SAMPLE_COUNT_1_BIT,         // VkSampleCountFlagBits          samples
-      VK_ATTACHMENT_LOAD_OP_CLEAR,   // VkAttachmentLoadOp             loadOp
-      VK_ATTACHMENT_STORE_OP_STORE,  // VkAttachmentStoreOp            storeOp
-      VK_ATTACHMENT_LOAD_OP_DONT_CARE,   // VkAttachmentLoadOp stencilLoadOp
-      VK_ATTACHMENT_STORE_OP_DONT_CARE,  // VkAttachmentStoreOp stencilStoreOp
-      VK_IMAGE_LAYOUT_UNDEFINED,         // VkImageLayout initialLayout;
-      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR    // VkImageLayout finalLayout
-  }};
-
-  VkAttachmentReference color_attachment_references[] = {{
-      0,  // uint32_t                       attachment
-      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL  // VkImageLayout layout
-  }};
-
-  VkSubpassDescription subpass_descriptions[] = {{
-      0,                                // VkSubpassDescriptionFlags      flags
-      VK_PIPELINE_BIND_POINT_GRAPHICS,  // VkPipelineBindPoint pipelineBindPoint
-      0,        // uint32_t                       inputAttachmentCount
-      nullptr,  // const VkAttachmentReference   *pInputAttachments
-      1,        // uint32_t                       colorAttachmentCount
-      color_attachment_references,  // const VkAttachmentReference
-                                    // *pColorAttachments
-      nullptr,  // const VkAttachmentReference   *pResolveAttachments
-      nullptr,  // const VkAttachmentReference   *pDepthStencilAttachment
-      0,        // uint32_t                       preserveAttachmentCount
-      nullptr   // const uint32_t*                pPreserveAttachments
-  }};
-
-  VkRenderPassCreateInfo render_pass_create_info = {
-      VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,  // VkStructureType sType
-      nullptr,  // const void                    *pNext
-      0,        // VkRenderPassCreateFlags        flags
-      1,        // uint32_t                       attachmentCount
-      attachment_descriptions,  // const VkAttachmentDescription *pAttachments
-      1,                        // uint32_t                       subpassCount
-      subpass_descriptions,     // const VkSubpassDescription    *pSubpasses
-      0,       // uint32_t                       dependencyCount
-      nullptr  // const VkSubpassDependency     *pDependencies
-  };
-
-  if (vkCreateRenderPass(GetDevice(), &render_pass_create_info, nullptr,
-                         &render_pass_) != VK_SUCCESS) {
-    std::cout << "Could not create render pass!" << std::endl;
-    return false;
-  }
-
-  return true;
-}
-
-bool HelloTriangle::CreateFramebuffers() {
-  const std::vector<ImageParameters>& swap_chain_images = GetSwapChain().Images;
-  framebuffers_.resize(swap_chain_images.size());
-
-  for (size_t i = 0; i < swap_chain_images.size(); ++i) {
-    VkFramebufferCreateInfo framebuffer_create_info = {
-        VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,  // VkStructureType sType
-        nullptr,       // const void                    *pNext
-        0,             // VkFramebufferCreateFlags       flags
-        render_pass_,  // VkRenderPass                   renderPass
-        1,             // uint32_t                       attachmentCount
-        &swap_chain_images[i].View,  // const VkImageView *pAttachments
-        800,                         // uint32_t                       width
-        600,                         // uint32_t                       height
-        1                            // uint32_t                       layers
-    };
-
-    if (vkCreateFramebuffer(GetDevice(), &framebuffer_create_info, nullptr,
-                            &framebuffers_[i]) != VK_SUCCESS) {
-      std::cout << "Could not create a framebuffer!" << std::endl;
-      return false;
-    }
-  }
-  return true;
-}
-
-bool HelloTriangle::CreatePipeline() {
-  Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-      vertex_shader_module =
-          CreateShaderModule("data/2.1.hello_triangle/shader.vert.spv");
-  Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-      fragment_shader_module =
-          CreateShaderModule("data/2.1.hello_triangle/shader.frag.spv");
-
-  if (!vertex_shader_module || !fragment_shader_module) {
-    return false;
-  }
-
-  std::vector<VkPipelineShaderStageCreateInfo> shader_stage_create_infos = {
-      // Vertex shader
-      {
-          VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,  // VkStructureType
-                                                                // sType
-          nullptr,  // const void                                    *pNext
-          0,        // VkPipelineShaderStageCreateFlags               flags
-          VK_SHADER_STAGE_VERTEX_BIT,  // VkShaderStageFlagBits stage
-          vertex_shader_module.Get(),  // VkShaderModule module
-          "main",  // const char                                    *pName
-          nullptr  // const VkSpecializationInfo *pSpecializationInfo
-      },
-      // Fragment shader
-      {
-          VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,  // VkStructureType
-                                                                // sType
-          nullptr,  // const void                                    *pNext
-          0,        // VkPipelineShaderStageCreateFlags               flags
-          VK_SHADER_STAGE_FRAGMENT_BIT,  // VkShaderStageFlagBits stage
-          fragment_shader_module.Get(),  // VkShaderModule module
-          "main",  // const char                                    *pName
-          nullptr  // const VkSpecializationInfo *pSpecializationInfo
-      }};
-
-  VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,  // VkStructureType
-                                                                  // sType
-      nullptr,  // const void                                    *pNext
-      0,        // VkPipelineVertexInputStateCreateFlags          flags;
-      0,        // uint32_t vertexBindingDescriptionCount
-      nullptr,  // const VkVertexInputBindingDescription
-                // *pVertexBindingDescriptions
-      0,        // uint32_t vertexAttributeDescriptionCount
-      nullptr   // const VkVertexInputAttributeDescription
-                // *pVertexAttributeDescriptions
-  };
-
-  VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,  // VkStructureType
-                                                                    // sType
-      nullptr,  // const void                                    *pNext
-      0,        // VkPipelineInputAssemblyStateCreateFlags        flags
-      VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,  // VkPrimitiveTopology topology
-      VK_FALSE                              // VkBool32 primitiveRestartEnable
-  };
-
-  VkViewport viewport = {
-      0.0f,    // float                                          x
-      0.0f,    // float                                          y
-      800.0f,  // float                                          width
-      600.0f,  // float                                          height
-      0.0f,    // float                                          minDepth
-      1.0f     // float                                          maxDepth
-  };
-
-  VkRect2D scissor = {{
-                          // VkOffset2D offset
-                          0,  // int32_t x
-                          0  // int32_t                                        y
-                      },
-                      {
-                          // VkExtent2D extent
-                          800,  // int32_t width
-                          600   // int32_t height
-                      }};
-
-  VkPipelineViewportStateCreateInfo viewport_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,  // VkStructureType
-                                                              // sType
-      nullptr,  // const void                                    *pNext
-      0,        // VkPipelineViewportStateCreateFlags             flags
-      1,        // uint32_t                                       viewportCount
-      &viewport,  // const VkViewport                              *pViewports
-      1,          // uint32_t                                       scissorCount
-      &scissor    // const VkRect2D                                *pScissors
-  };
-
-  VkPipelineRasterizationStateCreateInfo rasterization_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,  // VkStructureType
-                                                                   // sType
-      nullptr,   // const void                                    *pNext
-      0,         // VkPipelineRasterizationStateCreateFlags        flags
-      VK_FALSE,  // VkBool32 depthClampEnable
-      VK_FALSE,  // VkBool32 rasterizerDiscardEnable
-      VK_POLYGON_MODE_FILL,             // VkPolygonMode polygonMode
-      VK_CULL_MODE_BACK_BIT,            // VkCullModeFlags cullMode
-      VK_FRONT_FACE_COUNTER_CLOCKWISE,  // VkFrontFace frontFace
-      VK_FALSE,                         // VkBool32 depthBiasEnable
-      0.0f,                             // float depthBiasConstantFactor
-      0.0f,  // float                                          depthBiasClamp
-      0.0f,  // float depthBiasSlopeFactor
-      1.0f   // float                                          lineWidth
-  };
-
-  VkPipelineMultisampleStateCreateInfo multisample_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,  // VkStructureType
-                                                                 // sType
-      nullptr,  // const void                                    *pNext
-      0,        // VkPipelineMultisampleStateCreateFlags          flags
-      VK_SAMPLE_COUNT_1_BIT,  // VkSampleCountFlagBits rasterizationSamples
-      VK_FALSE,               // VkBool32 sampleShadingEnable
-      1.0f,  // float                                          minSampleShading
-      nullptr,   // const VkSampleMask                            *pSampleMask
-      VK_FALSE,  // VkBool32 alphaToCoverageEnable
-      VK_FALSE   // VkBool32 alphaToOneEnable
-  };
-
-  VkPipelineColorBlendAttachmentState color_blend_attachment_state = {
-      VK_FALSE,  // VkBool32                                       blendEnable
-      VK_BLEND_FACTOR_ONE,   // VkBlendFactor srcColorBlendFactor
-      VK_BLEND_FACTOR_ZERO,  // VkBlendFactor dstColorBlendFactor
-      VK_BLEND_OP_ADD,       // VkBlendOp colorBlendOp
-      VK_BLEND_FACTOR_ONE,   // VkBlendFactor srcAlphaBlendFactor
-      VK_BLEND_FACTOR_ZERO,  // VkBlendFactor dstAlphaBlendFactor
-      VK_BLEND_OP_ADD,       // VkBlendOp alphaBlendOp
-      VK_COLOR_COMPONENT_R_BIT |
-          VK_COLOR_COMPONENT_G_BIT |  // VkColorComponentFlags colorWriteMask
-          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
-
-  VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,  // VkStructureType
-                                                                 // sType
-      nullptr,   // const void                                    *pNext
-      0,         // VkPipelineColorBlendStateCreateFlags           flags
-      VK_FALSE,  // VkBool32                                       logicOpEnable
-      VK_LOGIC_OP_COPY,  // VkLogicOp logicOp
-      1,  // uint32_t                                       attachmentCount
-      &color_blend_attachment_state,  // const
-                                      // VkPipelineColorBlendAttachmentState
-                                      // *pAttachments
-      {0.0f, 0.0f, 0.0f, 0.0f}        // float blendConstants[4]
-  };
-
-  Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>
-      pipeline_layout = CreatePipelineLayout();
-  if (!pipeline_layout) {
-    return false;
+bool HelloTriangle::CreateRenderGraph() {
+  // The swap chain image is the only result of the frame; the render pass
+  // and the barriers around it are derived from how the pass uses it
+  RenderGraph& render_graph = GetRenderGraph();
+  render_graph.Reset();
+
+  // Acquired images are waited for at the color attachment output stage,
+  // which is also where the readback of headless mode picks them up
+  RenderGraphImageState initial_state;
+  initial_state.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  RenderGraphImageState final_state;
+  final_state.Layout = GetSwapChain().FinalLayout;
+  final_state.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  if (GetPresentQueue().Handle != GetGraphicsQueue().Handle) {
+    final_state.QueueFamilyIndex = GetPresentQueue().FamilyIndex;
   }
-
-  VkGraphicsPipelineCreateInfo pipeline_create_info = {
-      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,  // VkStructureType sType
-      nullptr,  // const void                                    *pNext
-      0,        // VkPipelineCreateFlags                          flags
-      static_cast<uint32_t>(
-          shader_stage_create_infos.size()),  // uint32_t stageCount
-      shader_stage_create_infos
-          .data(),  // const VkPipelineShaderStageCreateInfo         *pStages
-      &vertex_input_state_create_info,  // const
-                                        // VkPipelineVertexInputStateCreateInfo
-                                        // *pVertexInputState;
-      &input_assembly_state_create_info,  // const
-                                          // VkPipelineInputAssemblyStateCreateInfo
-                                          // *pInputAssemblyState
-      nullptr,  // const VkPipelineTessellationStateCreateInfo
-                // *pTessellationState
-      &viewport_state_create_info,  // const VkPipelineViewportStateCreateInfo
-                                    // *pViewportState
-      &rasterization_state_create_info,  // const
-                                         // VkPipelineRasterizationStateCreateInfo
-                                         // *pRasterizationState
-      &multisample_state_create_info,  // const
-                                       // VkPipelineMultisampleStateCreateInfo
-                                       // *pMultisampleState
-      nullptr,  // const VkPipelineDepthStencilStateCreateInfo
-                // *pDepthStencilState
-      &color_blend_state_create_info,  // const
-                                       // VkPipelineColorBlendStateCreateInfo
-                                       // *pColorBlendState
-      nullptr,  // const VkPipelineDynamicStateCreateInfo        *pDynamicState
-      pipeline_layout.Get(),  // VkPipelineLayout layout
-      render_pass_,           // VkRenderPass renderPass
-      0,               // uint32_t                                       subpass
-      VK_NULL_HANDLE,  // VkPipeline basePipelineHandle
-      -1  // int32_t                                        basePipelineIndex
-  };
-
-  if (vkCreateGraphicsPipelines(GetDevice(), VK_NULL_HANDLE, 1,
-                                &pipeline_create_info, nullptr,
-                                &graphics_pipeline_) != VK_SUCCESS) {
-    std::cout << "Could not create graphics pipeline!" << std::endl;
+  swap_chain_image_ = render_graph.ImportImage(
+      "Swap chain", GetSwapChain().Format, GetSwapChain().Extent,
+      initial_state, final_state);
+
+  VkClearColorValue clear_color = {{0.2f, 0.3f, 0.3f, 1.0f}};
+  triangle_pass_ = render_graph.AddPass(
+      "Triangle", [this](VkCommandBuffer command_buffer) {
+        RecordTrianglePass(command_buffer);
+      });
+  render_graph.AddColorOutput(triangle_pass_, swap_chain_image_,
+                              VK_ATTACHMENT_LOAD_OP_CLEAR, clear_color);
+
+  if (!render_graph.Compile()) {
+    std::cout << "Could not compile render graph!" << std::endl;
     return false;
   }
+  render_pass_ = render_graph.GetRenderPass(triangle_pass_);
+  render_pass_format_ = GetSwapChain().Format;
   return true;
 }
 
-Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-HelloTriangle::CreateShaderModule(const char* filename) {
-  const std::vector<char> code = Tools::GetBinaryFileContents(filename);
-  if (code.size() == 0) {
-    return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>();
-  }
-
-  VkShaderModuleCreateInfo shader_module_create_info = {
-      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,  // VkStructureType sType
-      nullptr,      // const void                    *pNext
-      0,            // VkShaderModuleCreateFlags      flags
-      code.size(),  // size_t                         codeSize
-      reinterpret_cast<const uint32_t*>(code.data())  // const uint32_t *pCode
-  };
-
-  VkShaderModule shader_module;
-  if (vkCreateShaderModule(GetDevice(), &shader_module_create_info, nullptr,
-                           &shader_module) != VK_SUCCESS) {
-    std::cout << "Could not create shader module from a \"" << filename
-              << "\" file!" << std::endl;
-    return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>();
-  }
-
-  return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>(
-      shader_module, vkDestroyShaderModule, GetDevice());
+bool HelloTriangle::CreatePipeline() {
+  PipelineDesc desc = GetPipelineDesc();
+  graphics_pipeline_ = GetPipelineRegistry().GetPipeline(desc);
+  // With pipeline libraries this is a quickly linked pipeline, the optimized
+  // one is swapped in by UpdatePipeline() once it is compiled
+  pending_pipeline_ =
+      GetPipelineRegistry().GetPipelineAsync(desc, graphics_pipeline_);
+  return graphics_pipeline_ != VK_NULL_HANDLE;
 }
 
-Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>
-HelloTriangle::CreatePipelineLayout() {
-  VkPipelineLayoutCreateInfo layout_create_info = {
-      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,  // VkStructureType sType
-      nullptr,  // const void                    *pNext
-      0,        // VkPipelineLayoutCreateFlags    flags
-      0,        // uint32_t                       setLayoutCount
-      nullptr,  // const VkDescriptorSetLayout   *pSetLayouts
-      0,        // uint32_t                       pushConstantRangeCount
-      nullptr   // const VkPushConstantRange     *pPushConstantRanges
-  };
-
-  VkPipelineLayout pipeline_layout;
-  if (vkCreatePipelineLayout(GetDevice(), &layout_create_info, nullptr,
-                             &pipeline_layout) != VK_SUCCESS) {
-    std::cout << "Could not create pipeline layout!" << std::endl;
-    return Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>();
-  }
-
-  return Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>(
-      pipeline_layout, vkDestroyPipelineLayout, GetDevice());
+PipelineDesc HelloTriangle::GetPipelineDesc() const {
+  // Everything else, including the layout, comes from the registry's
+  // defaults and the shaders themselves
+  PipelineDesc desc;
+  desc.VertexShader = "2.1.hello_triangle/shader.vert";
+  desc.FragmentShader = "2.1.hello_triangle/shader.frag";
+  desc.ColorFormat = render_pass_format_;
+  desc.RenderPass = render_pass_;
+  return desc;
 }
 
-bool HelloTriangle::CreateSemaphores() {
-  VkSemaphoreCreateInfo semaphore_create_info = {
-      VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,  // VkStructureType sType
-      nullptr,  // const void*              pNext
-      0         // VkSemaphoreCreateFlags   flags
-  };
-
-  if ((vkCreateSemaphore(GetDevice(), &semaphore_create_info, nullptr,
-                         &image_available_semaphore_) != VK_SUCCESS) ||
-      (vkCreateSemaphore(GetDevice(), &semaphore_create_info, nullptr,
-                         &rendering_finished_femaphore_) != VK_SUCCESS)) {
-    std::cout << "Could not create semaphores!" << std::endl;
-    return false;
-  }
-
-  return true;
+void HelloTriangle::SetRecordEveryFrame(bool record_every_frame) {
+  record_every_frame_ = record_every_frame;
 }
 
 bool HelloTriangle::CreateCommandBuffers() {
+  // Frame slots of VulkanCommon own the command buffers in this mode
+  if (record_every_frame_) {
+    return true;
+  }
   if (!CreateCommandPool(GetGraphicsQueue().FamilyIndex,
                          &graphics_command_pool_)) {
     std::cout << "Could not create command pool!" << std::endl;
@@ -373,8 +96,10 @@ bool HelloTriangle::CreateCommandPool(uint32_t queue_family_index,
                                       VkCommandPool* pool) {
   VkCommandPoolCreateInfo cmd_pool_create_info = {
       VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,  // VkStructureType sType
-      nullptr,            // const void                    *pNext
-      0,                  // VkCommandPoolCreateFlags       flags
+      nullptr,  // const void                    *pNext
+      // VkCommandPoolCreateFlags flags; prerecorded command buffers are
+      // re-recorded one at a time when a reloaded pipeline replaces theirs
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
       queue_family_index  // uint32_t                       queueFamilyIndex
   };
 
@@ -403,154 +128,187 @@ bool HelloTriangle::AllocateCommandBuffers(VkCommandPool pool, uint32_t count,
 }
 
 bool HelloTriangle::RecordCommandBuffers() {
+  // Recorded every frame by Draw() instead
+  if (record_every_frame_) {
+    return true;
+  }
+  for (size_t i = 0; i < graphics_command_buffers_.size(); ++i) {
+    if (!RecordCommandBuffer(graphics_command_buffers_[i],
+                             static_cast<uint32_t>(i),
+                             VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT)) {
+      return false;
+    }
+  }
+  recorded_pipelines_.assign(graphics_command_buffers_.size(),
+                             graphics_pipeline_);
+  return true;
+}
+
+bool HelloTriangle::RecordCommandBuffer(VkCommandBuffer command_buffer,
+                                        uint32_t image_index,
+                                        VkCommandBufferUsageFlags usage) {
   VkCommandBufferBeginInfo graphics_commandd_buffer_begin_info = {
       VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,  // VkStructureType sType
       nullptr,  // const void                            *pNext
-      VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,  // VkCommandBufferUsageFlags
-                                                     // flags
-      nullptr  // const VkCommandBufferInheritanceInfo  *pInheritanceInfo
+      usage,    // VkCommandBufferUsageFlags              flags
+      nullptr   // const VkCommandBufferInheritanceInfo  *pInheritanceInfo
   };
 
-  VkImageSubresourceRange image_subresource_range = {
-      VK_IMAGE_ASPECT_COLOR_BIT,  // VkImageAspectFlags             aspectMask
-      0,                          // uint32_t                       baseMipLevel
-      1,                          // uint32_t                       levelCount
-      0,  // uint32_t                       baseArrayLayer
-      1   // uint32_t                       layerCount
-  };
+  const ImageParameters& image = GetSwapChain().Images[image_index];
+
+  vkBeginCommandBuffer(command_buffer, &graphics_commandd_buffer_begin_info);
+
+  // Profiler slots follow swap chain images in both recording modes; an
+  // image is only recorded again once its previous frame has completed
+  uint32_t slot = image_index;
+  GetProfiler().BeginSlot(slot, command_buffer);
+  uint32_t frame_scope =
+      GetProfiler().BeginScope(slot, command_buffer, "Frame");
+
+  // Layout transitions and the ownership transfer to the present queue are
+  // recorded by the render graph around the pass
+  GetRenderGraph().SetImage(swap_chain_image_, image.Handle, image.View);
+  bool result = false;
+  {
+    GpuProfileScope render_graph_scope(GetProfiler(), slot, command_buffer,
+                                       "Render graph");
+    result = GetRenderGraph().Execute(command_buffer);
+  }
+
+  GetProfiler().EndScope(slot, command_buffer, frame_scope);
+  if ((vkEndCommandBuffer(command_buffer) != VK_SUCCESS) || !result) {
+    std::cout << "Could not record command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void HelloTriangle::RecordTrianglePass(VkCommandBuffer command_buffer) {
+  const VkExtent2D& extent = GetSwapChain().Extent;
 
-  VkClearValue clear_value = {
-      {0.2f, 0.3f, 0.3f, 1.0f},  // VkClearColorValue              color
+  VkViewport viewport = {
+      0.0f,                                // float                  x
+      0.0f,                                // float                  y
+      static_cast<float>(extent.width),   // float                  width
+      static_cast<float>(extent.height),  // float                  height
+      0.0f,                                // float                  minDepth
+      1.0f                                 // float                  maxDepth
   };
 
-  const std::vector<ImageParameters>& swap_chain_images = GetSwapChain().Images;
+  VkRect2D scissor = {{
+                          // VkOffset2D offset
+                          0,  // int32_t x
+                          0   // int32_t y
+                      },
+                      extent};  // VkExtent2D extent
 
-  for (size_t i = 0; i < graphics_command_buffers_.size(); ++i) {
-    vkBeginCommandBuffer(graphics_command_buffers_[i],
-                         &graphics_commandd_buffer_begin_info);
-
-    if (GetPresentQueue().Handle != GetGraphicsQueue().Handle) {
-      VkImageMemoryBarrier barrier_from_present_to_draw = {
-          VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,  // VkStructureType sType
-          nullptr,                    // const void                    *pNext
-          VK_ACCESS_MEMORY_READ_BIT,  // VkAccessFlags srcAccessMask
-          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,  // VkAccessFlags dstAccessMask
-          VK_IMAGE_LAYOUT_UNDEFINED,             // VkImageLayout oldLayout
-          VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,       // VkImageLayout newLayout
-          GetPresentQueue().FamilyIndex,         // uint32_t srcQueueFamilyIndex
-          GetGraphicsQueue().FamilyIndex,        // uint32_t dstQueueFamilyIndex
-          swap_chain_images[i].Handle,  // VkImage                        image
-          image_subresource_range  // VkImageSubresourceRange subresourceRange
-      };
-      vkCmdPipelineBarrier(graphics_command_buffers_[i],
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
-                           nullptr, 0, nullptr, 1,
-                           &barrier_from_present_to_draw);
-    }
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    graphics_pipeline_);
 
-    VkRenderPassBeginInfo render_pass_begin_info = {
-        VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,  // VkStructureType sType
-        nullptr,           // const void                    *pNext
-        render_pass_,      // VkRenderPass                   renderPass
-        framebuffers_[i],  // VkFramebuffer                  framebuffer
-        {                  // VkRect2D                       renderArea
-         {
-             // VkOffset2D                     offset
-             0,  // int32_t                        x
-             0   // int32_t                        y
-         },
-         {
-             // VkExtent2D                     extent
-             800,  // int32_t                        width
-             600,  // int32_t                        height
-         }},
-        1,            // uint32_t                       clearValueCount
-        &clear_value  // const VkClearValue            *pClearValues
-    };
-
-    vkCmdBeginRenderPass(graphics_command_buffers_[i], &render_pass_begin_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdBindPipeline(graphics_command_buffers_[i],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_);
-
-    vkCmdDraw(graphics_command_buffers_[i], 3, 1, 0, 0);
-
-    vkCmdEndRenderPass(graphics_command_buffers_[i]);
-
-    if (GetGraphicsQueue().Handle != GetPresentQueue().Handle) {
-      VkImageMemoryBarrier barrier_from_draw_to_present = {
-          VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,  // VkStructureType sType
-          nullptr,  // const void                  *pNext
-          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,  // VkAccessFlags srcAccessMask
-          VK_ACCESS_MEMORY_READ_BIT,             // VkAccessFlags dstAccessMask
-          VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,       // VkImageLayout oldLayout
-          VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,       // VkImageLayout newLayout
-          GetGraphicsQueue().FamilyIndex,        // uint32_t srcQueueFamilyIndex
-          GetPresentQueue().FamilyIndex,         // uint32_t dstQueueFamilyIndex
-          swap_chain_images[i].Handle,  // VkImage                      image
-          image_subresource_range  // VkImageSubresourceRange subresourceRange
-      };
-      vkCmdPipelineBarrier(graphics_command_buffers_[i],
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
-                           0, nullptr, 1, &barrier_from_draw_to_present);
-    }
-    if (vkEndCommandBuffer(graphics_command_buffers_[i]) != VK_SUCCESS) {
-      std::cout << "Could not record command buffer!" << std::endl;
-      return false;
-    }
-  }
-  return true;
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+  vkCmdDraw(command_buffer, 3, 1, 0, 0);
 }
 
 void HelloTriangle::ChildClear() {
   if (GetDevice() != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(GetDevice());
-
-    if ((graphics_command_buffers_.size() > 0) &&
-        (graphics_command_buffers_[0] != VK_NULL_HANDLE)) {
-      vkFreeCommandBuffers(
-          GetDevice(), graphics_command_pool_,
-          static_cast<uint32_t>(graphics_command_buffers_.size()),
-          graphics_command_buffers_.data());
-      graphics_command_buffers_.clear();
-    }
+    // Frames in flight may still reference these objects so they are
+    // destroyed once the graphics timeline passes the last submission
+    VkDevice device = GetDevice();
+    VkCommandPool command_pool = graphics_command_pool_;
+
+    GetGraphicsTimeline().DeferRelease([=]() {
+      // Destroying the pool frees its command buffers as well
+      if (command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, command_pool, nullptr);
+      }
+    });
 
-    if (graphics_command_pool_ != VK_NULL_HANDLE) {
-      vkDestroyCommandPool(GetDevice(), graphics_command_pool_, nullptr);
-      graphics_command_pool_ = VK_NULL_HANDLE;
-    }
+    graphics_command_buffers_.clear();
+    recorded_pipelines_.clear();
+    graphics_command_pool_ = VK_NULL_HANDLE;
+  }
+}
+
+void HelloTriangle::ChildOnShadersReloaded(
+    const std::vector<std::string>& /*names*/) {
+  // Only this demo's shaders are watched, so any of them affects the pipeline
+  rebuild_pipeline_ = true;
+}
 
-    if (graphics_pipeline_ != VK_NULL_HANDLE) {
-      vkDestroyPipeline(GetDevice(), graphics_pipeline_, nullptr);
-      graphics_pipeline_ = VK_NULL_HANDLE;
+void HelloTriangle::UpdatePipeline() {
+  if (pending_pipeline_.IsValid()) {
+    // The fast-linked pipeline is used while the optimized one compiles; a
+    // failed build keeps the current pipeline, e.g. after a shader edit
+    // broke the interface
+    bool ready = pending_pipeline_.IsReady();
+    graphics_pipeline_ = pending_pipeline_.Get();
+    if ((replaced_pipeline_ != VK_NULL_HANDLE) &&
+        (graphics_pipeline_ != replaced_pipeline_)) {
+      retired_pipelines_.push_back(replaced_pipeline_);
+      replaced_pipeline_ = VK_NULL_HANDLE;
+    }
+    if (ready) {
+      pending_pipeline_.Reset();
+      replaced_pipeline_ = VK_NULL_HANDLE;
     }
+  }
+  if (rebuild_pipeline_ && !pending_pipeline_.IsValid()) {
+    rebuild_pipeline_ = false;
+    replaced_pipeline_ = graphics_pipeline_;
+    pending_pipeline_ = GetPipelineRegistry().GetPipelineAsync(
+        GetPipelineDesc(), graphics_pipeline_);
+  }
+  ReleaseRetiredPipelines();
+}
 
-    if (render_pass_ != VK_NULL_HANDLE) {
-      vkDestroyRenderPass(GetDevice(), render_pass_, nullptr);
-      render_pass_ = VK_NULL_HANDLE;
+void HelloTriangle::ReleaseRetiredPipelines() {
+  // Prerecorded command buffers are re-recorded by Draw() one at a time;
+  // the registry destroys a released pipeline only after the frames
+  // submitted so far, which covers recording every frame
+  for (size_t i = 0; i < retired_pipelines_.size();) {
+    if (std::find(recorded_pipelines_.begin(), recorded_pipelines_.end(),
+                  retired_pipelines_[i]) != recorded_pipelines_.end()) {
+      ++i;
+      continue;
     }
+    GetPipelineRegistry().Release(retired_pipelines_[i]);
+    retired_pipelines_.erase(retired_pipelines_.begin() + i);
+  }
+}
 
-    for (size_t i = 0; i < framebuffers_.size(); ++i) {
-      if (framebuffers_[i] != VK_NULL_HANDLE) {
-        vkDestroyFramebuffer(GetDevice(), framebuffers_[i], nullptr);
-        framebuffers_[i] = VK_NULL_HANDLE;
-      }
+void HelloTriangle::ReleasePipeline() {
+  // A background rebuild uses the render pass, so it has to finish first;
+  // render passes are owned by the render graph. The pipelines can't be
+  // used with another render pass, so they go back to the registry
+  VkPipeline pending_pipeline = pending_pipeline_.Wait();
+  pending_pipeline_.Reset();
+  for (VkPipeline pipeline :
+       {graphics_pipeline_, replaced_pipeline_, pending_pipeline}) {
+    if ((pipeline != VK_NULL_HANDLE) &&
+        (std::find(retired_pipelines_.begin(), retired_pipelines_.end(),
+                   pipeline) == retired_pipelines_.end())) {
+      retired_pipelines_.push_back(pipeline);
     }
-    framebuffers_.clear();
   }
+  graphics_pipeline_ = VK_NULL_HANDLE;
+  replaced_pipeline_ = VK_NULL_HANDLE;
+  ReleaseRetiredPipelines();
 }
 
 bool HelloTriangle::ChildOnWindowSizeChanged() {
-  if (!CreateRenderPass()) {
-    return false;
+  // Pipeline only depends on the swap chain through the render pass format,
+  // so it is rebuilt only when the surface format changes; the graph is
+  // described again for the new images and extent
+  bool format_changed = render_pass_format_ != GetSwapChain().Format;
+  if (format_changed) {
+    ReleasePipeline();
   }
-  if (!CreateFramebuffers()) {
+  if (!CreateRenderGraph()) {
     return false;
   }
-  if (!CreatePipeline()) {
+  if (format_changed && !CreatePipeline()) {
     return false;
   }
   if (!CreateCommandBuffers()) {
@@ -565,73 +323,49 @@ bool HelloTriangle::ChildOnWindowSizeChanged() {
 
 HelloTriangle::~HelloTriangle() {
   ChildClear();
-
-  if (GetDevice() != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(GetDevice());
-
-    if (image_available_semaphore_ != VK_NULL_HANDLE) {
-      vkDestroySemaphore(GetDevice(), image_available_semaphore_, nullptr);
-    }
-
-    if (rendering_finished_femaphore_ != VK_NULL_HANDLE) {
-      vkDestroySemaphore(GetDevice(), rendering_finished_femaphore_, nullptr);
-    }
-  }
+  ReleasePipeline();
 }
 
 HelloTriangle::HelloTriangle() {}
 
 bool HelloTriangle::Draw() {
-  VkSwapchainKHR swap_chain = GetSwapChain().Handle;
+  TraceZone zone("Draw");
   uint32_t image_index;
 
-  VkResult result = vkAcquireNextImageKHR(GetDevice(), swap_chain, UINT64_MAX,
-                                          image_available_semaphore_,
-                                          VK_NULL_HANDLE, &image_index);
+  VkResult result = AcquireFrame(&image_index);
   switch (result) {
     case VK_SUCCESS:
-    case VK_SUBOPTIMAL_KHR:
       break;
     case VK_ERROR_OUT_OF_DATE_KHR:
       return OnWindowSizeChanged();
     default:
-      std::cout << "Problem occurred during swap chain image acquisition!"
-                << std::endl;
       return false;
   }
-
-  VkPipelineStageFlags wait_dst_stage_mask =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  VkSubmitInfo submit_info = {
-      VK_STRUCTURE_TYPE_SUBMIT_INFO,  // VkStructureType              sType
-      nullptr,                        // const void                  *pNext
-      1,  // uint32_t                     waitSemaphoreCount
-      &image_available_semaphore_,  // const VkSemaphore *pWaitSemaphores
-      &wait_dst_stage_mask,  // const VkPipelineStageFlags  *pWaitDstStageMask;
-      1,                     // uint32_t                     commandBufferCount
-      &graphics_command_buffers_[image_index],  // const VkCommandBuffer
-                                                // *pCommandBuffers
-      1,  // uint32_t                     signalSemaphoreCount
-      &rendering_finished_femaphore_  // const VkSemaphore *pSignalSemaphores
-  };
-
-  if (vkQueueSubmit(GetGraphicsQueue().Handle, 1, &submit_info,
-                    VK_NULL_HANDLE) != VK_SUCCESS) {
-    return false;
+  UpdatePipeline();
+
+  // Per frame recording reuses the frame slot's command buffer, its pool was
+  // reset by AcquireFrame()
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  if (record_every_frame_) {
+    command_buffer = GetCurrentFrame().CommandBuffer;
+    if (!RecordCommandBuffer(command_buffer, image_index,
+                             VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT)) {
+      return false;
+    }
+  } else {
+    command_buffer = graphics_command_buffers_[image_index];
+    // AcquireFrame() waited for the image's previous frame, so its command
+    // buffer can be re-recorded once the pipeline changed
+    if (recorded_pipelines_[image_index] != graphics_pipeline_) {
+      if (!RecordCommandBuffer(command_buffer, image_index,
+                               VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT)) {
+        return false;
+      }
+      recorded_pipelines_[image_index] = graphics_pipeline_;
+    }
   }
 
-  VkPresentInfoKHR present_info = {
-      VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,  // VkStructureType              sType
-      nullptr,                             // const void                  *pNext
-      1,  // uint32_t                     waitSemaphoreCount
-      &rendering_finished_femaphore_,  // const VkSemaphore *pWaitSemaphores
-      1,             // uint32_t                     swapchainCount
-      &swap_chain,   // const VkSwapchainKHR        *pSwapchains
-      &image_index,  // const uint32_t              *pImageIndices
-      nullptr        // VkResult                    *pResults
-  };
-  result = vkQueuePresentKHR(GetPresentQueue().Handle, &present_info);
-
+  result = SubmitFrame(image_index, command_buffer);
   switch (result) {
     case VK_SUCCESS:
       break;
@@ -639,7 +373,6 @@ bool HelloTriangle::Draw() {
     case VK_SUBOPTIMAL_KHR:
       return OnWindowSizeChanged();
     default:
-      std::cout << "Problem occurred during image presentation!" << std::endl;
       return false;
   }
   return true;
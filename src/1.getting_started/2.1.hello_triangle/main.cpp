@@ -14,7 +14,11 @@
 // under the License.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 #include "hello_triangle.h"
 #include "window.h"
@@ -23,31 +27,73 @@ const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
 int main(int argc, char **argv) {
+  // "--trace N" writes a Chrome trace of the first N frames; F12 writes it
+  // at any point of the capture. "--headless N" renders N frames offscreen
+  // without opening a window and reports the time it took, which together
+  // with "--record prerecorded" compares recording every frame with the
+  // prerecorded command buffers it replaced.
+  // "--frames-in-flight N" lets the CPU record up to N frames ahead of the
+  // GPU; headless runs report the CPU time spent in Draw(), which compares
+  // waiting for every frame (1) with overlapping them.
+  // "--resize-every-frame on" recreates the swap chain before every frame,
+  // windowed or headless, and reports the average and worst frame time.
+  // "--hot-reload on" recompiles shaders whenever their sources are saved
+  uint32_t headless_frames = 0;
+  uint32_t frames_in_flight = 0;
+  bool resize_every_frame = false;
+  bool record_every_frame = true;
+  bool hot_reload = false;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i];
+    if (option == "--trace") {
+      Tracer::Get().Start("hello_triangle.trace.json", std::atoi(argv[i + 1]));
+    } else if (option == "--headless") {
+      headless_frames = static_cast<uint32_t>(std::atoi(argv[i + 1]));
+    } else if (option == "--frames-in-flight") {
+      frames_in_flight = static_cast<uint32_t>(std::atoi(argv[i + 1]));
+    } else if (option == "--resize-every-frame") {
+      resize_every_frame = std::string(argv[i + 1]) == "on";
+    } else if (option == "--record") {
+      record_every_frame = std::string(argv[i + 1]) != "prerecorded";
+    } else if (option == "--hot-reload") {
+      hot_reload = std::string(argv[i + 1]) == "on";
+    }
+  }
+
   Window window;
   HelloTriangle helloTriangle;
   // Window creation
-  if (!window.Create("Hello, triangle", WIDTH, HEIGHT)) {
+  if ((headless_frames == 0) &&
+      !window.Create("Hello, triangle", WIDTH, HEIGHT)) {
     return -1;
   }
 
   // Vulkan preparations and initialization
-  if (!helloTriangle.PrepareVulkan(window.GetWindow())) {
+  helloTriangle.SetPipelineCacheFilename("hello_triangle.pipeline_cache");
+  if (frames_in_flight > 0) {
+    helloTriangle.SetFramesInFlight(frames_in_flight);
+  }
+  if (headless_frames > 0) {
+    if (!helloTriangle.PrepareVulkanHeadless(WIDTH, HEIGHT)) {
+      return -1;
+    }
+  } else if (!helloTriangle.PrepareVulkan(window.GetWindow())) {
     return -1;
   }
-
-  if (!helloTriangle.CreateRenderPass()) {
+  if (hot_reload &&
+      !helloTriangle.EnableShaderHotReload(SHADER_SOURCE_DIR, SHADER_PREFIX,
+                                           GLSLANG_VALIDATOR_PATH)) {
     return -1;
   }
-  if (!helloTriangle.CreateFramebuffers()) {
+
+  if (!helloTriangle.CreateRenderGraph()) {
     return -1;
   }
   if (!helloTriangle.CreatePipeline()) {
     return -1;
   }
 
-  if (!helloTriangle.CreateSemaphores()) {
-    return -1;
-  }
+  helloTriangle.SetRecordEveryFrame(record_every_frame);
   if (!helloTriangle.CreateCommandBuffers()) {
     return -1;
   }
@@ -56,7 +102,52 @@ int main(int argc, char **argv) {
   }
 
   // Rendering loop
-  if (!window.RenderingLoop(helloTriangle)) {
+  if (headless_frames > 0) {
+    // CPU time of a frame covers waiting for a free frame slot, recording
+    // and submitting, i.e. what frames in flight hide from the CPU, and the
+    // swap chain recreation when stressing it
+    double cpu_milliseconds = 0.0;
+    double worst_milliseconds = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < headless_frames; ++i) {
+      {
+        TraceZone zone("Frame");
+        auto frame_start = std::chrono::steady_clock::now();
+        if (resize_every_frame && !helloTriangle.OnWindowSizeChanged()) {
+          return -1;
+        }
+        if (!helloTriangle.Draw()) {
+          return -1;
+        }
+        double frame_milliseconds =
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - frame_start)
+                .count();
+        cpu_milliseconds += frame_milliseconds;
+        worst_milliseconds = std::max(worst_milliseconds, frame_milliseconds);
+      }
+      Tracer::Get().EndFrame();
+    }
+    TimelineScheduler &timeline = helloTriangle.GetGraphicsTimeline();
+    if (!timeline.Wait(timeline.GetLastSubmittedValue())) {
+      return -1;
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    std::cout << headless_frames << " frames ("
+              << (record_every_frame ? "recorded per frame" : "prerecorded")
+              << (resize_every_frame ? ", resized every frame" : "")
+              << ") in " << milliseconds << " ms, "
+              << milliseconds / headless_frames << " ms per frame, "
+              << cpu_milliseconds / headless_frames
+              << " ms CPU per frame (worst " << worst_milliseconds
+              << " ms) with " << helloTriangle.GetFramesInFlight()
+              << " frames in flight" << std::endl;
+    return 0;
+  }
+  if (!window.RenderingLoop(helloTriangle, resize_every_frame)) {
     return -1;
   }
   return 0;
@@ -12,7 +12,15 @@
 
 layout(location = 0) out vec4 FragColor;
 
+// Pipeline variant; the branch is compiled out instead of evaluated per
+// fragment
+layout(constant_id = 0) const bool Grayscale = false;
+
 void main()
 {
-    FragColor = vec4(1.0f, 0.5f, 0.2f, 1.0f);
+    vec4 color = vec4(1.0f, 0.5f, 0.2f, 1.0f);
+    if (Grayscale) {
+        color.rgb = vec3(dot(color.rgb, vec3(0.299f, 0.587f, 0.114f)));
+    }
+    FragColor = color;
 } 
@@ -5,269 +5,80 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
 #include <iostream>
 
-bool HelloTriangle::CreateRenderPass() {
-  VkAttachmentDescription color_attachment{};
-  color_attachment.format = GetSwapChain().Format;
-  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentReference color_attachment_references{};
-  color_attachment_references.attachment = 0;
-  color_attachment_references.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  VkSubpassDescription subpass{};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &color_attachment_references;
-
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-  VkRenderPassCreateInfo render_pass_info{};
-  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  render_pass_info.attachmentCount = 1;
-  render_pass_info.pAttachments = &color_attachment;
-  render_pass_info.subpassCount = 1;
-  render_pass_info.pSubpasses = &subpass;
-  render_pass_info.dependencyCount = 1;
-  render_pass_info.pDependencies = &dependency;
-
-  if (vkCreateRenderPass(GetDevice(), &render_pass_info, nullptr,
-                         &render_pass_) != VK_SUCCESS) {
-    std::cout << "Could not create render pass!" << std::endl;
-    return false;
-  }
-
-  return true;
-}
-
-bool HelloTriangle::CreateFramebuffers() {
-  const std::vector<ImageParameters>& swap_chain_images = GetSwapChain().Images;
-  framebuffers_.resize(swap_chain_images.size());
-
-  for (size_t i = 0; i < swap_chain_images.size(); ++i) {
-    VkFramebufferCreateInfo framebuffer_create_info = {};
-    framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebuffer_create_info.renderPass = render_pass_;
-    framebuffer_create_info.attachmentCount = 1;
-    framebuffer_create_info.pAttachments = &swap_chain_images[i].View;
-    framebuffer_create_info.width = 800;
-    framebuffer_create_info.height = 600;
-    framebuffer_create_info.layers = 1;
-
-    if (vkCreateFramebuffer(GetDevice(), &framebuffer_create_info, nullptr,
-                            &framebuffers_[i]) != VK_SUCCESS) {
-      std::cout << "Could not create a framebuffer!" << std::endl;
-      return false;
-    }
-  }
-  return true;
-}
-
-bool HelloTriangle::CreatePipeline() {
-  Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-      vertex_shader_module =
-          CreateShaderModule("data/2.2.hello_triangle/shader.vert.spv");
-  Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-      fragment_shader_module =
-          CreateShaderModule("data/2.2.hello_triangle/shader.frag.spv");
-
-  if (!vertex_shader_module || !fragment_shader_module) {
-    return false;
-  }
-
-  std::vector<VkPipelineShaderStageCreateInfo> shader_stage_create_infos;
-  VkPipelineShaderStageCreateInfo vertex_shader_module_create_info = {};
-  vertex_shader_module_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertex_shader_module_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertex_shader_module_create_info.module = vertex_shader_module.Get();
-  vertex_shader_module_create_info.pName = "main";
-  shader_stage_create_infos.push_back(vertex_shader_module_create_info);
-
-  VkPipelineShaderStageCreateInfo fragment_shader_module_create_info = {};
-  fragment_shader_module_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragment_shader_module_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  fragment_shader_module_create_info.module = fragment_shader_module.Get();
-  fragment_shader_module_create_info.pName = "main";
-  shader_stage_create_infos.push_back(fragment_shader_module_create_info);
-
-  VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
-  vertex_input_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-  VkVertexInputBindingDescription bindingDescription{};
-  bindingDescription.binding = 0;
-  bindingDescription.stride = sizeof(Vertex);
-  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-  std::array<VkVertexInputAttributeDescription, 1> attributeDescriptions{};
-  attributeDescriptions[0].binding = 0;
-  attributeDescriptions[0].location = 0;
-  attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-  attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-  vertex_input_state_create_info.vertexBindingDescriptionCount = 1;
-  vertex_input_state_create_info.vertexAttributeDescriptionCount =
-      static_cast<uint32_t>(attributeDescriptions.size());
-  vertex_input_state_create_info.pVertexBindingDescriptions =
-      &bindingDescription;
-  vertex_input_state_create_info.pVertexAttributeDescriptions =
-      attributeDescriptions.data();
-
-  VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
-  input_assembly_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  input_assembly_state_create_info.topology =
-      VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  input_assembly_state_create_info.primitiveRestartEnable = VK_FALSE;
-
-  VkViewport viewport = {0.0f, 0.0f, 800.0f, 600.0f, 0.0f, 1.0f};
-
-  VkRect2D scissor = {{0, 0}, {800, 600}};
-
-  VkPipelineViewportStateCreateInfo viewport_state_create_info = {};
-  viewport_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewport_state_create_info.viewportCount = 1;
-  viewport_state_create_info.pViewports = &viewport;
-  viewport_state_create_info.scissorCount = 1;
-  viewport_state_create_info.pScissors = &scissor;
-
-  VkPipelineRasterizationStateCreateInfo rasterization_state_create_info = {};
-  rasterization_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterization_state_create_info.depthClampEnable = VK_FALSE;
-  rasterization_state_create_info.rasterizerDiscardEnable = VK_FALSE;
-  rasterization_state_create_info.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterization_state_create_info.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterization_state_create_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterization_state_create_info.lineWidth = 1.0f;
-  rasterization_state_create_info.depthBiasEnable = VK_FALSE;
-
-  VkPipelineMultisampleStateCreateInfo multisample_state_create_info = {};
-  multisample_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisample_state_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisample_state_create_info.minSampleShading = 1.0f;
-  multisample_state_create_info.sampleShadingEnable = VK_FALSE;
-
-  VkPipelineColorBlendAttachmentState color_blend_attachment_state = {
-      VK_FALSE,
-      VK_BLEND_FACTOR_ONE,
-      VK_BLEND_FACTOR_ZERO,
-      VK_BLEND_OP_ADD,
-      VK_BLEND_FACTOR_ONE,
-      VK_BLEND_FACTOR_ZERO,
-      VK_BLEND_OP_ADD,
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
-
-  VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {};
-  color_blend_state_create_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  color_blend_state_create_info.logicOp = VK_LOGIC_OP_COPY;
-  color_blend_state_create_info.attachmentCount = 1;
-  color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
-
-  Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>
-      pipeline_layout = CreatePipelineLayout();
-  if (!pipeline_layout) {
-    return false;
+bool HelloTriangle::CreateRenderGraph() {
+  // The swap chain image is the only result of the frame; the render pass
+  // and the barriers around it are derived from how the pass uses it
+  RenderGraph& render_graph = GetRenderGraph();
+  render_graph.Reset();
+
+  // Acquired images are waited for at the color attachment output stage,
+  // which is also where the readback of headless mode picks them up
+  RenderGraphImageState initial_state;
+  initial_state.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  RenderGraphImageState final_state;
+  final_state.Layout = GetSwapChain().FinalLayout;
+  final_state.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  if (GetPresentQueue().Handle != GetGraphicsQueue().Handle) {
+    final_state.QueueFamilyIndex = GetPresentQueue().FamilyIndex;
   }
-
-  VkGraphicsPipelineCreateInfo pipeline_create_info = {};
-  pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipeline_create_info.stageCount = shader_stage_create_infos.size();
-  pipeline_create_info.pStages = shader_stage_create_infos.data();
-  pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
-  pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
-  pipeline_create_info.pViewportState = &viewport_state_create_info;
-  pipeline_create_info.pRasterizationState = &rasterization_state_create_info;
-  pipeline_create_info.pMultisampleState = &multisample_state_create_info;
-  pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
-  pipeline_create_info.layout = pipeline_layout.Get();
-  pipeline_create_info.renderPass = render_pass_;
-
-  if (vkCreateGraphicsPipelines(GetDevice(), VK_NULL_HANDLE, 1,
-                                &pipeline_create_info, nullptr,
-                                &graphics_pipeline_) != VK_SUCCESS) {
-    std::cout << "Could not create graphics pipeline!" << std::endl;
+  swap_chain_image_ = render_graph.ImportImage(
+      "Swap chain", GetSwapChain().Format, GetSwapChain().Extent,
+      initial_state, final_state);
+
+  VkClearColorValue clear_color = {{0.2f, 0.3f, 0.3f, 1.0f}};
+  triangle_pass_ = render_graph.AddPass(
+      "Triangle", [this](VkCommandBuffer command_buffer) {
+        RecordTrianglePass(command_buffer);
+      });
+  render_graph.AddColorOutput(triangle_pass_, swap_chain_image_,
+                              VK_ATTACHMENT_LOAD_OP_CLEAR, clear_color);
+
+  if (!render_graph.Compile()) {
+    std::cout << "Could not compile render graph!" << std::endl;
     return false;
   }
+  render_pass_ = render_graph.GetRenderPass(triangle_pass_);
+  render_pass_format_ = GetSwapChain().Format;
   return true;
 }
 
-Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-HelloTriangle::CreateShaderModule(const char* filename) {
-  const std::vector<char> code = Tools::GetBinaryFileContents(filename);
-  if (code.size() == 0) {
-    return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>();
-  }
-
-  VkShaderModuleCreateInfo shader_module_create_info = {};
-  shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  shader_module_create_info.codeSize = code.size();
-  shader_module_create_info.pCode =
-      reinterpret_cast<const uint32_t*>(code.data());
-
-  VkShaderModule shader_module;
-  if (vkCreateShaderModule(GetDevice(), &shader_module_create_info, nullptr,
-                           &shader_module) != VK_SUCCESS) {
-    std::cout << "Could not create shader module from a \"" << filename
-              << "\" file!" << std::endl;
-    return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>();
-  }
-
-  return Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>(
-      shader_module, vkDestroyShaderModule, GetDevice());
+bool HelloTriangle::CreatePipeline() {
+  PipelineDesc desc = GetPipelineDesc();
+  graphics_pipeline_ = GetPipelineRegistry().GetPipeline(desc);
+  // With pipeline libraries this is a quickly linked pipeline, the optimized
+  // one is swapped in by UpdatePipeline() once it is compiled
+  pending_pipeline_ =
+      GetPipelineRegistry().GetPipelineAsync(desc, graphics_pipeline_);
+  return graphics_pipeline_ != VK_NULL_HANDLE;
 }
 
-Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>
-HelloTriangle::CreatePipelineLayout() {
-  VkPipelineLayoutCreateInfo layout_create_info = {};
-  layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-  VkPipelineLayout pipeline_layout;
-  if (vkCreatePipelineLayout(GetDevice(), &layout_create_info, nullptr,
-                             &pipeline_layout) != VK_SUCCESS) {
-    std::cout << "Could not create pipeline layout!" << std::endl;
-    return Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>();
-  }
-
-  return Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>(
-      pipeline_layout, vkDestroyPipelineLayout, GetDevice());
+PipelineDesc HelloTriangle::GetPipelineDesc() const {
+  // Vertex attributes and the layout are derived from the shaders; the
+  // stride is checked so Vertex can't get out of sync with the GLSL
+  PipelineDesc desc;
+  desc.VertexShader = "2.2.hello_triangle_vertex/shader.vert";
+  desc.FragmentShader = "2.2.hello_triangle_vertex/shader.frag";
+  desc.VertexStride = sizeof(Vertex);
+  desc.SetConstant(0, grayscale_ ? VK_TRUE : VK_FALSE);
+  desc.ColorFormat = render_pass_format_;
+  desc.RenderPass = render_pass_;
+  return desc;
 }
 
-bool HelloTriangle::CreateSemaphores() {
-  VkSemaphoreCreateInfo semaphore_create_info = {};
-  semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-  if ((vkCreateSemaphore(GetDevice(), &semaphore_create_info, nullptr,
-                         &image_available_semaphore_) != VK_SUCCESS) ||
-      (vkCreateSemaphore(GetDevice(), &semaphore_create_info, nullptr,
-                         &rendering_finished_femaphore_) != VK_SUCCESS)) {
-    std::cout << "Could not create semaphores!" << std::endl;
-    return false;
-  }
+void HelloTriangle::SetGrayscale(bool grayscale) { grayscale_ = grayscale; }
 
-  return true;
+void HelloTriangle::SetRecordEveryFrame(bool record_every_frame) {
+  record_every_frame_ = record_every_frame;
 }
 
 bool HelloTriangle::CreateCommandBuffers() {
+  // Frame slots of VulkanCommon own the command buffers in this mode
+  if (record_every_frame_) {
+    return true;
+  }
   if (!CreateCommandPool(GetGraphicsQueue().FamilyIndex,
                          &graphics_command_pool_)) {
     std::cout << "Could not create command pool!" << std::endl;
@@ -289,6 +100,9 @@ bool HelloTriangle::CreateCommandPool(uint32_t queue_family_index,
                                       VkCommandPool* pool) {
   VkCommandPoolCreateInfo cmd_pool_create_info = {};
   cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  // Prerecorded command buffers are re-recorded one at a time when a
+  // reloaded pipeline replaces the one they use
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   cmd_pool_create_info.queueFamilyIndex = queue_family_index;
 
   if (vkCreateCommandPool(GetDevice(), &cmd_pool_create_info, nullptr, pool) !=
@@ -315,140 +129,182 @@ bool HelloTriangle::AllocateCommandBuffers(VkCommandPool pool, uint32_t count,
 }
 
 bool HelloTriangle::RecordCommandBuffers() {
+  // Recorded every frame by Draw() instead
+  if (record_every_frame_) {
+    return true;
+  }
+  for (size_t i = 0; i < graphics_command_buffers_.size(); ++i) {
+    if (!RecordCommandBuffer(graphics_command_buffers_[i],
+                             static_cast<uint32_t>(i),
+                             VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT)) {
+      return false;
+    }
+  }
+  recorded_pipelines_.assign(graphics_command_buffers_.size(),
+                             graphics_pipeline_);
+  return true;
+}
+
+bool HelloTriangle::RecordCommandBuffer(VkCommandBuffer command_buffer,
+                                        uint32_t image_index,
+                                        VkCommandBufferUsageFlags usage) {
   VkCommandBufferBeginInfo graphics_commandd_buffer_begin_info = {};
   graphics_commandd_buffer_begin_info.sType =
       VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  graphics_commandd_buffer_begin_info.flags =
-      VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+  graphics_commandd_buffer_begin_info.flags = usage;
+
+  const ImageParameters& image = GetSwapChain().Images[image_index];
+
+  vkBeginCommandBuffer(command_buffer, &graphics_commandd_buffer_begin_info);
+
+  // Profiler slots follow swap chain images in both recording modes; an
+  // image is only recorded again once its previous frame has completed
+  uint32_t slot = image_index;
+  GetProfiler().BeginSlot(slot, command_buffer);
+  uint32_t frame_scope =
+      GetProfiler().BeginScope(slot, command_buffer, "Frame");
+
+  // Layout transitions and the ownership transfer to the present queue are
+  // recorded by the render graph around the pass
+  GetRenderGraph().SetImage(swap_chain_image_, image.Handle, image.View);
+  bool result = false;
+  {
+    GpuProfileScope render_graph_scope(GetProfiler(), slot, command_buffer,
+                                       "Render graph");
+    result = GetRenderGraph().Execute(command_buffer);
+  }
 
-  VkImageSubresourceRange image_subresource_range = {};
-  image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  image_subresource_range.levelCount = 1;
-  image_subresource_range.layerCount = 1;
+  GetProfiler().EndScope(slot, command_buffer, frame_scope);
+  if ((vkEndCommandBuffer(command_buffer) != VK_SUCCESS) || !result) {
+    std::cout << "Could not record command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
 
-  VkClearValue clear_value = {{0.2f, 0.3f, 0.3f, 1.0f}};
+void HelloTriangle::RecordTrianglePass(VkCommandBuffer command_buffer) {
+  const VkExtent2D& extent = GetSwapChain().Extent;
 
-  const std::vector<ImageParameters>& swap_chain_images = GetSwapChain().Images;
+  VkViewport viewport = {0.0f,
+                         0.0f,
+                         static_cast<float>(extent.width),
+                         static_cast<float>(extent.height),
+                         0.0f,
+                         1.0f};
 
-  for (size_t i = 0; i < graphics_command_buffers_.size(); ++i) {
-    vkBeginCommandBuffer(graphics_command_buffers_[i],
-                         &graphics_commandd_buffer_begin_info);
-
-    if (GetPresentQueue().Handle != GetGraphicsQueue().Handle) {
-      VkImageMemoryBarrier barrier_from_present_to_draw = {};
-      barrier_from_present_to_draw.sType =
-          VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-      barrier_from_present_to_draw.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-      barrier_from_present_to_draw.dstAccessMask =
-          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-      barrier_from_present_to_draw.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-      barrier_from_present_to_draw.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-      barrier_from_present_to_draw.srcQueueFamilyIndex =
-          GetPresentQueue().FamilyIndex;
-      barrier_from_present_to_draw.dstQueueFamilyIndex =
-          GetGraphicsQueue().FamilyIndex;
-      barrier_from_present_to_draw.image = swap_chain_images[i].Handle;
-      barrier_from_present_to_draw.subresourceRange = image_subresource_range;
-      vkCmdPipelineBarrier(graphics_command_buffers_[i],
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
-                           nullptr, 0, nullptr, 1,
-                           &barrier_from_present_to_draw);
-    }
+  VkRect2D scissor = {{0, 0}, extent};
 
-    VkRenderPassBeginInfo render_pass_begin_info = {};
-    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_begin_info.renderPass = render_pass_;
-    render_pass_begin_info.framebuffer = framebuffers_[i];
-    render_pass_begin_info.renderArea = {{0, 0}, {800, 600}};
-    render_pass_begin_info.clearValueCount = 1;
-    render_pass_begin_info.pClearValues = &clear_value;
-
-    vkCmdBeginRenderPass(graphics_command_buffers_[i], &render_pass_begin_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdBindPipeline(graphics_command_buffers_[i],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_);
-
-    vkCmdDraw(graphics_command_buffers_[i], 3, 1, 0, 0);
-
-    vkCmdEndRenderPass(graphics_command_buffers_[i]);
-
-    if (GetGraphicsQueue().Handle != GetPresentQueue().Handle) {
-      VkImageMemoryBarrier barrier_from_draw_to_present = {};
-      barrier_from_draw_to_present.sType =
-          VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-      barrier_from_draw_to_present.srcAccessMask =
-          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-      barrier_from_draw_to_present.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-      barrier_from_draw_to_present.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-      barrier_from_draw_to_present.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-      barrier_from_draw_to_present.srcQueueFamilyIndex =
-          GetGraphicsQueue().FamilyIndex;
-      barrier_from_draw_to_present.dstQueueFamilyIndex =
-          GetPresentQueue().FamilyIndex;
-      barrier_from_draw_to_present.image = swap_chain_images[i].Handle;
-      barrier_from_draw_to_present.subresourceRange = image_subresource_range;
-
-      vkCmdPipelineBarrier(graphics_command_buffers_[i],
-                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
-                           0, nullptr, 1, &barrier_from_draw_to_present);
-    }
-    if (vkEndCommandBuffer(graphics_command_buffers_[i]) != VK_SUCCESS) {
-      std::cout << "Could not record command buffer!" << std::endl;
-      return false;
-    }
-  }
-  return true;
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    graphics_pipeline_);
+
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+  VkDeviceSize vertex_buffer_offset = 0;
+  vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertex_buffer_.Handle,
+                         &vertex_buffer_offset);
+
+  vkCmdDraw(command_buffer, 3, 1, 0, 0);
 }
 
 void HelloTriangle::ChildClear() {
   if (GetDevice() != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(GetDevice());
-
-    if ((graphics_command_buffers_.size() > 0) &&
-        (graphics_command_buffers_[0] != VK_NULL_HANDLE)) {
-      vkFreeCommandBuffers(
-          GetDevice(), graphics_command_pool_,
-          static_cast<uint32_t>(graphics_command_buffers_.size()),
-          graphics_command_buffers_.data());
-      graphics_command_buffers_.clear();
-    }
+    // Frames in flight may still reference these objects so they are
+    // destroyed once the graphics timeline passes the last submission
+    VkDevice device = GetDevice();
+    VkCommandPool command_pool = graphics_command_pool_;
+
+    GetGraphicsTimeline().DeferRelease([=]() {
+      // Destroying the pool frees its command buffers as well
+      if (command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, command_pool, nullptr);
+      }
+    });
 
-    if (graphics_command_pool_ != VK_NULL_HANDLE) {
-      vkDestroyCommandPool(GetDevice(), graphics_command_pool_, nullptr);
-      graphics_command_pool_ = VK_NULL_HANDLE;
-    }
+    graphics_command_buffers_.clear();
+    recorded_pipelines_.clear();
+    graphics_command_pool_ = VK_NULL_HANDLE;
+  }
+}
+
+void HelloTriangle::ChildOnShadersReloaded(
+    const std::vector<std::string>& /*names*/) {
+  // Only this demo's shaders are watched, so any of them affects the pipeline
+  rebuild_pipeline_ = true;
+}
 
-    if (graphics_pipeline_ != VK_NULL_HANDLE) {
-      vkDestroyPipeline(GetDevice(), graphics_pipeline_, nullptr);
-      graphics_pipeline_ = VK_NULL_HANDLE;
+void HelloTriangle::UpdatePipeline() {
+  if (pending_pipeline_.IsValid()) {
+    // The fast-linked pipeline is used while the optimized one compiles; a
+    // failed build keeps the current pipeline, e.g. after a shader edit
+    // broke the interface
+    bool ready = pending_pipeline_.IsReady();
+    graphics_pipeline_ = pending_pipeline_.Get();
+    if ((replaced_pipeline_ != VK_NULL_HANDLE) &&
+        (graphics_pipeline_ != replaced_pipeline_)) {
+      retired_pipelines_.push_back(replaced_pipeline_);
+      replaced_pipeline_ = VK_NULL_HANDLE;
+    }
+    if (ready) {
+      pending_pipeline_.Reset();
+      replaced_pipeline_ = VK_NULL_HANDLE;
     }
+  }
+  if (rebuild_pipeline_ && !pending_pipeline_.IsValid()) {
+    rebuild_pipeline_ = false;
+    replaced_pipeline_ = graphics_pipeline_;
+    pending_pipeline_ = GetPipelineRegistry().GetPipelineAsync(
+        GetPipelineDesc(), graphics_pipeline_);
+  }
+  ReleaseRetiredPipelines();
+}
 
-    if (render_pass_ != VK_NULL_HANDLE) {
-      vkDestroyRenderPass(GetDevice(), render_pass_, nullptr);
-      render_pass_ = VK_NULL_HANDLE;
+void HelloTriangle::ReleaseRetiredPipelines() {
+  // Prerecorded command buffers are re-recorded by Draw() one at a time;
+  // the registry destroys a released pipeline only after the frames
+  // submitted so far, which covers recording every frame
+  for (size_t i = 0; i < retired_pipelines_.size();) {
+    if (std::find(recorded_pipelines_.begin(), recorded_pipelines_.end(),
+                  retired_pipelines_[i]) != recorded_pipelines_.end()) {
+      ++i;
+      continue;
     }
+    GetPipelineRegistry().Release(retired_pipelines_[i]);
+    retired_pipelines_.erase(retired_pipelines_.begin() + i);
+  }
+}
 
-    for (size_t i = 0; i < framebuffers_.size(); ++i) {
-      if (framebuffers_[i] != VK_NULL_HANDLE) {
-        vkDestroyFramebuffer(GetDevice(), framebuffers_[i], nullptr);
-        framebuffers_[i] = VK_NULL_HANDLE;
-      }
+void HelloTriangle::ReleasePipeline() {
+  // A background rebuild uses the render pass, so it has to finish first;
+  // render passes are owned by the render graph. The pipelines can't be
+  // used with another render pass, so they go back to the registry
+  VkPipeline pending_pipeline = pending_pipeline_.Wait();
+  pending_pipeline_.Reset();
+  for (VkPipeline pipeline :
+       {graphics_pipeline_, replaced_pipeline_, pending_pipeline}) {
+    if ((pipeline != VK_NULL_HANDLE) &&
+        (std::find(retired_pipelines_.begin(), retired_pipelines_.end(),
+                   pipeline) == retired_pipelines_.end())) {
+      retired_pipelines_.push_back(pipeline);
     }
-    framebuffers_.clear();
   }
+  graphics_pipeline_ = VK_NULL_HANDLE;
+  replaced_pipeline_ = VK_NULL_HANDLE;
+  ReleaseRetiredPipelines();
 }
 
 bool HelloTriangle::ChildOnWindowSizeChanged() {
-  if (!CreateRenderPass()) {
-    return false;
+  // Pipeline only depends on the swap chain through the render pass format,
+  // so it is rebuilt only when the surface format changes; the graph is
+  // described again for the new images and extent
+  bool format_changed = render_pass_format_ != GetSwapChain().Format;
+  if (format_changed) {
+    ReleasePipeline();
   }
-  if (!CreateFramebuffers()) {
+  if (!CreateRenderGraph()) {
     return false;
   }
-  if (!CreatePipeline()) {
+  if (format_changed && !CreatePipeline()) {
     return false;
   }
   if (!CreateCommandBuffers()) {
@@ -463,69 +319,62 @@ bool HelloTriangle::ChildOnWindowSizeChanged() {
 
 HelloTriangle::~HelloTriangle() {
   ChildClear();
+  ReleasePipeline();
 
   if (GetDevice() != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(GetDevice());
+    VkDevice device = GetDevice();
+    GpuAllocator* allocator = &GetAllocator();
+    BufferParameters vertex_buffer = vertex_buffer_;
 
-    if (image_available_semaphore_ != VK_NULL_HANDLE) {
-      vkDestroySemaphore(GetDevice(), image_available_semaphore_, nullptr);
-    }
-
-    if (rendering_finished_femaphore_ != VK_NULL_HANDLE) {
-      vkDestroySemaphore(GetDevice(), rendering_finished_femaphore_, nullptr);
-    }
+    GetGraphicsTimeline().DeferRelease([=]() mutable {
+      if (vertex_buffer.Handle != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, vertex_buffer.Handle, nullptr);
+      }
+      allocator->Free(vertex_buffer.Memory);
+    });
   }
 }
 
 HelloTriangle::HelloTriangle() {}
 
 bool HelloTriangle::Draw() {
-  VkSwapchainKHR swap_chain = GetSwapChain().Handle;
+  TraceZone zone("Draw");
   uint32_t image_index;
 
-  VkResult result = vkAcquireNextImageKHR(GetDevice(), swap_chain, UINT64_MAX,
-                                          image_available_semaphore_,
-                                          VK_NULL_HANDLE, &image_index);
+  VkResult result = AcquireFrame(&image_index);
   switch (result) {
     case VK_SUCCESS:
-    case VK_SUBOPTIMAL_KHR:
       break;
     case VK_ERROR_OUT_OF_DATE_KHR:
       return OnWindowSizeChanged();
     default:
-      std::cout << "Problem occurred during swap chain image acquisition!"
-                << std::endl;
       return false;
   }
-
-  VkPipelineStageFlags wait_dst_stage_mask =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-  VkSubmitInfo submit_info = {};
-  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_info.waitSemaphoreCount = 1;
-  submit_info.pWaitSemaphores = &image_available_semaphore_;
-  submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
-  submit_info.commandBufferCount = 1;
-  submit_info.pCommandBuffers = &graphics_command_buffers_[image_index];
-  submit_info.signalSemaphoreCount = 1;
-  submit_info.pSignalSemaphores = &rendering_finished_femaphore_;
-
-  if (vkQueueSubmit(GetGraphicsQueue().Handle, 1, &submit_info,
-                    VK_NULL_HANDLE) != VK_SUCCESS) {
-    return false;
+  UpdatePipeline();
+
+  // Per frame recording reuses the frame slot's command buffer, its pool was
+  // reset by AcquireFrame()
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  if (record_every_frame_) {
+    command_buffer = GetCurrentFrame().CommandBuffer;
+    if (!RecordCommandBuffer(command_buffer, image_index,
+                             VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT)) {
+      return false;
+    }
+  } else {
+    command_buffer = graphics_command_buffers_[image_index];
+    // AcquireFrame() waited for the image's previous frame, so its command
+    // buffer can be re-recorded once the pipeline changed
+    if (recorded_pipelines_[image_index] != graphics_pipeline_) {
+      if (!RecordCommandBuffer(command_buffer, image_index,
+                               VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT)) {
+        return false;
+      }
+      recorded_pipelines_[image_index] = graphics_pipeline_;
+    }
   }
 
-  VkPresentInfoKHR present_info = {};
-  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  present_info.waitSemaphoreCount = 1;
-  present_info.pWaitSemaphores = &rendering_finished_femaphore_;
-  present_info.swapchainCount = 1;
-  present_info.pSwapchains = &swap_chain;
-  present_info.pImageIndices = &image_index;
-
-  result = vkQueuePresentKHR(GetPresentQueue().Handle, &present_info);
-
+  result = SubmitFrame(image_index, command_buffer);
   switch (result) {
     case VK_SUCCESS:
       break;
@@ -533,7 +382,6 @@ bool HelloTriangle::Draw() {
     case VK_SUBOPTIMAL_KHR:
       return OnWindowSizeChanged();
     default:
-      std::cout << "Problem occurred during image presentation!" << std::endl;
       return false;
   }
   return true;
@@ -557,44 +405,14 @@ bool HelloTriangle::CreateVertexBuffer() {
           0.0f,
       }},
   };
-  VkBufferCreateInfo buffer_info{};
-  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  buffer_info.size = sizeof(vertices[0]) * vertices.size();
-  buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  if (vkCreateBuffer(GetDevice(), &buffer_info, nullptr, &vertex_buffer_) !=
-      VK_SUCCESS) {
-    return false;
-  }
-  if (vkCreateBuffer(GetDevice(), &buffer_info, nullptr,
-                     &vertex_buffer_) != VK_SUCCESS) {
+  // Vertex fetch reads from device local memory; the data is copied there
+  // through the staging ring ahead of the first frame
+  if (!CreateDeviceLocalBuffer(vertices.data(),
+                               sizeof(vertices[0]) * vertices.size(),
+                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                               &vertex_buffer_)) {
     std::cout << "Could not create a vertex buffer!" << std::endl;
     return false;
   }
+  return true;
 }
-
- bool HelloTriangle::AllocateBufferMemory( VkBuffer buffer, VkDeviceMemory *memory ) {
-    VkMemoryRequirements buffer_memory_requirements;
-    vkGetBufferMemoryRequirements( GetDevice(), buffer, &buffer_memory_requirements );
-
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties( GetPhysicalDevice(), &memory_properties );
-
-    for( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i ) {
-      if( (buffer_memory_requirements.memoryTypeBits & (1 << i)) &&
-        (memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ) {
-
-        VkMemoryAllocateInfo memory_allocate_info = {
-          VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,     // VkStructureType                        sType
-          nullptr,                                    // const void                            *pNext
-          buffer_memory_requirements.size,            // VkDeviceSize                           allocationSize
-          i                                           // uint32_t                               memoryTypeIndex
-        };
-
-        if( vkAllocateMemory( GetDevice(), &memory_allocate_info, nullptr, memory ) == VK_SUCCESS ) {
-          return true;
-        }
-      }
-    }
-    return false;
-  }
@@ -1,6 +1,7 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <string>
 #include <vector>
 
 #include "common/tools.h"
@@ -14,10 +15,18 @@ class HelloTriangle : public VulkanCommon {
  public:
   HelloTriangle();
   ~HelloTriangle();
-  bool CreateRenderPass();
-  bool CreateFramebuffers();
+  // Describes the frame to the render graph, which provides the render pass;
+  // called again whenever the swap chain changes
+  bool CreateRenderGraph();
   bool CreatePipeline();
-  bool CreateSemaphores();
+  // Selects the grayscale specialization of the fragment shader; must be set
+  // before CreatePipeline()
+  void SetGrayscale(bool grayscale);
+  // Command buffers are recorded every frame with ONE_TIME_SUBMIT by
+  // default; false prerecords one per swap chain image with
+  // SIMULTANEOUS_USE, only kept as the baseline of the recording benchmark.
+  // Must be set before CreateCommandBuffers()
+  void SetRecordEveryFrame(bool record_every_frame);
   bool CreateCommandBuffers();
   bool CreateVertexBuffer();
   bool RecordCommandBuffers();
@@ -26,20 +35,39 @@ class HelloTriangle : public VulkanCommon {
  private:
   void ChildClear() override;
   bool ChildOnWindowSizeChanged() override;
-  Tools::AutoDeleter<VkShaderModule, PFN_vkDestroyShaderModule>
-  CreateShaderModule(const char* filename);
-  Tools::AutoDeleter<VkPipelineLayout, PFN_vkDestroyPipelineLayout>
-  CreatePipelineLayout();
+  void ChildOnShadersReloaded(const std::vector<std::string>& names) override;
+  PipelineDesc GetPipelineDesc() const;
+  // Swaps in a pipeline rebuilt in the background once it is ready and
+  // starts a rebuild when shaders were reloaded; called at frame boundaries
+  void UpdatePipeline();
+  // Hands retired pipelines back to the registry once no prerecorded
+  // command buffer binds them anymore
+  void ReleaseRetiredPipelines();
+  void ReleasePipeline();
   bool CreateCommandPool(uint32_t queue_family_index, VkCommandPool* pool);
   bool AllocateCommandBuffers(VkCommandPool pool, uint32_t count,
                               VkCommandBuffer* command_buffers);
-  bool AllocateBufferMemory( VkBuffer buffer, VkDeviceMemory *memory );
-  VkRenderPass render_pass_;
-  std::vector<VkFramebuffer> framebuffers_;
-  VkPipeline graphics_pipeline_;
-  VkSemaphore image_available_semaphore_;
-  VkSemaphore rendering_finished_femaphore_;
-  VkCommandPool graphics_command_pool_;
+  bool RecordCommandBuffer(VkCommandBuffer command_buffer, uint32_t image_index,
+                           VkCommandBufferUsageFlags usage);
+  // Called by the render graph inside the pass's render pass
+  void RecordTrianglePass(VkCommandBuffer command_buffer);
+  VkRenderPass render_pass_ = VK_NULL_HANDLE;
+  VkFormat render_pass_format_ = VK_FORMAT_UNDEFINED;
+  // Render graph handles, valid until the next CreateRenderGraph()
+  uint32_t swap_chain_image_ = 0;
+  uint32_t triangle_pass_ = 0;
+  VkPipeline graphics_pipeline_ = VK_NULL_HANDLE;
+  VkCommandPool graphics_command_pool_ = VK_NULL_HANDLE;
   std::vector<VkCommandBuffer> graphics_command_buffers_;
-  VkBuffer vertex_buffer_;
+  // Pipeline each prerecorded command buffer was recorded with
+  std::vector<VkPipeline> recorded_pipelines_;
+  PipelineFuture pending_pipeline_;
+  // Pipeline a running rebuild replaces once the rebuilt one is usable
+  VkPipeline replaced_pipeline_ = VK_NULL_HANDLE;
+  // Replaced pipelines not yet released to the registry
+  std::vector<VkPipeline> retired_pipelines_;
+  bool rebuild_pipeline_ = false;
+  BufferParameters vertex_buffer_;
+  bool record_every_frame_ = true;
+  bool grayscale_ = false;
 };
@@ -0,0 +1,566 @@
+#include "async_upload_engine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Staging offsets are kept aligned so copies stay friendly to DMA engines and
+// satisfy texel block alignment of common image formats
+static const VkDeviceSize kStagingAlignment = 16;
+
+AsyncUploadEngine::AsyncUploadEngine()
+    : device_(VK_NULL_HANDLE),
+      transfer_timeline_(nullptr),
+      graphics_timeline_(nullptr),
+      transfer_queue_(VK_NULL_HANDLE),
+      graphics_queue_(VK_NULL_HANDLE),
+      transfer_queue_family_index_(0),
+      graphics_queue_family_index_(0),
+      transfer_command_pool_(VK_NULL_HANDLE),
+      graphics_command_pool_(VK_NULL_HANDLE),
+      free_transfer_command_buffers_(),
+      free_graphics_command_buffers_(),
+      staging_ring_(),
+      pending_(),
+      batches_(),
+      next_ticket_(1),
+      ready_ticket_(0) {}
+
+AsyncUploadEngine::~AsyncUploadEngine() { Destroy(); }
+
+bool AsyncUploadEngine::Create(VkDevice device, GpuAllocator *allocator,
+                               TimelineScheduler *transfer_timeline,
+                               VkQueue transfer_queue,
+                               uint32_t transfer_queue_family_index,
+                               TimelineScheduler *graphics_timeline,
+                               VkQueue graphics_queue,
+                               uint32_t graphics_queue_family_index,
+                               VkDeviceSize staging_size) {
+  device_ = device;
+  transfer_timeline_ = transfer_timeline;
+  graphics_timeline_ = graphics_timeline;
+  transfer_queue_ = transfer_queue;
+  graphics_queue_ = graphics_queue;
+  transfer_queue_family_index_ = transfer_queue_family_index;
+  graphics_queue_family_index_ = graphics_queue_family_index;
+
+  VkCommandPoolCreateInfo cmd_pool_create_info = {};
+  cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                               VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  cmd_pool_create_info.queueFamilyIndex = transfer_queue_family_index_;
+
+  if (vkCreateCommandPool(device_, &cmd_pool_create_info, nullptr,
+                          &transfer_command_pool_) != VK_SUCCESS) {
+    std::cout << "Could not create command pool for transfer queue!"
+              << std::endl;
+    return false;
+  }
+
+  if (OwnershipTransfer()) {
+    cmd_pool_create_info.queueFamilyIndex = graphics_queue_family_index_;
+    if (vkCreateCommandPool(device_, &cmd_pool_create_info, nullptr,
+                            &graphics_command_pool_) != VK_SUCCESS) {
+      std::cout << "Could not create command pool for ownership transfers!"
+                << std::endl;
+      return false;
+    }
+  }
+
+  pending_ = Batch();
+  pending_.Ticket = next_ticket_;
+  return staging_ring_.Create(device_, allocator, staging_size);
+}
+
+void AsyncUploadEngine::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  for (const Batch &batch : batches_) {
+    transfer_timeline_->Wait(batch.TransferValue);
+    if (batch.GraphicsValue != 0) {
+      graphics_timeline_->Wait(batch.GraphicsValue);
+    }
+  }
+  batches_.clear();
+  pending_ = Batch();
+  free_transfer_command_buffers_.clear();
+  free_graphics_command_buffers_.clear();
+
+  if (transfer_command_pool_ != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(device_, transfer_command_pool_, nullptr);
+    transfer_command_pool_ = VK_NULL_HANDLE;
+  }
+  if (graphics_command_pool_ != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(device_, graphics_command_pool_, nullptr);
+    graphics_command_pool_ = VK_NULL_HANDLE;
+  }
+  staging_ring_.Destroy();
+  device_ = VK_NULL_HANDLE;
+}
+
+bool AsyncUploadEngine::UploadBuffer(VkBuffer buffer, VkDeviceSize offset,
+                                     const void *data, VkDeviceSize size,
+                                     VkPipelineStageFlags dst_stage,
+                                     VkAccessFlags dst_access,
+                                     uint64_t *ticket) {
+  const char *source = static_cast<const char *>(data);
+  while (size > 0) {
+    VkDeviceSize chunk_size = std::min(size, staging_ring_.GetSize());
+    VkDeviceSize staging_offset;
+    if (!AllocateStaging(chunk_size, &staging_offset)) {
+      return false;
+    }
+    memcpy(staging_ring_.GetMapped(staging_offset), source,
+           static_cast<size_t>(chunk_size));
+
+    BufferCopy copy;
+    copy.Buffer = buffer;
+    copy.Region.srcOffset = staging_offset;
+    copy.Region.dstOffset = offset;
+    copy.Region.size = chunk_size;
+    copy.DstStage = dst_stage;
+    copy.DstAccess = dst_access;
+    pending_.BufferCopies.push_back(copy);
+
+    source += chunk_size;
+    offset += chunk_size;
+    size -= chunk_size;
+  }
+  if (ticket != nullptr) {
+    *ticket = pending_.Ticket;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::UploadImage(VkImage image, VkImageAspectFlags aspect,
+                                    uint32_t mip_level, VkExtent3D extent,
+                                    const void *data, VkDeviceSize size,
+                                    VkImageLayout final_layout,
+                                    VkPipelineStageFlags dst_stage,
+                                    VkAccessFlags dst_access,
+                                    uint64_t *ticket) {
+  VkDeviceSize staging_offset;
+  if (!AllocateStaging(size, &staging_offset)) {
+    return false;
+  }
+  memcpy(staging_ring_.GetMapped(staging_offset), data,
+         static_cast<size_t>(size));
+
+  ImageCopy copy;
+  copy.Image = image;
+  copy.Region.bufferOffset = staging_offset;
+  copy.Region.bufferRowLength = 0;
+  copy.Region.bufferImageHeight = 0;
+  copy.Region.imageSubresource.aspectMask = aspect;
+  copy.Region.imageSubresource.mipLevel = mip_level;
+  copy.Region.imageSubresource.baseArrayLayer = 0;
+  copy.Region.imageSubresource.layerCount = 1;
+  copy.Region.imageOffset = {0, 0, 0};
+  copy.Region.imageExtent = extent;
+  copy.FinalLayout = final_layout;
+  copy.DstStage = dst_stage;
+  copy.DstAccess = dst_access;
+  pending_.ImageCopies.push_back(copy);
+
+  if (ticket != nullptr) {
+    *ticket = pending_.Ticket;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::Flush() {
+  ReclaimBatches();
+  if (pending_.BufferCopies.empty() && pending_.ImageCopies.empty()) {
+    return true;
+  }
+
+  if (!AllocateCommandBuffer(transfer_command_pool_,
+                             free_transfer_command_buffers_,
+                             &pending_.TransferCommandBuffer)) {
+    return false;
+  }
+  if (!RecordTransfer(pending_)) {
+    free_transfer_command_buffers_.push_back(pending_.TransferCommandBuffer);
+    pending_.TransferCommandBuffer = VK_NULL_HANDLE;
+    return false;
+  }
+
+  uint64_t value = transfer_timeline_->GetNextSubmitValue();
+  VkSemaphore timeline_semaphore = transfer_timeline_->GetSemaphore();
+
+  VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {};
+  timeline_submit_info.sType =
+      VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_submit_info.signalSemaphoreValueCount = 1;
+  timeline_submit_info.pSignalSemaphoreValues = &value;
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_submit_info;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &pending_.TransferCommandBuffer;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &timeline_semaphore;
+
+  if (vkQueueSubmit(transfer_queue_, 1, &submit_info, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    std::cout << "Could not submit uploads to transfer queue!" << std::endl;
+    return false;
+  }
+  transfer_timeline_->OnSubmitted(value);
+
+  pending_.TransferValue = value;
+  pending_.RingEnd = staging_ring_.GetHead();
+  // Without a family change the transfer queue is the graphics queue and
+  // submission order alone makes the data visible
+  if (!OwnershipTransfer()) {
+    ready_ticket_ = pending_.Ticket;
+  }
+  batches_.push_back(pending_);
+
+  pending_ = Batch();
+  pending_.Ticket = ++next_ticket_;
+  return true;
+}
+
+bool AsyncUploadEngine::SubmitAcquires() {
+  if (!OwnershipTransfer()) {
+    return true;
+  }
+
+  std::vector<VkCommandBuffer> command_buffers;
+  std::vector<Batch *> acquired_batches;
+  uint64_t wait_value = 0;
+  VkPipelineStageFlags wait_dst_stage_mask = 0;
+
+  for (Batch &batch : batches_) {
+    if (batch.GraphicsValue != 0) {
+      continue;
+    }
+    // Acquires are issued in order, and only for finished transfers, so the
+    // graphics queue never stalls on the semaphore wait below
+    if (!transfer_timeline_->IsComplete(batch.TransferValue)) {
+      break;
+    }
+    if (!AllocateCommandBuffer(graphics_command_pool_,
+                               free_graphics_command_buffers_,
+                               &batch.GraphicsCommandBuffer)) {
+      return false;
+    }
+    if (!RecordAcquire(batch)) {
+      return false;
+    }
+    command_buffers.push_back(batch.GraphicsCommandBuffer);
+    acquired_batches.push_back(&batch);
+    wait_value = batch.TransferValue;
+    for (const BufferCopy &copy : batch.BufferCopies) {
+      wait_dst_stage_mask |= copy.DstStage;
+    }
+    for (const ImageCopy &copy : batch.ImageCopies) {
+      wait_dst_stage_mask |= copy.DstStage;
+    }
+  }
+  if (command_buffers.empty()) {
+    return true;
+  }
+  if (wait_dst_stage_mask == 0) {
+    wait_dst_stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  }
+
+  // Host already saw the transfer finish, but a semaphore wait is still
+  // needed for the copies to become visible to the graphics queue
+  uint64_t signal_value = graphics_timeline_->GetNextSubmitValue();
+  VkSemaphore wait_semaphore = transfer_timeline_->GetSemaphore();
+  VkSemaphore signal_semaphore = graphics_timeline_->GetSemaphore();
+
+  VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {};
+  timeline_submit_info.sType =
+      VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_submit_info.waitSemaphoreValueCount = 1;
+  timeline_submit_info.pWaitSemaphoreValues = &wait_value;
+  timeline_submit_info.signalSemaphoreValueCount = 1;
+  timeline_submit_info.pSignalSemaphoreValues = &signal_value;
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_submit_info;
+  submit_info.waitSemaphoreCount = 1;
+  submit_info.pWaitSemaphores = &wait_semaphore;
+  submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
+  submit_info.commandBufferCount = static_cast<uint32_t>(command_buffers.size());
+  submit_info.pCommandBuffers = command_buffers.data();
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &signal_semaphore;
+
+  if (vkQueueSubmit(graphics_queue_, 1, &submit_info, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    std::cout << "Could not submit ownership acquires!" << std::endl;
+    return false;
+  }
+  graphics_timeline_->OnSubmitted(signal_value);
+
+  for (Batch *batch : acquired_batches) {
+    batch->GraphicsValue = signal_value;
+    ready_ticket_ = batch->Ticket;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::IsReady(uint64_t ticket) const {
+  return ticket <= ready_ticket_;
+}
+
+bool AsyncUploadEngine::AllocateStaging(VkDeviceSize size,
+                                        VkDeviceSize *offset) {
+  for (;;) {
+    ReclaimBatches();
+    if (staging_ring_.Allocate(size, kStagingAlignment, offset)) {
+      return true;
+    }
+
+    // Ring is full: push out what was staged so far, then wait for the
+    // oldest batch to give its space back
+    if (!pending_.BufferCopies.empty() || !pending_.ImageCopies.empty()) {
+      if (!Flush()) {
+        return false;
+      }
+      continue;
+    }
+    if (batches_.empty()) {
+      std::cout << "Upload does not fit into the staging buffer!" << std::endl;
+      return false;
+    }
+
+    const Batch &oldest = batches_.front();
+    bool waited = true;
+    if (!transfer_timeline_->IsComplete(oldest.TransferValue)) {
+      waited = transfer_timeline_->Wait(oldest.TransferValue);
+    } else if (OwnershipTransfer() && (oldest.GraphicsValue == 0)) {
+      waited = SubmitAcquires();
+    } else if (OwnershipTransfer()) {
+      waited = graphics_timeline_->Wait(oldest.GraphicsValue);
+    }
+    if (!waited) {
+      std::cout << "Waiting for an upload batch failed!" << std::endl;
+      return false;
+    }
+  }
+}
+
+void AsyncUploadEngine::ReclaimBatches() {
+  while (!batches_.empty()) {
+    Batch &batch = batches_.front();
+    if (!transfer_timeline_->IsComplete(batch.TransferValue)) {
+      break;
+    }
+    if (OwnershipTransfer() &&
+        ((batch.GraphicsValue == 0) ||
+         !graphics_timeline_->IsComplete(batch.GraphicsValue))) {
+      break;
+    }
+    staging_ring_.Release(batch.RingEnd);
+    free_transfer_command_buffers_.push_back(batch.TransferCommandBuffer);
+    if (batch.GraphicsCommandBuffer != VK_NULL_HANDLE) {
+      free_graphics_command_buffers_.push_back(batch.GraphicsCommandBuffer);
+    }
+    batches_.pop_front();
+  }
+  if (batches_.empty() && pending_.BufferCopies.empty() &&
+      pending_.ImageCopies.empty()) {
+    staging_ring_.Reset();
+  }
+}
+
+bool AsyncUploadEngine::AllocateCommandBuffer(
+    VkCommandPool pool, std::vector<VkCommandBuffer> &free_buffers,
+    VkCommandBuffer *command_buffer) {
+  // Reused buffers are reset implicitly by vkBeginCommandBuffer thanks to
+  // the pool's reset flag
+  if (!free_buffers.empty()) {
+    *command_buffer = free_buffers.back();
+    free_buffers.pop_back();
+    return true;
+  }
+
+  VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+  command_buffer_allocate_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_allocate_info.commandPool = pool;
+  command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  command_buffer_allocate_info.commandBufferCount = 1;
+
+  if (vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                               command_buffer) != VK_SUCCESS) {
+    std::cout << "Could not allocate upload command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::RecordTransfer(Batch &batch) {
+  VkCommandBuffer command_buffer = batch.TransferCommandBuffer;
+
+  VkCommandBufferBeginInfo command_buffer_begin_info = {};
+  command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  command_buffer_begin_info.flags =
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+
+  bool ownership_transfer = OwnershipTransfer();
+  uint32_t src_queue_family_index = ownership_transfer
+                                        ? transfer_queue_family_index_
+                                        : VK_QUEUE_FAMILY_IGNORED;
+  uint32_t dst_queue_family_index = ownership_transfer
+                                        ? graphics_queue_family_index_
+                                        : VK_QUEUE_FAMILY_IGNORED;
+
+  // Images are written from scratch, so their old contents are discarded
+  std::vector<VkImageMemoryBarrier> image_barriers(batch.ImageCopies.size());
+  for (size_t i = 0; i < batch.ImageCopies.size(); ++i) {
+    const ImageCopy &copy = batch.ImageCopies[i];
+    VkImageMemoryBarrier &barrier = image_barriers[i];
+    barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = copy.Image;
+    barrier.subresourceRange = {copy.Region.imageSubresource.aspectMask,
+                                copy.Region.imageSubresource.mipLevel, 1, 0,
+                                1};
+  }
+  if (!image_barriers.empty()) {
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, static_cast<uint32_t>(image_barriers.size()),
+                         image_barriers.data());
+  }
+
+  for (const BufferCopy &copy : batch.BufferCopies) {
+    vkCmdCopyBuffer(command_buffer, staging_ring_.GetBuffer(), copy.Buffer, 1,
+                    &copy.Region);
+  }
+  for (const ImageCopy &copy : batch.ImageCopies) {
+    vkCmdCopyBufferToImage(command_buffer, staging_ring_.GetBuffer(),
+                           copy.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &copy.Region);
+  }
+
+  // Release half of the ownership transfer; access masks of the destination
+  // queue are ignored here and belong to the acquire barrier instead
+  VkPipelineStageFlags dst_stage_mask = 0;
+  std::vector<VkBufferMemoryBarrier> buffer_barriers(
+      batch.BufferCopies.size());
+  for (size_t i = 0; i < batch.BufferCopies.size(); ++i) {
+    const BufferCopy &copy = batch.BufferCopies[i];
+    VkBufferMemoryBarrier &barrier = buffer_barriers[i];
+    barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = ownership_transfer ? 0 : copy.DstAccess;
+    barrier.srcQueueFamilyIndex = src_queue_family_index;
+    barrier.dstQueueFamilyIndex = dst_queue_family_index;
+    barrier.buffer = copy.Buffer;
+    barrier.offset = copy.Region.dstOffset;
+    barrier.size = copy.Region.size;
+    dst_stage_mask |= copy.DstStage;
+  }
+  for (size_t i = 0; i < batch.ImageCopies.size(); ++i) {
+    const ImageCopy &copy = batch.ImageCopies[i];
+    VkImageMemoryBarrier &barrier = image_barriers[i];
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = ownership_transfer ? 0 : copy.DstAccess;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = copy.FinalLayout;
+    barrier.srcQueueFamilyIndex = src_queue_family_index;
+    barrier.dstQueueFamilyIndex = dst_queue_family_index;
+    dst_stage_mask |= copy.DstStage;
+  }
+  if (ownership_transfer || (dst_stage_mask == 0)) {
+    dst_stage_mask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  }
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       dst_stage_mask, 0, 0, nullptr,
+                       static_cast<uint32_t>(buffer_barriers.size()),
+                       buffer_barriers.data(),
+                       static_cast<uint32_t>(image_barriers.size()),
+                       image_barriers.data());
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    std::cout << "Could not record transfer command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::RecordAcquire(Batch &batch) {
+  VkCommandBuffer command_buffer = batch.GraphicsCommandBuffer;
+
+  VkCommandBufferBeginInfo command_buffer_begin_info = {};
+  command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  command_buffer_begin_info.flags =
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+
+  // Acquire half mirrors the release recorded on the transfer queue; the
+  // layout transition is repeated as both halves must match
+  VkPipelineStageFlags stage_mask = 0;
+  std::vector<VkBufferMemoryBarrier> buffer_barriers(
+      batch.BufferCopies.size());
+  for (size_t i = 0; i < batch.BufferCopies.size(); ++i) {
+    const BufferCopy &copy = batch.BufferCopies[i];
+    VkBufferMemoryBarrier &barrier = buffer_barriers[i];
+    barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = copy.DstAccess;
+    barrier.srcQueueFamilyIndex = transfer_queue_family_index_;
+    barrier.dstQueueFamilyIndex = graphics_queue_family_index_;
+    barrier.buffer = copy.Buffer;
+    barrier.offset = copy.Region.dstOffset;
+    barrier.size = copy.Region.size;
+    stage_mask |= copy.DstStage;
+  }
+  std::vector<VkImageMemoryBarrier> image_barriers(batch.ImageCopies.size());
+  for (size_t i = 0; i < batch.ImageCopies.size(); ++i) {
+    const ImageCopy &copy = batch.ImageCopies[i];
+    VkImageMemoryBarrier &barrier = image_barriers[i];
+    barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = copy.DstAccess;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = copy.FinalLayout;
+    barrier.srcQueueFamilyIndex = transfer_queue_family_index_;
+    barrier.dstQueueFamilyIndex = graphics_queue_family_index_;
+    barrier.image = copy.Image;
+    barrier.subresourceRange = {copy.Region.imageSubresource.aspectMask,
+                                copy.Region.imageSubresource.mipLevel, 1, 0,
+                                1};
+    stage_mask |= copy.DstStage;
+  }
+  // Source stage matches the semaphore wait stage so the barrier chains
+  // after the wait
+  if (stage_mask == 0) {
+    stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  }
+  vkCmdPipelineBarrier(command_buffer, stage_mask, stage_mask, 0, 0, nullptr,
+                       static_cast<uint32_t>(buffer_barriers.size()),
+                       buffer_barriers.data(),
+                       static_cast<uint32_t>(image_barriers.size()),
+                       image_barriers.data());
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    std::cout << "Could not record ownership acquire!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AsyncUploadEngine::OwnershipTransfer() const {
+  return transfer_queue_family_index_ != graphics_queue_family_index_;
+}
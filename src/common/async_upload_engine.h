@@ -0,0 +1,108 @@
+#ifndef ASYNC_UPLOAD_ENGINE_H_
+#define ASYNC_UPLOAD_ENGINE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <vector>
+
+#include "gpu_allocator.h"
+#include "staging_ring.h"
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// AsyncUploadEngine                                            //
+//                                                              //
+// Streams buffer and image data on the transfer queue; once a  //
+// batch finishes, ownership of its resources is handed to the  //
+// graphics queue family with release/acquire barrier pairs     //
+// ************************************************************ //
+class AsyncUploadEngine {
+ public:
+  AsyncUploadEngine();
+  ~AsyncUploadEngine();
+  bool Create(VkDevice device, GpuAllocator *allocator,
+              TimelineScheduler *transfer_timeline, VkQueue transfer_queue,
+              uint32_t transfer_queue_family_index,
+              TimelineScheduler *graphics_timeline, VkQueue graphics_queue,
+              uint32_t graphics_queue_family_index,
+              VkDeviceSize staging_size = 16 * 1024 * 1024);
+  void Destroy();
+  // Stages a copy into buffer; dst_stage and dst_access describe how the
+  // graphics queue uses the buffer afterwards. The ticket becomes ready once
+  // the graphics queue owns the data
+  bool UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data,
+                    VkDeviceSize size, VkPipelineStageFlags dst_stage,
+                    VkAccessFlags dst_access, uint64_t *ticket);
+  // Stages a copy into a single mip level of a 2D image whose previous
+  // contents are discarded; the image ends up in final_layout. Data must fit
+  // into the staging ring and texel blocks have to divide 16 bytes
+  bool UploadImage(VkImage image, VkImageAspectFlags aspect,
+                   uint32_t mip_level, VkExtent3D extent, const void *data,
+                   VkDeviceSize size, VkImageLayout final_layout,
+                   VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+                   uint64_t *ticket);
+  // Submits staged copies to the transfer queue
+  bool Flush();
+  // Submits acquire barriers on the graphics queue for every batch the
+  // transfer queue has finished; graphics submissions made afterwards may
+  // use the uploaded resources
+  bool SubmitAcquires();
+  bool IsReady(uint64_t ticket) const;
+
+ private:
+  struct BufferCopy {
+    VkBuffer Buffer;
+    VkBufferCopy Region;
+    VkPipelineStageFlags DstStage;
+    VkAccessFlags DstAccess;
+  };
+  struct ImageCopy {
+    VkImage Image;
+    VkBufferImageCopy Region;
+    VkImageLayout FinalLayout;
+    VkPipelineStageFlags DstStage;
+    VkAccessFlags DstAccess;
+  };
+  struct Batch {
+    VkCommandBuffer TransferCommandBuffer;
+    VkCommandBuffer GraphicsCommandBuffer;
+    uint64_t Ticket;
+    uint64_t TransferValue;
+    // Graphics timeline value of the acquire submission, 0 until submitted
+    uint64_t GraphicsValue;
+    VkDeviceSize RingEnd;
+    std::vector<BufferCopy> BufferCopies;
+    std::vector<ImageCopy> ImageCopies;
+  };
+
+  AsyncUploadEngine(const AsyncUploadEngine &);
+  AsyncUploadEngine &operator=(const AsyncUploadEngine &);
+  bool AllocateStaging(VkDeviceSize size, VkDeviceSize *offset);
+  void ReclaimBatches();
+  bool AllocateCommandBuffer(VkCommandPool pool,
+                             std::vector<VkCommandBuffer> &free_buffers,
+                             VkCommandBuffer *command_buffer);
+  bool RecordTransfer(Batch &batch);
+  bool RecordAcquire(Batch &batch);
+  bool OwnershipTransfer() const;
+  VkDevice device_;
+  TimelineScheduler *transfer_timeline_;
+  TimelineScheduler *graphics_timeline_;
+  VkQueue transfer_queue_;
+  VkQueue graphics_queue_;
+  uint32_t transfer_queue_family_index_;
+  uint32_t graphics_queue_family_index_;
+  VkCommandPool transfer_command_pool_;
+  VkCommandPool graphics_command_pool_;
+  std::vector<VkCommandBuffer> free_transfer_command_buffers_;
+  std::vector<VkCommandBuffer> free_graphics_command_buffers_;
+  StagingRing staging_ring_;
+  Batch pending_;
+  // Batches submitted to the transfer queue, oldest first
+  std::deque<Batch> batches_;
+  uint64_t next_ticket_;
+  uint64_t ready_ticket_;
+};
+
+#endif
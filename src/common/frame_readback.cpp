@@ -0,0 +1,331 @@
+#include "frame_readback.h"
+
+#include <iostream>
+
+// Bytes per pixel of color formats used for render targets, 0 if unknown
+static VkDeviceSize GetPixelSize(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+      return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+      return 8;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+FrameReadback::FrameReadback()
+    : device_(VK_NULL_HANDLE),
+      allocator_(nullptr),
+      timeline_(nullptr),
+      command_pool_(VK_NULL_HANDLE),
+      non_coherent_atom_size_(1),
+      callback_(),
+      format_(VK_FORMAT_UNDEFINED),
+      extent_(),
+      row_pitch_(0),
+      slots_(),
+      pending_frames_(),
+      delivered_frames_(0) {}
+
+FrameReadback::~FrameReadback() { Destroy(); }
+
+bool FrameReadback::Create(VkPhysicalDevice physical_device, VkDevice device,
+                           GpuAllocator *allocator, TimelineScheduler *timeline,
+                           uint32_t queue_family_index) {
+  device_ = device;
+  allocator_ = allocator;
+  timeline_ = timeline;
+
+  VkPhysicalDeviceProperties device_properties;
+  vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+  non_coherent_atom_size_ = device_properties.limits.nonCoherentAtomSize;
+
+  VkCommandPoolCreateInfo command_pool_create_info = {};
+  command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  command_pool_create_info.queueFamilyIndex = queue_family_index;
+
+  if (vkCreateCommandPool(device_, &command_pool_create_info, nullptr,
+                          &command_pool_) != VK_SUCCESS) {
+    std::cout << "Could not create a readback command pool!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void FrameReadback::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  pending_frames_.clear();
+  for (Slot &slot : slots_) {
+    if (slot.Buffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device_, slot.Buffer, nullptr);
+    }
+    allocator_->Free(slot.Memory);
+  }
+  slots_.clear();
+  if (command_pool_ != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(device_, command_pool_, nullptr);
+    command_pool_ = VK_NULL_HANDLE;
+  }
+  device_ = VK_NULL_HANDLE;
+}
+
+void FrameReadback::SetCallback(ReadbackCallback callback) {
+  callback_ = callback;
+}
+
+bool FrameReadback::IsEnabled() const { return !slots_.empty(); }
+
+bool FrameReadback::SetTargets(const std::vector<VkImage> &images,
+                               VkFormat format, VkExtent2D extent,
+                               VkImageLayout final_layout) {
+  // Frames of the old targets are handed out before their buffers go away;
+  // targets only change on resize so the wait doesn't matter
+  if (!WaitAll()) {
+    return false;
+  }
+  ReleaseSlots();
+  if (!callback_) {
+    return true;
+  }
+
+  VkDeviceSize pixel_size = GetPixelSize(format);
+  if (pixel_size == 0) {
+    std::cout << "Readback of render target format " << format
+              << " is not supported!" << std::endl;
+    return false;
+  }
+  format_ = format;
+  extent_ = extent;
+  row_pitch_ = extent.width * pixel_size;
+
+  VkBufferCreateInfo buffer_create_info = {};
+  buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_create_info.size = row_pitch_ * extent.height;
+  buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  std::vector<VkCommandBuffer> command_buffers(images.size());
+  VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+  command_buffer_allocate_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_allocate_info.commandPool = command_pool_;
+  command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  command_buffer_allocate_info.commandBufferCount =
+      static_cast<uint32_t>(command_buffers.size());
+
+  if (vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                               command_buffers.data()) != VK_SUCCESS) {
+    std::cout << "Could not allocate readback command buffers!" << std::endl;
+    return false;
+  }
+
+  slots_.resize(images.size());
+  for (size_t i = 0; i < images.size(); ++i) {
+    Slot &slot = slots_[i];
+    slot.CommandBuffer = command_buffers[i];
+    if (vkCreateBuffer(device_, &buffer_create_info, nullptr, &slot.Buffer) !=
+        VK_SUCCESS) {
+      std::cout << "Could not create a readback buffer!" << std::endl;
+      return false;
+    }
+    // The CPU reads every byte of the frame so cached memory matters most
+    if (!allocator_->AllocateForBuffer(slot.Buffer,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                                       &slot.Memory)) {
+      std::cout << "Could not allocate memory for a readback buffer!"
+                << std::endl;
+      return false;
+    }
+    if (!RecordSlot(slot, images[i], final_layout)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+VkCommandBuffer FrameReadback::GetCommandBuffer(uint32_t image_index) const {
+  if (image_index >= slots_.size()) {
+    return VK_NULL_HANDLE;
+  }
+  return slots_[image_index].CommandBuffer;
+}
+
+void FrameReadback::OnSubmitted(uint32_t image_index, uint64_t timeline_value) {
+  if (image_index >= slots_.size()) {
+    return;
+  }
+  PendingFrame pending;
+  pending.ImageIndex = image_index;
+  pending.TimelineValue = timeline_value;
+  pending_frames_.push_back(pending);
+}
+
+void FrameReadback::Collect() {
+  // Values grow with submission order so the first incomplete frame ends
+  // the scan
+  while (!pending_frames_.empty() &&
+         timeline_->IsComplete(pending_frames_.front().TimelineValue)) {
+    PendingFrame pending = pending_frames_.front();
+    pending_frames_.pop_front();
+    Deliver(pending);
+  }
+}
+
+bool FrameReadback::WaitAll() {
+  if (pending_frames_.empty()) {
+    return true;
+  }
+  if (!timeline_->Wait(pending_frames_.back().TimelineValue)) {
+    std::cout << "Could not wait for frame readback!" << std::endl;
+    return false;
+  }
+  Collect();
+  return true;
+}
+
+void FrameReadback::ReleaseSlots() {
+  if (slots_.empty()) {
+    return;
+  }
+  VkDevice device = device_;
+  GpuAllocator *allocator = allocator_;
+  VkCommandPool command_pool = command_pool_;
+  std::vector<Slot> old_slots;
+  old_slots.swap(slots_);
+  timeline_->DeferRelease([device, allocator, command_pool,
+                           old_slots]() mutable {
+    for (Slot &slot : old_slots) {
+      if (slot.Buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, slot.Buffer, nullptr);
+      }
+      allocator->Free(slot.Memory);
+      vkFreeCommandBuffers(device, command_pool, 1, &slot.CommandBuffer);
+    }
+  });
+}
+
+bool FrameReadback::RecordSlot(Slot &slot, VkImage image,
+                               VkImageLayout final_layout) {
+  VkCommandBufferBeginInfo command_buffer_begin_info = {};
+  command_buffer_begin_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  command_buffer_begin_info.flags =
+      VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+  if (vkBeginCommandBuffer(slot.CommandBuffer, &command_buffer_begin_info) !=
+      VK_SUCCESS) {
+    std::cout << "Could not record readback command buffer!" << std::endl;
+    return false;
+  }
+
+  VkImageSubresourceRange image_subresource_range = {};
+  image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  image_subresource_range.levelCount = 1;
+  image_subresource_range.layerCount = 1;
+
+  // Rendering of the frame precedes in the same submission
+  VkImageMemoryBarrier barrier_to_transfer = {};
+  barrier_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier_to_transfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier_to_transfer.oldLayout = final_layout;
+  barrier_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier_to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier_to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier_to_transfer.image = image;
+  barrier_to_transfer.subresourceRange = image_subresource_range;
+  vkCmdPipelineBarrier(slot.CommandBuffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier_to_transfer);
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {extent_.width, extent_.height, 1};
+  vkCmdCopyImageToBuffer(slot.CommandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.Buffer, 1,
+                         &region);
+
+  // Presentation waits on a semaphore so no access has to be made visible
+  // to it, only the layout restored
+  VkImageMemoryBarrier barrier_to_final = barrier_to_transfer;
+  barrier_to_final.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier_to_final.dstAccessMask = 0;
+  barrier_to_final.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier_to_final.newLayout = final_layout;
+
+  VkBufferMemoryBarrier barrier_to_host = {};
+  barrier_to_host.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier_to_host.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier_to_host.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier_to_host.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier_to_host.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier_to_host.buffer = slot.Buffer;
+  barrier_to_host.offset = 0;
+  barrier_to_host.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(
+      slot.CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+      nullptr, 1, &barrier_to_host, 1, &barrier_to_final);
+
+  if (vkEndCommandBuffer(slot.CommandBuffer) != VK_SUCCESS) {
+    std::cout << "Could not record readback command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void FrameReadback::Deliver(const PendingFrame &pending) {
+  if (!callback_ || (pending.ImageIndex >= slots_.size())) {
+    return;
+  }
+  const Slot &slot = slots_[pending.ImageIndex];
+
+  // Non-coherent memory has to be invalidated in whole atoms
+  const VkPhysicalDeviceMemoryProperties &memory_properties =
+      allocator_->GetMemoryProperties();
+  if (!(memory_properties.memoryTypes[slot.Memory.MemoryTypeIndex]
+            .propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    VkMappedMemoryRange memory_range = {};
+    memory_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    memory_range.memory = slot.Memory.Memory;
+    if (slot.Memory.BlockIndex == UINT32_MAX) {
+      memory_range.offset = 0;
+      memory_range.size = VK_WHOLE_SIZE;
+    } else {
+      // Block nodes are powers of two so rounding stays inside the block
+      VkDeviceSize begin = slot.Memory.Offset / non_coherent_atom_size_ *
+                           non_coherent_atom_size_;
+      VkDeviceSize end = (slot.Memory.Offset + slot.Memory.Size +
+                          non_coherent_atom_size_ - 1) /
+                         non_coherent_atom_size_ * non_coherent_atom_size_;
+      memory_range.offset = begin;
+      memory_range.size = end - begin;
+    }
+    vkInvalidateMappedMemoryRanges(device_, 1, &memory_range);
+  }
+
+  ReadbackFrame frame;
+  frame.FrameNumber = delivered_frames_++;
+  frame.ImageIndex = pending.ImageIndex;
+  frame.Format = format_;
+  frame.Extent = extent_;
+  frame.RowPitch = row_pitch_;
+  frame.Size = row_pitch_ * extent_.height;
+  frame.Data = slot.Memory.Mapped;
+  callback_(frame);
+}
@@ -0,0 +1,109 @@
+#ifndef FRAME_READBACK_H_
+#define FRAME_READBACK_H_
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "gpu_allocator.h"
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// ReadbackFrame                                                //
+//                                                              //
+// Pixels of one rendered frame copied into host memory; Data   //
+// is only valid for the duration of the callback               //
+// ************************************************************ //
+struct ReadbackFrame {
+  // Number of frames read back before this one
+  uint64_t FrameNumber;
+  uint32_t ImageIndex;
+  VkFormat Format;
+  VkExtent2D Extent;
+  // Rows are tightly packed
+  VkDeviceSize RowPitch;
+  VkDeviceSize Size;
+  const void *Data;
+
+  ReadbackFrame()
+      : FrameNumber(0),
+        ImageIndex(0),
+        Format(VK_FORMAT_UNDEFINED),
+        Extent(),
+        RowPitch(0),
+        Size(0),
+        Data(nullptr) {}
+};
+
+typedef std::function<void(const ReadbackFrame &)> ReadbackCallback;
+
+// ************************************************************ //
+// FrameReadback                                                //
+//                                                              //
+// Copies every submitted frame into one of a ring of host      //
+// cached, persistently mapped buffers with a command buffer    //
+// prerecorded per target image; the callback runs once the     //
+// frame's timeline value is reached so reading never stalls    //
+// ************************************************************ //
+class FrameReadback {
+ public:
+  FrameReadback();
+  ~FrameReadback();
+  bool Create(VkPhysicalDevice physical_device, VkDevice device,
+              GpuAllocator *allocator, TimelineScheduler *timeline,
+              uint32_t queue_family_index);
+  // Frames still in flight are dropped without invoking the callback
+  void Destroy();
+  // An empty callback disables readback; takes effect with SetTargets()
+  void SetCallback(ReadbackCallback callback);
+  bool IsEnabled() const;
+  // (Re)creates buffers and copy commands for images left in final_layout by
+  // rendering; resources of the previous targets are released once the GPU
+  // is done with them
+  bool SetTargets(const std::vector<VkImage> &images, VkFormat format,
+                  VkExtent2D extent, VkImageLayout final_layout);
+  // Command buffer to submit right after the frame rendered into image_index
+  // or VK_NULL_HANDLE when readback is disabled
+  VkCommandBuffer GetCommandBuffer(uint32_t image_index) const;
+  // Marks the copy of image_index as completing with timeline_value
+  void OnSubmitted(uint32_t image_index, uint64_t timeline_value);
+  // Invokes the callback for completed frames in submission order
+  void Collect();
+  // Waits for all frames in flight and hands them to the callback
+  bool WaitAll();
+
+ private:
+  struct Slot {
+    VkBuffer Buffer;
+    GpuAllocation Memory;
+    VkCommandBuffer CommandBuffer;
+
+    Slot() : Buffer(VK_NULL_HANDLE), Memory(), CommandBuffer(VK_NULL_HANDLE) {}
+  };
+  struct PendingFrame {
+    uint32_t ImageIndex;
+    uint64_t TimelineValue;
+  };
+
+  FrameReadback(const FrameReadback &);
+  FrameReadback &operator=(const FrameReadback &);
+  void ReleaseSlots();
+  bool RecordSlot(Slot &slot, VkImage image, VkImageLayout final_layout);
+  void Deliver(const PendingFrame &pending);
+  VkDevice device_;
+  GpuAllocator *allocator_;
+  TimelineScheduler *timeline_;
+  VkCommandPool command_pool_;
+  VkDeviceSize non_coherent_atom_size_;
+  ReadbackCallback callback_;
+  VkFormat format_;
+  VkExtent2D extent_;
+  VkDeviceSize row_pitch_;
+  std::vector<Slot> slots_;
+  std::deque<PendingFrame> pending_frames_;
+  uint64_t delivered_frames_;
+};
+
+#endif
@@ -0,0 +1,401 @@
+#include "gpu_allocator.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Smallest node handed out by the buddy allocator
+static const VkDeviceSize kMinNodeSize = 256;
+
+static uint32_t CountBits(uint32_t value) {
+  uint32_t count = 0;
+  for (; value != 0; value &= value - 1) {
+    ++count;
+  }
+  return count;
+}
+
+GpuAllocator::GpuAllocator()
+    : device_(VK_NULL_HANDLE),
+      memory_properties_(),
+      block_size_(0),
+      blocks_(),
+      dedicated_allocation_count_(0),
+      dedicated_bytes_(0) {}
+
+GpuAllocator::~GpuAllocator() { Destroy(); }
+
+bool GpuAllocator::Create(VkPhysicalDevice physical_device, VkDevice device,
+                          VkDeviceSize block_size) {
+  device_ = device;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties_);
+
+  // Buddy nodes must split evenly down to kMinNodeSize
+  block_size_ = kMinNodeSize;
+  while (block_size_ * 2 <= block_size) {
+    block_size_ *= 2;
+  }
+  return true;
+}
+
+void GpuAllocator::Destroy() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (MemoryBlock &block : blocks_) {
+    if (block.Memory == VK_NULL_HANDLE) {
+      continue;
+    }
+    if (block.AllocationCount > 0) {
+      std::cout << "GpuAllocator destroyed with " << block.AllocationCount
+                << " live allocation(s) in a block!" << std::endl;
+    }
+    vkFreeMemory(device_, block.Memory, nullptr);
+  }
+  blocks_.clear();
+}
+
+bool GpuAllocator::AllocateForBuffer(VkBuffer buffer,
+                                     VkMemoryPropertyFlags required,
+                                     VkMemoryPropertyFlags preferred,
+                                     GpuAllocation *allocation) {
+  VkMemoryRequirements memory_requirements;
+  vkGetBufferMemoryRequirements(device_, buffer, &memory_requirements);
+
+  if (!Allocate(memory_requirements, true, required, preferred, allocation)) {
+    return false;
+  }
+  if (vkBindBufferMemory(device_, buffer, allocation->Memory,
+                         allocation->Offset) != VK_SUCCESS) {
+    std::cout << "Could not bind memory to a buffer!" << std::endl;
+    Free(*allocation);
+    return false;
+  }
+  return true;
+}
+
+bool GpuAllocator::AllocateForImage(VkImage image, VkImageTiling tiling,
+                                    VkMemoryPropertyFlags required,
+                                    VkMemoryPropertyFlags preferred,
+                                    GpuAllocation *allocation) {
+  VkMemoryRequirements memory_requirements;
+  vkGetImageMemoryRequirements(device_, image, &memory_requirements);
+
+  if (!Allocate(memory_requirements, tiling == VK_IMAGE_TILING_LINEAR,
+                required, preferred, allocation)) {
+    return false;
+  }
+  if (vkBindImageMemory(device_, image, allocation->Memory,
+                        allocation->Offset) != VK_SUCCESS) {
+    std::cout << "Could not bind memory to an image!" << std::endl;
+    Free(*allocation);
+    return false;
+  }
+  return true;
+}
+
+bool GpuAllocator::Allocate(const VkMemoryRequirements &memory_requirements,
+                            bool linear, VkMemoryPropertyFlags required,
+                            VkMemoryPropertyFlags preferred,
+                            GpuAllocation *allocation) {
+  std::vector<uint32_t> memory_types = GetMemoryTypeCandidates(
+      memory_requirements.memoryTypeBits, required, preferred);
+  if (memory_types.empty()) {
+    std::cout << "Could not find a memory type with required properties!"
+              << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint32_t memory_type_index : memory_types) {
+    VkDeviceSize block_size = GetBlockSize(memory_type_index);
+
+    // Requests that don't fit a block get their own device memory
+    if (memory_requirements.size > block_size / 2) {
+      void *mapped = nullptr;
+      VkDeviceMemory memory = VK_NULL_HANDLE;
+      if (!AllocateDeviceMemory(memory_type_index, memory_requirements.size,
+                                &memory, &mapped)) {
+        continue;
+      }
+      allocation->Memory = memory;
+      allocation->Offset = 0;
+      allocation->Size = memory_requirements.size;
+      allocation->Mapped = mapped;
+      allocation->MemoryTypeIndex = memory_type_index;
+      allocation->BlockIndex = UINT32_MAX;
+      allocation->Order = 0;
+      ++dedicated_allocation_count_;
+      dedicated_bytes_ += memory_requirements.size;
+      return true;
+    }
+
+    uint32_t block_index = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    uint32_t order = 0;
+    for (uint32_t i = 0; i < blocks_.size(); ++i) {
+      MemoryBlock &block = blocks_[i];
+      if ((block.Memory != VK_NULL_HANDLE) &&
+          (block.MemoryTypeIndex == memory_type_index) &&
+          (block.Linear == linear) &&
+          AllocateFromBlock(block, memory_requirements.size,
+                            memory_requirements.alignment, &offset, &order)) {
+        block_index = i;
+        break;
+      }
+    }
+    if (block_index == UINT32_MAX) {
+      block_index = CreateBlock(memory_type_index, linear);
+      if ((block_index == UINT32_MAX) ||
+          !AllocateFromBlock(blocks_[block_index], memory_requirements.size,
+                             memory_requirements.alignment, &offset, &order)) {
+        continue;
+      }
+    }
+
+    MemoryBlock &block = blocks_[block_index];
+    ++block.AllocationCount;
+    block.BytesUsed += memory_requirements.size;
+
+    allocation->Memory = block.Memory;
+    allocation->Offset = offset;
+    allocation->Size = memory_requirements.size;
+    allocation->Mapped = block.Mapped != nullptr
+                             ? static_cast<char *>(block.Mapped) + offset
+                             : nullptr;
+    allocation->MemoryTypeIndex = memory_type_index;
+    allocation->BlockIndex = block_index;
+    allocation->Order = order;
+    return true;
+  }
+
+  std::cout << "Could not allocate device memory!" << std::endl;
+  return false;
+}
+
+void GpuAllocator::Free(GpuAllocation &allocation) {
+  if (allocation.Memory == VK_NULL_HANDLE) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (allocation.BlockIndex == UINT32_MAX) {
+    vkFreeMemory(device_, allocation.Memory, nullptr);
+    --dedicated_allocation_count_;
+    dedicated_bytes_ -= allocation.Size;
+  } else {
+    MemoryBlock &block = blocks_[allocation.BlockIndex];
+    FreeToBlock(block, allocation.Offset, allocation.Order);
+    --block.AllocationCount;
+    block.BytesUsed -= allocation.Size;
+
+    // Give empty blocks back to the driver unless it is the last one of its
+    // kind, which is kept to avoid thrashing on alloc/free patterns
+    if (block.AllocationCount == 0) {
+      uint32_t similar_blocks = 0;
+      for (const MemoryBlock &other : blocks_) {
+        if ((other.Memory != VK_NULL_HANDLE) &&
+            (other.MemoryTypeIndex == block.MemoryTypeIndex) &&
+            (other.Linear == block.Linear)) {
+          ++similar_blocks;
+        }
+      }
+      if (similar_blocks > 1) {
+        vkFreeMemory(device_, block.Memory, nullptr);
+        block.Memory = VK_NULL_HANDLE;
+        block.Mapped = nullptr;
+        block.FreeLists.clear();
+      }
+    }
+  }
+  allocation = GpuAllocation();
+}
+
+GpuAllocatorStats GpuAllocator::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  GpuAllocatorStats stats;
+  stats.DedicatedAllocationCount = dedicated_allocation_count_;
+  stats.AllocationCount = dedicated_allocation_count_;
+  stats.BytesAllocated = dedicated_bytes_;
+  stats.BytesUsed = dedicated_bytes_;
+
+  VkDeviceSize free_bytes = 0;
+  VkDeviceSize largest_free_node = 0;
+  for (const MemoryBlock &block : blocks_) {
+    if (block.Memory == VK_NULL_HANDLE) {
+      continue;
+    }
+    ++stats.BlockCount;
+    stats.AllocationCount += block.AllocationCount;
+    stats.BytesAllocated += block.Size;
+    stats.BytesUsed += block.BytesUsed;
+
+    for (uint32_t order = 0; order < block.FreeLists.size(); ++order) {
+      VkDeviceSize node_size = kMinNodeSize << order;
+      free_bytes += node_size * block.FreeLists[order].size();
+      if (!block.FreeLists[order].empty()) {
+        largest_free_node = std::max(largest_free_node, node_size);
+      }
+    }
+  }
+  if (free_bytes > 0) {
+    stats.Fragmentation = 1.0f - static_cast<float>(largest_free_node) /
+                                     static_cast<float>(free_bytes);
+  }
+  return stats;
+}
+
+const VkPhysicalDeviceMemoryProperties &GpuAllocator::GetMemoryProperties()
+    const {
+  return memory_properties_;
+}
+
+std::vector<uint32_t> GpuAllocator::GetMemoryTypeCandidates(
+    uint32_t memory_type_bits, VkMemoryPropertyFlags required,
+    VkMemoryPropertyFlags preferred) const {
+  std::vector<uint32_t> candidates;
+  for (uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i) {
+    VkMemoryPropertyFlags flags = memory_properties_.memoryTypes[i].propertyFlags;
+    if ((memory_type_bits & (1 << i)) && ((flags & required) == required)) {
+      candidates.push_back(i);
+    }
+  }
+
+  // Most preferred flags first; among equals pick the type with fewer
+  // properties nobody asked for (i.e. don't waste DEVICE_LOCAL|HOST_VISIBLE
+  // memory on staging data)
+  const VkPhysicalDeviceMemoryProperties &properties = memory_properties_;
+  VkMemoryPropertyFlags wanted = required | preferred;
+  std::stable_sort(
+      candidates.begin(), candidates.end(),
+      [&properties, preferred, wanted](uint32_t a, uint32_t b) {
+        VkMemoryPropertyFlags flags_a = properties.memoryTypes[a].propertyFlags;
+        VkMemoryPropertyFlags flags_b = properties.memoryTypes[b].propertyFlags;
+        uint32_t score_a = CountBits(flags_a & preferred);
+        uint32_t score_b = CountBits(flags_b & preferred);
+        if (score_a != score_b) {
+          return score_a > score_b;
+        }
+        return CountBits(flags_a & ~wanted) < CountBits(flags_b & ~wanted);
+      });
+  return candidates;
+}
+
+VkDeviceSize GpuAllocator::GetBlockSize(uint32_t memory_type_index) const {
+  // Small heaps (i.e. host visible device local BAR memory) get smaller blocks
+  // so a single block can't take a large part of the heap
+  uint32_t heap_index = memory_properties_.memoryTypes[memory_type_index].heapIndex;
+  VkDeviceSize heap_size = memory_properties_.memoryHeaps[heap_index].size;
+  VkDeviceSize block_size = block_size_;
+  while ((block_size > heap_size / 8) && (block_size > kMinNodeSize * 1024)) {
+    block_size /= 2;
+  }
+  return block_size;
+}
+
+bool GpuAllocator::AllocateDeviceMemory(uint32_t memory_type_index,
+                                        VkDeviceSize size,
+                                        VkDeviceMemory *memory,
+                                        void **mapped) {
+  VkMemoryAllocateInfo memory_allocate_info = {};
+  memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  memory_allocate_info.allocationSize = size;
+  memory_allocate_info.memoryTypeIndex = memory_type_index;
+
+  if (vkAllocateMemory(device_, &memory_allocate_info, nullptr, memory) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  // Host visible memory stays mapped for its whole lifetime
+  *mapped = nullptr;
+  if ((memory_properties_.memoryTypes[memory_type_index].propertyFlags &
+       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      (vkMapMemory(device_, *memory, 0, VK_WHOLE_SIZE, 0, mapped) !=
+       VK_SUCCESS)) {
+    std::cout << "Could not map device memory!" << std::endl;
+    vkFreeMemory(device_, *memory, nullptr);
+    *memory = VK_NULL_HANDLE;
+    return false;
+  }
+  return true;
+}
+
+bool GpuAllocator::AllocateFromBlock(MemoryBlock &block, VkDeviceSize size,
+                                     VkDeviceSize alignment,
+                                     VkDeviceSize *offset, uint32_t *order) {
+  // Nodes are aligned to their own size, so a power of two node at least as
+  // large as the alignment satisfies it
+  VkDeviceSize node_size = std::max(size, alignment);
+  uint32_t needed_order = 0;
+  while ((kMinNodeSize << needed_order) < node_size) {
+    ++needed_order;
+  }
+
+  uint32_t current_order = needed_order;
+  while ((current_order < block.FreeLists.size()) &&
+         block.FreeLists[current_order].empty()) {
+    ++current_order;
+  }
+  if (current_order >= block.FreeLists.size()) {
+    return false;
+  }
+
+  VkDeviceSize node_offset = *block.FreeLists[current_order].begin();
+  block.FreeLists[current_order].erase(block.FreeLists[current_order].begin());
+
+  // Split larger node, returning upper halves to the free lists
+  while (current_order > needed_order) {
+    --current_order;
+    block.FreeLists[current_order].insert(node_offset +
+                                          (kMinNodeSize << current_order));
+  }
+
+  *offset = node_offset;
+  *order = needed_order;
+  return true;
+}
+
+void GpuAllocator::FreeToBlock(MemoryBlock &block, VkDeviceSize offset,
+                               uint32_t order) {
+  // Merge with the buddy for as long as it is free too
+  while (order + 1 < block.FreeLists.size()) {
+    VkDeviceSize buddy_offset = offset ^ (kMinNodeSize << order);
+    std::set<VkDeviceSize>::iterator buddy =
+        block.FreeLists[order].find(buddy_offset);
+    if (buddy == block.FreeLists[order].end()) {
+      break;
+    }
+    block.FreeLists[order].erase(buddy);
+    offset = std::min(offset, buddy_offset);
+    ++order;
+  }
+  block.FreeLists[order].insert(offset);
+}
+
+uint32_t GpuAllocator::CreateBlock(uint32_t memory_type_index, bool linear) {
+  MemoryBlock block;
+  block.Size = GetBlockSize(memory_type_index);
+  block.MemoryTypeIndex = memory_type_index;
+  block.Linear = linear;
+  block.AllocationCount = 0;
+  block.BytesUsed = 0;
+  if (!AllocateDeviceMemory(memory_type_index, block.Size, &block.Memory,
+                            &block.Mapped)) {
+    return UINT32_MAX;
+  }
+
+  uint32_t order_count = 1;
+  while ((kMinNodeSize << (order_count - 1)) < block.Size) {
+    ++order_count;
+  }
+  block.FreeLists.resize(order_count);
+  block.FreeLists[order_count - 1].insert(0);
+
+  // Reuse slots of released blocks so indices held by allocations stay valid
+  for (uint32_t i = 0; i < blocks_.size(); ++i) {
+    if (blocks_[i].Memory == VK_NULL_HANDLE) {
+      blocks_[i] = block;
+      return i;
+    }
+  }
+  blocks_.push_back(block);
+  return static_cast<uint32_t>(blocks_.size() - 1);
+}
@@ -0,0 +1,129 @@
+#ifndef GPU_ALLOCATOR_H_
+#define GPU_ALLOCATOR_H_
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+// ************************************************************ //
+// GpuAllocation                                                //
+//                                                              //
+// Range of device memory handed out by GpuAllocator            //
+// ************************************************************ //
+struct GpuAllocation {
+  VkDeviceMemory Memory;
+  VkDeviceSize Offset;
+  VkDeviceSize Size;
+  // Non-null when the memory type is host visible
+  void *Mapped;
+  uint32_t MemoryTypeIndex;
+  // Owning block or UINT32_MAX for a dedicated allocation
+  uint32_t BlockIndex;
+  // Buddy order of the allocated node inside its block
+  uint32_t Order;
+
+  GpuAllocation()
+      : Memory(VK_NULL_HANDLE),
+        Offset(0),
+        Size(0),
+        Mapped(nullptr),
+        MemoryTypeIndex(UINT32_MAX),
+        BlockIndex(UINT32_MAX),
+        Order(0) {}
+};
+
+// ************************************************************ //
+// GpuAllocatorStats                                            //
+//                                                              //
+// Snapshot of GpuAllocator's memory usage                      //
+// ************************************************************ //
+struct GpuAllocatorStats {
+  uint32_t BlockCount;
+  uint32_t DedicatedAllocationCount;
+  uint32_t AllocationCount;
+  // Device memory obtained from the driver
+  VkDeviceSize BytesAllocated;
+  // Bytes requested by callers
+  VkDeviceSize BytesUsed;
+  // 1 - largest free range / total free bytes inside blocks
+  float Fragmentation;
+
+  GpuAllocatorStats()
+      : BlockCount(0),
+        DedicatedAllocationCount(0),
+        AllocationCount(0),
+        BytesAllocated(0),
+        BytesUsed(0),
+        Fragmentation(0.0f) {}
+};
+
+// ************************************************************ //
+// GpuAllocator                                                 //
+//                                                              //
+// Grabs large device memory blocks per memory type and         //
+// sub-allocates them with a buddy scheme                       //
+// ************************************************************ //
+class GpuAllocator {
+ public:
+  GpuAllocator();
+  ~GpuAllocator();
+  bool Create(VkPhysicalDevice physical_device, VkDevice device,
+              VkDeviceSize block_size = 64 * 1024 * 1024);
+  void Destroy();
+  // Allocates memory suitable for the buffer and binds it; memory types
+  // having all required flags are ranked by how many preferred flags they
+  // have
+  bool AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags required,
+                         VkMemoryPropertyFlags preferred,
+                         GpuAllocation *allocation);
+  bool AllocateForImage(VkImage image, VkImageTiling tiling,
+                        VkMemoryPropertyFlags required,
+                        VkMemoryPropertyFlags preferred,
+                        GpuAllocation *allocation);
+  // Linear resources (buffers, linear images) and optimal images never share
+  // a block so bufferImageGranularity can't be violated
+  bool Allocate(const VkMemoryRequirements &memory_requirements, bool linear,
+                VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                GpuAllocation *allocation);
+  void Free(GpuAllocation &allocation);
+  GpuAllocatorStats GetStats();
+  const VkPhysicalDeviceMemoryProperties &GetMemoryProperties() const;
+
+ private:
+  struct MemoryBlock {
+    VkDeviceMemory Memory;
+    void *Mapped;
+    VkDeviceSize Size;
+    uint32_t MemoryTypeIndex;
+    bool Linear;
+    uint32_t AllocationCount;
+    VkDeviceSize BytesUsed;
+    // Free node offsets for every buddy order; order 0 is the smallest node
+    std::vector<std::set<VkDeviceSize>> FreeLists;
+  };
+
+  GpuAllocator(const GpuAllocator &);
+  GpuAllocator &operator=(const GpuAllocator &);
+  std::vector<uint32_t> GetMemoryTypeCandidates(
+      uint32_t memory_type_bits, VkMemoryPropertyFlags required,
+      VkMemoryPropertyFlags preferred) const;
+  VkDeviceSize GetBlockSize(uint32_t memory_type_index) const;
+  bool AllocateDeviceMemory(uint32_t memory_type_index, VkDeviceSize size,
+                            VkDeviceMemory *memory, void **mapped);
+  bool AllocateFromBlock(MemoryBlock &block, VkDeviceSize size,
+                         VkDeviceSize alignment, VkDeviceSize *offset,
+                         uint32_t *order);
+  void FreeToBlock(MemoryBlock &block, VkDeviceSize offset, uint32_t order);
+  uint32_t CreateBlock(uint32_t memory_type_index, bool linear);
+  VkDevice device_;
+  VkPhysicalDeviceMemoryProperties memory_properties_;
+  VkDeviceSize block_size_;
+  std::vector<MemoryBlock> blocks_;
+  uint32_t dedicated_allocation_count_;
+  VkDeviceSize dedicated_bytes_;
+  std::mutex mutex_;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "gpu_profiler.h"
+
+#include <iomanip>
+#include <iostream>
+
+GpuProfiler::GpuProfiler()
+    : device_(VK_NULL_HANDLE),
+      timeline_(nullptr),
+      enabled_(false),
+      timestamp_period_(1.0),
+      timestamp_mask_(0),
+      max_scopes_(0),
+      slots_(),
+      last_results_(),
+      collected_frames_(0) {}
+
+GpuProfiler::~GpuProfiler() { Destroy(); }
+
+bool GpuProfiler::Create(VkPhysicalDevice physical_device, VkDevice device,
+                         uint32_t queue_family_index,
+                         TimelineScheduler *timeline, uint32_t slot_count,
+                         uint32_t max_scopes) {
+  device_ = device;
+  timeline_ = timeline;
+  max_scopes_ = max_scopes;
+
+  VkPhysicalDeviceProperties device_properties;
+  vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+  timestamp_period_ = device_properties.limits.timestampPeriod;
+
+  uint32_t queue_families_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                           &queue_families_count, nullptr);
+  std::vector<VkQueueFamilyProperties> queue_family_properties(
+      queue_families_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      physical_device, &queue_families_count, queue_family_properties.data());
+
+  uint32_t valid_bits = 0;
+  if (queue_family_index < queue_families_count) {
+    valid_bits = queue_family_properties[queue_family_index].timestampValidBits;
+  }
+  enabled_ = valid_bits > 0;
+  if (!enabled_) {
+    std::cout << "Queue family doesn't support timestamps, GPU profiling is "
+                 "disabled!"
+              << std::endl;
+    return true;
+  }
+  timestamp_mask_ = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+  return SetSlotCount(slot_count);
+}
+
+void GpuProfiler::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  for (Slot &slot : slots_) {
+    if (slot.QueryPool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device_, slot.QueryPool, nullptr);
+    }
+  }
+  slots_.clear();
+  device_ = VK_NULL_HANDLE;
+}
+
+bool GpuProfiler::SetSlotCount(uint32_t slot_count) {
+  if (!enabled_) {
+    return true;
+  }
+  while (slots_.size() > slot_count) {
+    VkDevice device = device_;
+    VkQueryPool query_pool = slots_.back().QueryPool;
+    timeline_->DeferRelease([=]() {
+      if (query_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, query_pool, nullptr);
+      }
+    });
+    slots_.pop_back();
+  }
+  while (slots_.size() < slot_count) {
+    Slot slot;
+    if (!CreateSlot(slot)) {
+      return false;
+    }
+    slots_.push_back(slot);
+  }
+  return true;
+}
+
+uint32_t GpuProfiler::GetSlotCount() const {
+  return static_cast<uint32_t>(slots_.size());
+}
+
+bool GpuProfiler::IsEnabled() const { return enabled_; }
+
+void GpuProfiler::BeginSlot(uint32_t slot, VkCommandBuffer command_buffer) {
+  if (!enabled_ || (slot >= slots_.size())) {
+    return;
+  }
+  slots_[slot].Scopes.clear();
+  slots_[slot].OpenScopes.clear();
+  vkCmdResetQueryPool(command_buffer, slots_[slot].QueryPool, 0,
+                      2 * max_scopes_);
+}
+
+uint32_t GpuProfiler::BeginScope(uint32_t slot, VkCommandBuffer command_buffer,
+                                 const char *name) {
+  if (!enabled_ || (slot >= slots_.size()) ||
+      (slots_[slot].Scopes.size() >= max_scopes_)) {
+    return UINT32_MAX;
+  }
+  Slot &profiler_slot = slots_[slot];
+
+  Scope scope;
+  scope.Name = name;
+  scope.Parent = profiler_slot.OpenScopes.empty()
+                     ? UINT32_MAX
+                     : profiler_slot.OpenScopes.back();
+  scope.Depth = static_cast<uint32_t>(profiler_slot.OpenScopes.size());
+
+  uint32_t index = static_cast<uint32_t>(profiler_slot.Scopes.size());
+  profiler_slot.Scopes.push_back(scope);
+  profiler_slot.OpenScopes.push_back(index);
+
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      profiler_slot.QueryPool, 2 * index);
+  return index;
+}
+
+void GpuProfiler::EndScope(uint32_t slot, VkCommandBuffer command_buffer,
+                           uint32_t scope) {
+  if (!enabled_ || (slot >= slots_.size()) || (scope == UINT32_MAX)) {
+    return;
+  }
+  Slot &profiler_slot = slots_[slot];
+  if (!profiler_slot.OpenScopes.empty() &&
+      (profiler_slot.OpenScopes.back() == scope)) {
+    profiler_slot.OpenScopes.pop_back();
+  }
+
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      profiler_slot.QueryPool, 2 * scope + 1);
+}
+
+bool GpuProfiler::CollectResults(uint32_t slot) {
+  if (!enabled_ || (slot >= slots_.size()) || slots_[slot].Scopes.empty()) {
+    return false;
+  }
+  const Slot &profiler_slot = slots_[slot];
+  uint32_t query_count = static_cast<uint32_t>(2 * profiler_slot.Scopes.size());
+
+  // No WAIT flag: the slot's submission has already finished so results are
+  // either there or the slot hasn't been executed since it was recorded
+  std::vector<uint64_t> timestamps(query_count);
+  if (vkGetQueryPoolResults(device_, profiler_slot.QueryPool, 0, query_count,
+                            timestamps.size() * sizeof(uint64_t),
+                            timestamps.data(), sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return false;
+  }
+
+  last_results_.FrameNumber = collected_frames_++;
+  last_results_.Slot = slot;
+  last_results_.Nodes.resize(profiler_slot.Scopes.size());
+  for (size_t i = 0; i < profiler_slot.Scopes.size(); ++i) {
+    const Scope &scope = profiler_slot.Scopes[i];
+    GpuProfileNode &node = last_results_.Nodes[i];
+    node.Name = scope.Name;
+    node.Parent = scope.Parent;
+    node.Depth = scope.Depth;
+
+    // Masking handles counters narrower than 64 bits wrapping around
+    uint64_t ticks =
+        (timestamps[2 * i + 1] - timestamps[2 * i]) & timestamp_mask_;
+    node.Milliseconds = static_cast<double>(ticks) * timestamp_period_ / 1e6;
+    node.StartNanoseconds = GetNanoseconds(timestamps[2 * i]);
+    node.EndNanoseconds =
+        node.StartNanoseconds +
+        static_cast<uint64_t>(static_cast<double>(ticks) * timestamp_period_);
+  }
+  return true;
+}
+
+const GpuProfileFrame &GpuProfiler::GetLastResults() const {
+  return last_results_;
+}
+
+uint64_t GpuProfiler::GetNanoseconds(uint64_t timestamp) const {
+  return static_cast<uint64_t>(
+      static_cast<double>(timestamp & timestamp_mask_) * timestamp_period_);
+}
+
+void GpuProfiler::Log(std::ostream &stream) const {
+  stream << "GPU frame " << last_results_.FrameNumber << ":" << std::endl;
+  for (const GpuProfileNode &node : last_results_.Nodes) {
+    stream << std::string(2 * (node.Depth + 1), ' ') << node.Name << ": "
+           << std::fixed << std::setprecision(3) << node.Milliseconds << " ms"
+           << std::endl;
+  }
+}
+
+bool GpuProfiler::CreateSlot(Slot &slot) {
+  VkQueryPoolCreateInfo query_pool_create_info = {};
+  query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  query_pool_create_info.queryCount = 2 * max_scopes_;
+
+  slot.QueryPool = VK_NULL_HANDLE;
+  if (vkCreateQueryPool(device_, &query_pool_create_info, nullptr,
+                        &slot.QueryPool) != VK_SUCCESS) {
+    std::cout << "Could not create timestamp query pool!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+GpuProfileScope::GpuProfileScope(GpuProfiler &profiler, uint32_t slot,
+                                 VkCommandBuffer command_buffer,
+                                 const char *name)
+    : profiler_(profiler),
+      slot_(slot),
+      command_buffer_(command_buffer),
+      scope_(profiler.BeginScope(slot, command_buffer, name)) {}
+
+GpuProfileScope::~GpuProfileScope() {
+  profiler_.EndScope(slot_, command_buffer_, scope_);
+}
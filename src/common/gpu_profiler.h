@@ -0,0 +1,135 @@
+#ifndef GPU_PROFILER_H_
+#define GPU_PROFILER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// GpuProfileNode                                               //
+//                                                              //
+// GPU time spent in a single profiled scope                    //
+// ************************************************************ //
+struct GpuProfileNode {
+  std::string Name;
+  // Index of the enclosing scope or UINT32_MAX for top level scopes
+  uint32_t Parent;
+  uint32_t Depth;
+  double Milliseconds;
+  // Scope bounds on the device's timestamp clock
+  uint64_t StartNanoseconds;
+  uint64_t EndNanoseconds;
+
+  GpuProfileNode()
+      : Name(),
+        Parent(UINT32_MAX),
+        Depth(0),
+        Milliseconds(0.0),
+        StartNanoseconds(0),
+        EndNanoseconds(0) {}
+};
+
+// ************************************************************ //
+// GpuProfileFrame                                              //
+//                                                              //
+// Scope tree of one profiled submission, stored in pre-order   //
+// ************************************************************ //
+struct GpuProfileFrame {
+  // Number of results collected before this one
+  uint64_t FrameNumber;
+  uint32_t Slot;
+  std::vector<GpuProfileNode> Nodes;
+
+  GpuProfileFrame() : FrameNumber(0), Slot(0), Nodes() {}
+};
+
+// ************************************************************ //
+// GpuProfiler                                                  //
+//                                                              //
+// Timestamp queries around named scopes of command buffers;    //
+// every slot owns a query pool and its results are read only   //
+// after the slot's previous submission completed, so reading   //
+// never stalls                                                 //
+// ************************************************************ //
+class GpuProfiler {
+ public:
+  GpuProfiler();
+  ~GpuProfiler();
+  bool Create(VkPhysicalDevice physical_device, VkDevice device,
+              uint32_t queue_family_index, TimelineScheduler *timeline,
+              uint32_t slot_count, uint32_t max_scopes = 128);
+  void Destroy();
+  // Pools of removed slots are released once the GPU is done with them
+  bool SetSlotCount(uint32_t slot_count);
+  uint32_t GetSlotCount() const;
+  // False when the queue family doesn't support timestamps; scopes are no-ops
+  bool IsEnabled() const;
+  // Starts recording slot into command_buffer; must be called outside of a
+  // render pass before any scope of the slot
+  void BeginSlot(uint32_t slot, VkCommandBuffer command_buffer);
+  // Returns scope index to be passed to EndScope()
+  uint32_t BeginScope(uint32_t slot, VkCommandBuffer command_buffer,
+                      const char *name);
+  void EndScope(uint32_t slot, VkCommandBuffer command_buffer, uint32_t scope);
+  // Reads timestamps of the last execution of slot; call only once that
+  // execution is known to have completed
+  bool CollectResults(uint32_t slot);
+  const GpuProfileFrame &GetLastResults() const;
+  // Converts a raw timestamp of the device, e.g. from
+  // vkGetCalibratedTimestampsEXT, to the clock of GpuProfileNode
+  uint64_t GetNanoseconds(uint64_t timestamp) const;
+  // Prints the last results as an indented tree
+  void Log(std::ostream &stream) const;
+
+ private:
+  struct Scope {
+    std::string Name;
+    uint32_t Parent;
+    uint32_t Depth;
+  };
+  struct Slot {
+    VkQueryPool QueryPool;
+    // Scope i writes queries 2 * i and 2 * i + 1
+    std::vector<Scope> Scopes;
+    std::vector<uint32_t> OpenScopes;
+  };
+
+  GpuProfiler(const GpuProfiler &);
+  GpuProfiler &operator=(const GpuProfiler &);
+  bool CreateSlot(Slot &slot);
+  VkDevice device_;
+  TimelineScheduler *timeline_;
+  bool enabled_;
+  double timestamp_period_;
+  uint64_t timestamp_mask_;
+  uint32_t max_scopes_;
+  std::vector<Slot> slots_;
+  GpuProfileFrame last_results_;
+  uint64_t collected_frames_;
+};
+
+// ************************************************************ //
+// GpuProfileScope                                              //
+//                                                              //
+// Profiles commands recorded during its lifetime               //
+// ************************************************************ //
+class GpuProfileScope {
+ public:
+  GpuProfileScope(GpuProfiler &profiler, uint32_t slot,
+                  VkCommandBuffer command_buffer, const char *name);
+  ~GpuProfileScope();
+
+ private:
+  GpuProfileScope(const GpuProfileScope &);
+  GpuProfileScope &operator=(const GpuProfileScope &);
+  GpuProfiler &profiler_;
+  uint32_t slot_;
+  VkCommandBuffer command_buffer_;
+  uint32_t scope_;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "parallel_recorder.h"
+
+#include <iostream>
+
+#include "tracer.h"
+
+ParallelRecorder::ParallelRecorder()
+    : device_(VK_NULL_HANDLE),
+      thread_count_(0),
+      pools_(),
+      workers_(),
+      job_(),
+      job_generation_(0),
+      workers_busy_(0),
+      job_failed_(false),
+      quit_(false) {}
+
+ParallelRecorder::~ParallelRecorder() { Destroy(); }
+
+bool ParallelRecorder::Create(VkDevice device, uint32_t queue_family_index,
+                              uint32_t slot_count, uint32_t thread_count) {
+  device_ = device;
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+  }
+  thread_count_ = thread_count > 0 ? thread_count : 1;
+
+  // Pools are reset as a whole, never single command buffers
+  VkCommandPoolCreateInfo command_pool_create_info = {};
+  command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  command_pool_create_info.queueFamilyIndex = queue_family_index;
+
+  pools_.resize(slot_count * thread_count_);
+  for (ThreadPool &pool : pools_) {
+    if (vkCreateCommandPool(device_, &command_pool_create_info, nullptr,
+                            &pool.Pool) != VK_SUCCESS) {
+      std::cout << "Could not create a recording thread command pool!"
+                << std::endl;
+      return false;
+    }
+  }
+
+  // Thread 0 is the one calling Record()
+  quit_ = false;
+  for (uint32_t i = 1; i < thread_count_; ++i) {
+    workers_.push_back(std::thread(&ParallelRecorder::WorkerLoop, this, i));
+  }
+  return true;
+}
+
+void ParallelRecorder::Destroy() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  job_started_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  for (ThreadPool &pool : pools_) {
+    if (pool.Pool != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(device_, pool.Pool, nullptr);
+    }
+  }
+  pools_.clear();
+  device_ = VK_NULL_HANDLE;
+}
+
+uint32_t ParallelRecorder::GetThreadCount() const { return thread_count_; }
+
+bool ParallelRecorder::BeginSlot(uint32_t slot) {
+  if ((slot + 1) * thread_count_ > pools_.size()) {
+    return false;
+  }
+  for (uint32_t i = 0; i < thread_count_; ++i) {
+    ThreadPool &pool = pools_[slot * thread_count_ + i];
+    if (vkResetCommandPool(device_, pool.Pool, 0) != VK_SUCCESS) {
+      std::cout << "Could not reset a recording thread command pool!"
+                << std::endl;
+      return false;
+    }
+    pool.UsedCount = 0;
+  }
+  return true;
+}
+
+bool ParallelRecorder::Record(uint32_t slot, VkRenderPass render_pass,
+                              uint32_t subpass, VkFramebuffer framebuffer,
+                              uint32_t task_count,
+                              const RecordFunction &record_function,
+                              std::vector<VkCommandBuffer> *command_buffers) {
+  TraceZone zone("Record secondaries");
+  if ((slot + 1) * thread_count_ > pools_.size()) {
+    return false;
+  }
+  command_buffers->assign(task_count, VK_NULL_HANDLE);
+
+  Job job = {};
+  job.Slot = slot;
+  job.InheritanceInfo.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  job.InheritanceInfo.renderPass = render_pass;
+  job.InheritanceInfo.subpass = subpass;
+  job.InheritanceInfo.framebuffer = framebuffer;
+  job.Usage = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (render_pass != VK_NULL_HANDLE) {
+    job.Usage |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  }
+  job.TaskCount = task_count;
+  job.Function = &record_function;
+  job.CommandBuffers = command_buffers;
+
+  // Not worth waking the workers for a single task
+  if ((thread_count_ == 1) || (task_count < 2)) {
+    return RecordTasks(0, 0, task_count, job);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = job;
+    job_failed_ = false;
+    workers_busy_ = thread_count_ - 1;
+    ++job_generation_;
+  }
+  job_started_.notify_all();
+
+  bool result = RecordTasks(0, 0, task_count / thread_count_, job);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_finished_.wait(lock, [this]() { return workers_busy_ == 0; });
+  return result && !job_failed_;
+}
+
+void ParallelRecorder::WorkerLoop(uint32_t thread_index) {
+  uint64_t last_generation = 0;
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_started_.wait(lock, [this, last_generation]() {
+        return quit_ || (job_generation_ != last_generation);
+      });
+      if (quit_) {
+        return;
+      }
+      last_generation = job_generation_;
+      job = job_;
+    }
+
+    // Every thread takes a contiguous share of the tasks
+    uint32_t first_task = job.TaskCount * thread_index / thread_count_;
+    uint32_t last_task = job.TaskCount * (thread_index + 1) / thread_count_;
+    bool result = RecordTasks(thread_index, first_task, last_task, job);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!result) {
+        job_failed_ = true;
+      }
+      --workers_busy_;
+    }
+    job_finished_.notify_one();
+  }
+}
+
+bool ParallelRecorder::RecordTasks(uint32_t thread_index, uint32_t first_task,
+                                   uint32_t last_task, const Job &job) {
+  if (first_task == last_task) {
+    return true;
+  }
+  TraceZone zone("Record tasks");
+  ThreadPool &pool = pools_[job.Slot * thread_count_ + thread_index];
+
+  uint32_t needed = pool.UsedCount + (last_task - first_task);
+  if (needed > pool.CommandBuffers.size()) {
+    uint32_t first_new = static_cast<uint32_t>(pool.CommandBuffers.size());
+    pool.CommandBuffers.resize(needed);
+
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.commandPool = pool.Pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    command_buffer_allocate_info.commandBufferCount = needed - first_new;
+    if (vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                                 &pool.CommandBuffers[first_new]) !=
+        VK_SUCCESS) {
+      pool.CommandBuffers.resize(first_new);
+      std::cout << "Could not allocate secondary command buffers!"
+                << std::endl;
+      return false;
+    }
+  }
+
+  VkCommandBufferBeginInfo command_buffer_begin_info = {};
+  command_buffer_begin_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  command_buffer_begin_info.flags = job.Usage;
+  command_buffer_begin_info.pInheritanceInfo = &job.InheritanceInfo;
+
+  for (uint32_t task = first_task; task < last_task; ++task) {
+    VkCommandBuffer command_buffer = pool.CommandBuffers[pool.UsedCount++];
+    if (vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info) !=
+        VK_SUCCESS) {
+      std::cout << "Could not begin a secondary command buffer!" << std::endl;
+      return false;
+    }
+    (*job.Function)(command_buffer, task);
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+      std::cout << "Could not record a secondary command buffer!"
+                << std::endl;
+      return false;
+    }
+    // Every thread writes its own range of the output
+    (*job.CommandBuffers)[task] = command_buffer;
+  }
+  return true;
+}
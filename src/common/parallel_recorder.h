@@ -0,0 +1,85 @@
+#ifndef PARALLEL_RECORDER_H_
+#define PARALLEL_RECORDER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ************************************************************ //
+// ParallelRecorder                                             //
+//                                                              //
+// Splits recording of a frame into secondary command buffers   //
+// recorded by a pool of worker threads; every thread owns one  //
+// command pool per slot (frame in flight) so recording never   //
+// needs a lock and a slot's pools are reset as a whole         //
+// ************************************************************ //
+class ParallelRecorder {
+ public:
+  // Records the commands of task into a secondary command buffer; called
+  // concurrently from several threads
+  typedef std::function<void(VkCommandBuffer command_buffer, uint32_t task)>
+      RecordFunction;
+
+  ParallelRecorder();
+  ~ParallelRecorder();
+  // thread_count includes the calling thread; 0 picks one thread per core
+  bool Create(VkDevice device, uint32_t queue_family_index,
+              uint32_t slot_count, uint32_t thread_count = 0);
+  // Joins the workers and destroys all pools; the GPU must be done with them
+  void Destroy();
+  uint32_t GetThreadCount() const;
+  // Resets all pools of slot; the slot's previous submission must have
+  // completed
+  bool BeginSlot(uint32_t slot);
+  // Records task_count secondary command buffers continuing subpass of
+  // render_pass (or outside of a render pass for VK_NULL_HANDLE) and
+  // returns them in task order, ready for vkCmdExecuteCommands()
+  bool Record(uint32_t slot, VkRenderPass render_pass, uint32_t subpass,
+              VkFramebuffer framebuffer, uint32_t task_count,
+              const RecordFunction &record_function,
+              std::vector<VkCommandBuffer> *command_buffers);
+
+ private:
+  struct ThreadPool {
+    VkCommandPool Pool;
+    std::vector<VkCommandBuffer> CommandBuffers;
+    uint32_t UsedCount;
+
+    ThreadPool() : Pool(VK_NULL_HANDLE), CommandBuffers(), UsedCount(0) {}
+  };
+  struct Job {
+    uint32_t Slot;
+    VkCommandBufferInheritanceInfo InheritanceInfo;
+    VkCommandBufferUsageFlags Usage;
+    uint32_t TaskCount;
+    const RecordFunction *Function;
+    std::vector<VkCommandBuffer> *CommandBuffers;
+  };
+
+  ParallelRecorder(const ParallelRecorder &);
+  ParallelRecorder &operator=(const ParallelRecorder &);
+  void WorkerLoop(uint32_t thread_index);
+  // Records tasks [first_task, last_task) into the thread's pool of the
+  // job's slot
+  bool RecordTasks(uint32_t thread_index, uint32_t first_task,
+                   uint32_t last_task, const Job &job);
+  VkDevice device_;
+  uint32_t thread_count_;
+  // Indexed by slot * thread_count_ + thread
+  std::vector<ThreadPool> pools_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable job_started_;
+  std::condition_variable job_finished_;
+  Job job_;
+  uint64_t job_generation_;
+  uint32_t workers_busy_;
+  bool job_failed_;
+  bool quit_;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "pipeline_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+PipelineCache::PipelineCache()
+    : device_(VK_NULL_HANDLE),
+      handle_(VK_NULL_HANDLE),
+      device_properties_(),
+      filename_() {}
+
+PipelineCache::~PipelineCache() { Destroy(); }
+
+bool PipelineCache::Create(VkPhysicalDevice physical_device, VkDevice device,
+                           const std::string &filename) {
+  device_ = device;
+  filename_ = filename;
+  vkGetPhysicalDeviceProperties(physical_device, &device_properties_);
+
+  // A missing file is the normal cold start case so it isn't reported
+  std::vector<char> data;
+  std::ifstream file(filename_, std::ios::binary | std::ios::ate);
+  if (file.is_open()) {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(data.data(), data.size())) {
+      data.clear();
+    }
+  }
+  if (!data.empty() && !IsCompatible(data)) {
+    std::cout << "Pipeline cache \"" << filename_
+              << "\" was created for a different device or driver, ignoring!"
+              << std::endl;
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo pipeline_cache_create_info = {};
+  pipeline_cache_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_create_info.initialDataSize = data.size();
+  pipeline_cache_create_info.pInitialData = data.empty() ? nullptr : data.data();
+
+  if (vkCreatePipelineCache(device_, &pipeline_cache_create_info, nullptr,
+                            &handle_) != VK_SUCCESS) {
+    std::cout << "Could not create pipeline cache!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PipelineCache::Destroy() {
+  if (handle_ == VK_NULL_HANDLE) {
+    return;
+  }
+  Save();
+
+  vkDestroyPipelineCache(device_, handle_, nullptr);
+  handle_ = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::Save() {
+  size_t data_size = 0;
+  if ((vkGetPipelineCacheData(device_, handle_, &data_size, nullptr) !=
+       VK_SUCCESS) ||
+      (data_size == 0)) {
+    std::cout << "Could not get pipeline cache data!" << std::endl;
+    return false;
+  }
+
+  std::vector<char> data(data_size);
+  if (vkGetPipelineCacheData(device_, handle_, &data_size, data.data()) !=
+      VK_SUCCESS) {
+    std::cout << "Could not get pipeline cache data!" << std::endl;
+    return false;
+  }
+
+  // Write next to the target and rename over it so a crash mid-write never
+  // leaves a truncated cache behind
+  std::string temporary_filename = filename_ + ".tmp";
+  {
+    std::ofstream file(temporary_filename,
+                       std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), data_size)) {
+      std::cout << "Could not write \"" << temporary_filename << "\" file!"
+                << std::endl;
+      return false;
+    }
+  }
+  if (std::rename(temporary_filename.c_str(), filename_.c_str()) != 0) {
+    std::cout << "Could not replace \"" << filename_ << "\" file!"
+              << std::endl;
+    std::remove(temporary_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+VkPipelineCache PipelineCache::GetHandle() const { return handle_; }
+
+bool PipelineCache::IsCompatible(const std::vector<char> &data) const {
+  // Header layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+  uint32_t header_size = 0;
+  uint32_t header_version = 0;
+  uint32_t vendor_id = 0;
+  uint32_t device_id = 0;
+  uint8_t cache_uuid[VK_UUID_SIZE] = {};
+
+  if (data.size() < 16 + VK_UUID_SIZE) {
+    return false;
+  }
+  memcpy(&header_size, data.data(), 4);
+  memcpy(&header_version, data.data() + 4, 4);
+  memcpy(&vendor_id, data.data() + 8, 4);
+  memcpy(&device_id, data.data() + 12, 4);
+  memcpy(cache_uuid, data.data() + 16, VK_UUID_SIZE);
+
+  return (header_size >= 16 + VK_UUID_SIZE) && (header_size <= data.size()) &&
+         (header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE) &&
+         (vendor_id == device_properties_.vendorID) &&
+         (device_id == device_properties_.deviceID) &&
+         (memcmp(cache_uuid, device_properties_.pipelineCacheUUID,
+                 VK_UUID_SIZE) == 0);
+}
@@ -0,0 +1,36 @@
+#ifndef PIPELINE_CACHE_H_
+#define PIPELINE_CACHE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+// ************************************************************ //
+// PipelineCache                                                //
+//                                                              //
+// VkPipelineCache persisted on disk between runs; a stored     //
+// blob is only reused when its header matches the device       //
+// ************************************************************ //
+class PipelineCache {
+ public:
+  PipelineCache();
+  ~PipelineCache();
+  bool Create(VkPhysicalDevice physical_device, VkDevice device,
+              const std::string &filename);
+  // Writes the cache back to disk and destroys it
+  void Destroy();
+  bool Save();
+  VkPipelineCache GetHandle() const;
+
+ private:
+  PipelineCache(const PipelineCache &);
+  PipelineCache &operator=(const PipelineCache &);
+  bool IsCompatible(const std::vector<char> &data) const;
+  VkDevice device_;
+  VkPipelineCache handle_;
+  VkPhysicalDeviceProperties device_properties_;
+  std::string filename_;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "pipeline_compiler.h"
+
+#include <iostream>
+#include <utility>
+
+#include "tracer.h"
+
+PipelineFuture::PipelineFuture()
+    : state_(), fallback_state_(), fallback_(VK_NULL_HANDLE) {}
+
+PipelineFuture::PipelineFuture(const std::shared_ptr<State> &state)
+    : state_(state), fallback_state_(), fallback_(VK_NULL_HANDLE) {}
+
+bool PipelineFuture::IsValid() const { return state_ != nullptr; }
+
+bool PipelineFuture::IsReady() const {
+  if (!state_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(state_->Mutex);
+  return state_->Ready;
+}
+
+bool PipelineFuture::HasFailed() const {
+  if (!state_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(state_->Mutex);
+  return state_->Failed;
+}
+
+VkPipeline PipelineFuture::Get() const {
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (state_ && GetResult(*state_, &pipeline)) {
+    return pipeline;
+  }
+  if (fallback_state_ && GetResult(*fallback_state_, &pipeline)) {
+    return pipeline;
+  }
+  return fallback_;
+}
+
+VkPipeline PipelineFuture::Wait() const {
+  if (!state_) {
+    return VK_NULL_HANDLE;
+  }
+  {
+    std::unique_lock<std::mutex> lock(state_->Mutex);
+    state_->Finished.wait(lock, [this]() { return state_->Ready; });
+  }
+  return Get();
+}
+
+void PipelineFuture::Reset() {
+  state_.reset();
+  fallback_state_.reset();
+  fallback_ = VK_NULL_HANDLE;
+}
+
+void PipelineFuture::SetFallback(VkPipeline fallback) { fallback_ = fallback; }
+
+void PipelineFuture::SetFallback(const PipelineFuture &fallback) {
+  fallback_state_ = fallback.state_;
+}
+
+bool PipelineFuture::GetResult(State &state, VkPipeline *pipeline) {
+  std::lock_guard<std::mutex> lock(state.Mutex);
+  if (!state.Ready || state.Failed) {
+    return false;
+  }
+  *pipeline = state.Handle;
+  return true;
+}
+
+PipelineCompiler::PipelineCompiler()
+    : device_(VK_NULL_HANDLE),
+      cache_(VK_NULL_HANDLE),
+      workers_(),
+      jobs_(),
+      jobs_running_(0),
+      quit_(false) {}
+
+PipelineCompiler::~PipelineCompiler() { Destroy(); }
+
+bool PipelineCompiler::Create(VkDevice device, VkPipelineCache cache,
+                              uint32_t thread_count) {
+  device_ = device;
+  cache_ = cache;
+  if (thread_count == 0) {
+    uint32_t core_count = std::thread::hardware_concurrency();
+    thread_count = core_count > 1 ? core_count - 1 : 1;
+  }
+
+  quit_ = false;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    workers_.push_back(std::thread(&PipelineCompiler::WorkerLoop, this));
+  }
+  return true;
+}
+
+void PipelineCompiler::Destroy() {
+  std::deque<Job> dropped_jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    dropped_jobs.swap(jobs_);
+  }
+  job_queued_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+
+  for (Job &job : dropped_jobs) {
+    Finish(*job.State, false, VK_NULL_HANDLE);
+  }
+  idle_.notify_all();
+  device_ = VK_NULL_HANDLE;
+  cache_ = VK_NULL_HANDLE;
+}
+
+VkPipelineCache PipelineCompiler::GetCache() const { return cache_; }
+
+PipelineFuture PipelineCompiler::Compile(BuildFunction build,
+                                         VkPipeline fallback) {
+  std::shared_ptr<PipelineFuture::State> state =
+      std::make_shared<PipelineFuture::State>();
+  PipelineFuture future(state);
+  future.SetFallback(fallback);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!quit_ && !workers_.empty()) {
+      Job job;
+      job.Build = std::move(build);
+      job.State = state;
+      jobs_.push_back(std::move(job));
+      job_queued_.notify_one();
+      return future;
+    }
+  }
+  std::cout << "Could not queue a pipeline, the compiler isn't running!"
+            << std::endl;
+  Finish(*state, false, VK_NULL_HANDLE);
+  return future;
+}
+
+void PipelineCompiler::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock,
+             [this]() { return jobs_.empty() && (jobs_running_ == 0); });
+}
+
+void PipelineCompiler::WorkerLoop() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_queued_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+      if (quit_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+      ++jobs_running_;
+    }
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    bool result = false;
+    {
+      TraceZone zone("Compile pipeline");
+      result = job.Build(cache_, &pipeline);
+    }
+    // A build may fail after its pipeline was created, nobody else gets
+    // to see the handle
+    if (!result && (pipeline != VK_NULL_HANDLE)) {
+      vkDestroyPipeline(device_, pipeline, nullptr);
+      pipeline = VK_NULL_HANDLE;
+    }
+    Finish(*job.State, result, pipeline);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --jobs_running_;
+    }
+    idle_.notify_all();
+  }
+}
+
+void PipelineCompiler::Finish(PipelineFuture::State &state, bool result,
+                              VkPipeline pipeline) {
+  {
+    std::lock_guard<std::mutex> lock(state.Mutex);
+    state.Ready = true;
+    state.Failed = !result || (pipeline == VK_NULL_HANDLE);
+    state.Handle = pipeline;
+  }
+  state.Finished.notify_all();
+}
@@ -0,0 +1,113 @@
+#ifndef PIPELINE_COMPILER_H_
+#define PIPELINE_COMPILER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ************************************************************ //
+// PipelineFuture                                               //
+//                                                              //
+// Result of a pipeline queued on a PipelineCompiler; polled by //
+// the renderer each frame. The compiled pipeline belongs to    //
+// the caller, who has to wait for pending futures before       //
+// dropping them                                                //
+// ************************************************************ //
+class PipelineFuture {
+ public:
+  PipelineFuture();
+  bool IsValid() const;
+  // Compilation finished, successfully or not
+  bool IsReady() const;
+  bool HasFailed() const;
+  // The compiled pipeline once ready, the fallback before and after a
+  // failure; a fallback future is used once it is ready itself
+  VkPipeline Get() const;
+  // Blocks until compilation finished, then returns Get()
+  VkPipeline Wait() const;
+  // Drops the reference to the job, e.g. once its result was taken over
+  void Reset();
+  // Replaces the fallback of this handle only; copies keep their own
+  void SetFallback(VkPipeline fallback);
+  // Pipeline compiled by another job, e.g. a quicker unoptimized version,
+  // that is preferred over the fallback pipeline once it is ready
+  void SetFallback(const PipelineFuture &fallback);
+
+ private:
+  friend class PipelineCompiler;
+  struct State {
+    std::mutex Mutex;
+    std::condition_variable Finished;
+    bool Ready;
+    bool Failed;
+    VkPipeline Handle;
+
+    State() : Ready(false), Failed(false), Handle(VK_NULL_HANDLE) {}
+  };
+
+  explicit PipelineFuture(const std::shared_ptr<State> &state);
+  static bool GetResult(State &state, VkPipeline *pipeline);
+  std::shared_ptr<State> state_;
+  std::shared_ptr<State> fallback_state_;
+  VkPipeline fallback_;
+};
+
+// ************************************************************ //
+// PipelineCompiler                                             //
+//                                                              //
+// Creates pipelines on a pool of worker threads so new         //
+// pipelines don't stall the render thread; all of them go      //
+// through the same VkPipelineCache                             //
+// ************************************************************ //
+class PipelineCompiler {
+ public:
+  // Fills create infos and calls vkCreate*Pipelines() with cache; called on
+  // a worker thread, so everything it references must outlive the job
+  typedef std::function<bool(VkPipelineCache cache, VkPipeline *pipeline)>
+      BuildFunction;
+
+  PipelineCompiler();
+  ~PipelineCompiler();
+  // thread_count 0 leaves one core to the render thread
+  bool Create(VkDevice device, VkPipelineCache cache,
+              uint32_t thread_count = 0);
+  // Waits for jobs in progress; queued jobs fail
+  void Destroy();
+  // For pipelines created on the calling thread
+  VkPipelineCache GetCache() const;
+  // fallback is what the future returns while the job is pending or if it
+  // fails, e.g. a pipeline with a simpler shader or the previous version
+  PipelineFuture Compile(BuildFunction build,
+                         VkPipeline fallback = VK_NULL_HANDLE);
+  // Blocks until all queued jobs are done
+  void WaitIdle();
+
+ private:
+  struct Job {
+    BuildFunction Build;
+    std::shared_ptr<PipelineFuture::State> State;
+  };
+
+  PipelineCompiler(const PipelineCompiler &);
+  PipelineCompiler &operator=(const PipelineCompiler &);
+  void WorkerLoop();
+  static void Finish(PipelineFuture::State &state, bool result,
+                     VkPipeline pipeline);
+  VkDevice device_;
+  VkPipelineCache cache_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable job_queued_;
+  std::condition_variable idle_;
+  std::deque<Job> jobs_;
+  uint32_t jobs_running_;
+  bool quit_;
+};
+
+#endif
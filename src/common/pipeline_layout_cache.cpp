@@ -0,0 +1,178 @@
+#include "pipeline_layout_cache.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "shader_library.h"
+
+PipelineLayoutCache::PipelineLayoutCache()
+    : device_(VK_NULL_HANDLE), set_layouts_(), pipeline_layouts_() {}
+
+PipelineLayoutCache::~PipelineLayoutCache() { Destroy(); }
+
+bool PipelineLayoutCache::Create(VkDevice device) {
+  device_ = device;
+  return true;
+}
+
+void PipelineLayoutCache::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  for (auto &layout : pipeline_layouts_) {
+    vkDestroyPipelineLayout(device_, layout.second.Handle, nullptr);
+  }
+  for (auto &layout : set_layouts_) {
+    vkDestroyDescriptorSetLayout(device_, layout.second.Handle, nullptr);
+  }
+  pipeline_layouts_.clear();
+  set_layouts_.clear();
+  device_ = VK_NULL_HANDLE;
+}
+
+VkPipelineLayout PipelineLayoutCache::GetPipelineLayout(
+    const std::vector<const ShaderReflection *> &stages,
+    std::vector<VkDescriptorSetLayout> *set_layouts) {
+  // Bindings of all stages keyed by set and binding number, so each set
+  // comes out sorted by binding
+  std::map<std::pair<uint32_t, uint32_t>, VkDescriptorSetLayoutBinding>
+      merged_bindings;
+  VkPushConstantRange push_constant_range = {};
+  uint32_t set_count = 0;
+
+  for (const ShaderReflection *stage : stages) {
+    for (const ReflectedBinding &binding : stage->GetBindings()) {
+      auto key = std::make_pair(binding.Set, binding.Binding);
+      auto merged = merged_bindings.find(key);
+      if (merged == merged_bindings.end()) {
+        VkDescriptorSetLayoutBinding layout_binding = {};
+        layout_binding.binding = binding.Binding;
+        layout_binding.descriptorType = binding.Type;
+        layout_binding.descriptorCount = binding.Count;
+        layout_binding.stageFlags = stage->GetStage();
+        merged_bindings[key] = layout_binding;
+      } else if ((merged->second.descriptorType != binding.Type) ||
+                 (merged->second.descriptorCount != binding.Count)) {
+        std::cout << "Could not merge descriptor set " << binding.Set
+                  << " binding " << binding.Binding
+                  << ", shader stages declare it differently!" << std::endl;
+        return VK_NULL_HANDLE;
+      } else {
+        merged->second.stageFlags |= stage->GetStage();
+      }
+      set_count = std::max(set_count, binding.Set + 1);
+    }
+    // A single range visible to every stage using push constants keeps
+    // vkCmdPushConstants() calls simple
+    if (stage->GetPushConstantSize() > 0) {
+      push_constant_range.stageFlags |= stage->GetStage();
+      push_constant_range.size =
+          std::max(push_constant_range.size, stage->GetPushConstantSize());
+    }
+  }
+
+  std::vector<std::vector<VkDescriptorSetLayoutBinding>> set_bindings(
+      set_count);
+  for (auto &binding : merged_bindings) {
+    set_bindings[binding.first.first].push_back(binding.second);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<VkDescriptorSetLayout> layouts;
+  std::vector<uint32_t> key;
+  for (const auto &bindings : set_bindings) {
+    // Unused set numbers below the highest one get empty layouts
+    VkDescriptorSetLayout layout = FindOrCreateSetLayout(bindings);
+    if (layout == VK_NULL_HANDLE) {
+      return VK_NULL_HANDLE;
+    }
+    layouts.push_back(layout);
+    std::vector<uint32_t> set_key = GetSetLayoutKey(bindings);
+    key.push_back(static_cast<uint32_t>(set_key.size()));
+    key.insert(key.end(), set_key.begin(), set_key.end());
+  }
+  key.push_back(push_constant_range.stageFlags);
+  key.push_back(push_constant_range.size);
+
+  if (set_layouts != nullptr) {
+    *set_layouts = layouts;
+  }
+
+  uint64_t hash =
+      ShaderLibrary::HashCode(key.data(), key.size() * sizeof(uint32_t));
+  auto range = pipeline_layouts_.equal_range(hash);
+  for (auto layout = range.first; layout != range.second; ++layout) {
+    if (layout->second.Key == key) {
+      return layout->second.Handle;
+    }
+  }
+
+  VkPipelineLayoutCreateInfo layout_create_info = {};
+  layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_create_info.setLayoutCount = static_cast<uint32_t>(layouts.size());
+  layout_create_info.pSetLayouts = layouts.data();
+  if (push_constant_range.size > 0) {
+    layout_create_info.pushConstantRangeCount = 1;
+    layout_create_info.pPushConstantRanges = &push_constant_range;
+  }
+
+  PipelineLayout layout;
+  layout.Key = key;
+  if (vkCreatePipelineLayout(device_, &layout_create_info, nullptr,
+                             &layout.Handle) != VK_SUCCESS) {
+    std::cout << "Could not create pipeline layout!" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  pipeline_layouts_.insert(std::make_pair(hash, layout));
+  return layout.Handle;
+}
+
+VkDescriptorSetLayout PipelineLayoutCache::GetSetLayout(
+    const std::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return FindOrCreateSetLayout(bindings);
+}
+
+std::vector<uint32_t> PipelineLayoutCache::GetSetLayoutKey(
+    const std::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  std::vector<uint32_t> key;
+  key.reserve(bindings.size() * 4);
+  for (const VkDescriptorSetLayoutBinding &binding : bindings) {
+    key.push_back(binding.binding);
+    key.push_back(static_cast<uint32_t>(binding.descriptorType));
+    key.push_back(binding.descriptorCount);
+    key.push_back(binding.stageFlags);
+  }
+  return key;
+}
+
+VkDescriptorSetLayout PipelineLayoutCache::FindOrCreateSetLayout(
+    const std::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  std::vector<uint32_t> key = GetSetLayoutKey(bindings);
+  uint64_t hash =
+      ShaderLibrary::HashCode(key.data(), key.size() * sizeof(uint32_t));
+  auto range = set_layouts_.equal_range(hash);
+  for (auto layout = range.first; layout != range.second; ++layout) {
+    if (layout->second.Key == key) {
+      return layout->second.Handle;
+    }
+  }
+
+  VkDescriptorSetLayoutCreateInfo layout_create_info = {};
+  layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_create_info.bindingCount = static_cast<uint32_t>(bindings.size());
+  layout_create_info.pBindings = bindings.data();
+
+  SetLayout layout;
+  layout.Key = key;
+  if (vkCreateDescriptorSetLayout(device_, &layout_create_info, nullptr,
+                                  &layout.Handle) != VK_SUCCESS) {
+    std::cout << "Could not create descriptor set layout!" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  set_layouts_.insert(std::make_pair(hash, layout));
+  return layout.Handle;
+}
@@ -0,0 +1,60 @@
+#ifndef PIPELINE_LAYOUT_CACHE_H_
+#define PIPELINE_LAYOUT_CACHE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "shader_reflection.h"
+
+// ************************************************************ //
+// PipelineLayoutCache                                          //
+//                                                              //
+// Descriptor set layouts and pipeline layouts deduplicated by  //
+// a hash of their description; layouts live as long as the     //
+// device so pipelines with the same interface share one and    //
+// stay compatible for descriptor binding                       //
+// ************************************************************ //
+class PipelineLayoutCache {
+ public:
+  PipelineLayoutCache();
+  ~PipelineLayoutCache();
+  bool Create(VkDevice device);
+  void Destroy();
+  // Merges descriptors and push constants of all stages; set layouts are
+  // returned through set_layouts when it isn't nullptr. Returns
+  // VK_NULL_HANDLE if stages disagree about a binding
+  VkPipelineLayout GetPipelineLayout(
+      const std::vector<const ShaderReflection *> &stages,
+      std::vector<VkDescriptorSetLayout> *set_layouts = nullptr);
+  // Bindings must be sorted by binding number
+  VkDescriptorSetLayout GetSetLayout(
+      const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+
+ private:
+  struct SetLayout {
+    std::vector<uint32_t> Key;
+    VkDescriptorSetLayout Handle;
+  };
+  struct PipelineLayout {
+    std::vector<uint32_t> Key;
+    VkPipelineLayout Handle;
+  };
+
+  PipelineLayoutCache(const PipelineLayoutCache &);
+  PipelineLayoutCache &operator=(const PipelineLayoutCache &);
+  static std::vector<uint32_t> GetSetLayoutKey(
+      const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+  // Callers hold mutex_
+  VkDescriptorSetLayout FindOrCreateSetLayout(
+      const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+  VkDevice device_;
+  std::mutex mutex_;
+  std::unordered_multimap<uint64_t, SetLayout> set_layouts_;
+  std::unordered_multimap<uint64_t, PipelineLayout> pipeline_layouts_;
+};
+
+#endif
@@ -0,0 +1,820 @@
+#include "pipeline_registry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "tracer.h"
+
+namespace {
+
+// ************************************************************ //
+// StageSpecialization                                          //
+//                                                              //
+// Specialization info of one shader stage with its storage     //
+// ************************************************************ //
+struct StageSpecialization {
+  std::vector<VkSpecializationMapEntry> MapEntries;
+  std::vector<uint32_t> Data;
+  VkSpecializationInfo Info;
+
+  StageSpecialization() : MapEntries(), Data(), Info() {}
+};
+
+bool DeclaresConstant(const ShaderReflection *reflection,
+                      uint32_t constant_id) {
+  if (reflection == nullptr) {
+    return false;
+  }
+  for (const ReflectedSpecializationConstant &constant :
+       reflection->GetSpecializationConstants()) {
+    if (constant.ConstantId == constant_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GetSpecialization(const PipelineDesc &desc,
+                       const ShaderReflection *reflection,
+                       StageSpecialization *specialization) {
+  for (const ReflectedSpecializationConstant &constant :
+       reflection->GetSpecializationConstants()) {
+    auto value = std::lower_bound(
+        desc.Constants.begin(), desc.Constants.end(), constant.ConstantId,
+        [](const SpecializationConstant &a, uint32_t constant_id) {
+          return a.ConstantId < constant_id;
+        });
+    // Constants not given keep the default from the shader
+    if ((value == desc.Constants.end()) ||
+        (value->ConstantId != constant.ConstantId)) {
+      continue;
+    }
+    if (constant.Size != sizeof(uint32_t)) {
+      std::cout << "Could not specialize constant " << constant.ConstantId
+                << ", only 32-bit constants are supported!" << std::endl;
+      return false;
+    }
+    VkSpecializationMapEntry map_entry = {};
+    map_entry.constantID = constant.ConstantId;
+    map_entry.offset =
+        static_cast<uint32_t>(specialization->Data.size() * sizeof(uint32_t));
+    map_entry.size = sizeof(uint32_t);
+    specialization->MapEntries.push_back(map_entry);
+    specialization->Data.push_back(value->Value);
+  }
+
+  specialization->Info.mapEntryCount =
+      static_cast<uint32_t>(specialization->MapEntries.size());
+  specialization->Info.pMapEntries = specialization->MapEntries.data();
+  specialization->Info.dataSize =
+      specialization->Data.size() * sizeof(uint32_t);
+  specialization->Info.pData = specialization->Data.data();
+  return true;
+}
+
+void AppendHandle(uint64_t value, std::vector<uint32_t> *key) {
+  key->push_back(static_cast<uint32_t>(value));
+  key->push_back(static_cast<uint32_t>(value >> 32));
+}
+
+// Non-dispatchable handles are pointers or 64-bit integers depending on the
+// platform
+uint64_t GetHandleValue(VkPipelineLayout layout) {
+  uint64_t value = 0;
+  memcpy(&value, &layout, sizeof(layout));
+  return value;
+}
+
+void AppendConstants(const PipelineDesc &desc,
+                     const ShaderReflection *reflection,
+                     std::vector<uint32_t> *key) {
+  for (const SpecializationConstant &constant : desc.Constants) {
+    if (DeclaresConstant(reflection, constant.ConstantId)) {
+      key->push_back(constant.ConstantId);
+      key->push_back(constant.Value);
+    }
+  }
+}
+
+}  // namespace
+
+// ************************************************************ //
+// PipelineRegistry::PipelineState                              //
+//                                                              //
+// Create infos of every part of a pipeline together with the   //
+// storage they point to; not copyable                          //
+// ************************************************************ //
+struct PipelineRegistry::PipelineState {
+  StageSpecialization Specializations[2];
+  // Vertex stage first, then the fragment stage if there is one
+  std::vector<VkPipelineShaderStageCreateInfo> Stages;
+  std::vector<VkVertexInputAttributeDescription> Attributes;
+  VkVertexInputBindingDescription Binding;
+  VkPipelineVertexInputStateCreateInfo VertexInput;
+  VkPipelineInputAssemblyStateCreateInfo InputAssembly;
+  VkPipelineViewportStateCreateInfo Viewport;
+  VkDynamicState DynamicStates[2];
+  VkPipelineDynamicStateCreateInfo Dynamic;
+  VkPipelineRasterizationStateCreateInfo Rasterization;
+  VkPipelineMultisampleStateCreateInfo Multisample;
+  VkPipelineDepthStencilStateCreateInfo DepthStencil;
+  VkPipelineColorBlendStateCreateInfo ColorBlend;
+  VkPipelineLayout Layout;
+
+  PipelineState()
+      : Specializations(),
+        Stages(),
+        Attributes(),
+        Binding(),
+        VertexInput(),
+        InputAssembly(),
+        Viewport(),
+        DynamicStates(),
+        Dynamic(),
+        Rasterization(),
+        Multisample(),
+        DepthStencil(),
+        ColorBlend(),
+        Layout(VK_NULL_HANDLE) {}
+
+ private:
+  PipelineState(const PipelineState &);
+  PipelineState &operator=(const PipelineState &);
+};
+
+PipelineDesc::PipelineDesc()
+    : VertexShader(),
+      FragmentShader(),
+      VertexStride(0),
+      Topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST),
+      PolygonMode(VK_POLYGON_MODE_FILL),
+      CullMode(VK_CULL_MODE_BACK_BIT),
+      FrontFace(VK_FRONT_FACE_COUNTER_CLOCKWISE),
+      Samples(VK_SAMPLE_COUNT_1_BIT),
+      DepthTest(VK_FALSE),
+      DepthWrite(VK_FALSE),
+      DepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL),
+      Blend(),
+      ColorFormat(VK_FORMAT_UNDEFINED),
+      DepthFormat(VK_FORMAT_UNDEFINED),
+      Subpass(0),
+      RenderPass(VK_NULL_HANDLE),
+      Constants() {
+  Blend.blendEnable = VK_FALSE;
+  Blend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  Blend.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+  Blend.colorBlendOp = VK_BLEND_OP_ADD;
+  Blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  Blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  Blend.alphaBlendOp = VK_BLEND_OP_ADD;
+  Blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+}
+
+void PipelineDesc::SetConstant(uint32_t constant_id, uint32_t value) {
+  auto constant = std::lower_bound(
+      Constants.begin(), Constants.end(), constant_id,
+      [](const SpecializationConstant &a, uint32_t constant_id) {
+        return a.ConstantId < constant_id;
+      });
+  if ((constant == Constants.end()) || (constant->ConstantId != constant_id)) {
+    constant = Constants.insert(constant, SpecializationConstant());
+    constant->ConstantId = constant_id;
+  }
+  constant->Value = value;
+}
+
+void PipelineDesc::SetFloatConstant(uint32_t constant_id, float value) {
+  uint32_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  SetConstant(constant_id, bits);
+}
+
+PipelineRegistry::PipelineRegistry()
+    : device_(VK_NULL_HANDLE),
+      shader_library_(nullptr),
+      layout_cache_(nullptr),
+      compiler_(nullptr),
+      timeline_(nullptr),
+      use_libraries_(false),
+      entries_(),
+      libraries_() {}
+
+PipelineRegistry::~PipelineRegistry() { Destroy(); }
+
+bool PipelineRegistry::Create(VkDevice device, ShaderLibrary *shader_library,
+                              PipelineLayoutCache *layout_cache,
+                              PipelineCompiler *compiler,
+                              TimelineScheduler *timeline,
+                              bool use_libraries) {
+  device_ = device;
+  shader_library_ = shader_library;
+  layout_cache_ = layout_cache;
+  compiler_ = compiler;
+  timeline_ = timeline;
+  use_libraries_ = use_libraries;
+  return true;
+}
+
+void PipelineRegistry::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  // Jobs still running take mutex_ for their libraries, so wait for them
+  // without holding it
+  std::unordered_multimap<uint64_t, Entry> entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries.swap(entries_);
+  }
+  for (auto &entry : entries) {
+    PipelineFuture *futures[] = {&entry.second.Linked, &entry.second.Future};
+    for (PipelineFuture *future : futures) {
+      if (future->IsValid()) {
+        future->Wait();
+        if (!future->HasFailed()) {
+          vkDestroyPipeline(device_, future->Get(), nullptr);
+        }
+      }
+    }
+  }
+  // Linked pipelines don't depend on their libraries, but the optimizing
+  // jobs above did
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &library : libraries_) {
+    vkDestroyPipeline(device_, library.second.Handle, nullptr);
+  }
+  libraries_.clear();
+  device_ = VK_NULL_HANDLE;
+}
+
+VkPipeline PipelineRegistry::GetPipeline(const PipelineDesc &desc) {
+  // Goes through the workers as well so concurrent requests for the same
+  // description still compile it only once
+  PipelineFuture linked;
+  PipelineFuture future;
+  if (!GetEntry(desc, &linked, &future)) {
+    return VK_NULL_HANDLE;
+  }
+  VkPipeline pipeline = future.Get();
+  if (pipeline != VK_NULL_HANDLE) {
+    return pipeline;
+  }
+  if (linked.IsValid()) {
+    pipeline = linked.Wait();
+    if (pipeline != VK_NULL_HANDLE) {
+      return pipeline;
+    }
+  }
+  return future.Wait();
+}
+
+PipelineFuture PipelineRegistry::GetPipelineAsync(const PipelineDesc &desc,
+                                                  VkPipeline fallback) {
+  PipelineFuture linked;
+  PipelineFuture future;
+  if (!GetEntry(desc, &linked, &future)) {
+    return PipelineFuture();
+  }
+  future.SetFallback(fallback);
+  if (linked.IsValid()) {
+    future.SetFallback(linked);
+  }
+  return future;
+}
+
+bool PipelineRegistry::GetEntry(const PipelineDesc &desc,
+                                PipelineFuture *linked,
+                                PipelineFuture *future) {
+  Shaders shaders;
+  if (!GetShaders(desc, &shaders)) {
+    return false;
+  }
+  std::vector<uint32_t> key = GetKey(desc, shaders);
+  uint64_t hash =
+      ShaderLibrary::HashCode(key.data(), key.size() * sizeof(uint32_t));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto range = entries_.equal_range(hash);
+  for (auto entry = range.first; entry != range.second; ++entry) {
+    if (entry->second.Key != key) {
+      continue;
+    }
+    // Failed pipelines are retried, e.g. once a broken shader is fixed; a
+    // fast-linked one is still usable when only its optimization failed
+    const PipelineFuture &entry_linked = entry->second.Linked;
+    if (entry->second.Future.IsReady() && entry->second.Future.HasFailed() &&
+        (!entry_linked.IsValid() ||
+         (entry_linked.IsReady() && entry_linked.HasFailed()))) {
+      if (entry->second.Libraries) {
+        ReleaseLibraries(*entry->second.Libraries);
+      }
+      entries_.erase(entry);
+      break;
+    }
+    *linked = entry->second.Linked;
+    *future = entry->second.Future;
+    return true;
+  }
+
+  Entry entry;
+  entry.Key = std::move(key);
+  // The description is copied as the jobs run after this call returned
+  if (use_libraries_) {
+    // Linking without optimization only costs a fraction of a compile, the
+    // optimized pipeline replaces it once the workers are done with it.
+    // Jobs are taken in order, so the first one is running or done when
+    // the second one waits for it
+    std::shared_ptr<LinkedLibraries> linked_libraries =
+        std::make_shared<LinkedLibraries>();
+    linked_libraries->Layout = VK_NULL_HANDLE;
+    entry.Libraries = linked_libraries;
+    entry.Linked = compiler_->Compile(
+        [this, desc, shaders, linked_libraries](VkPipelineCache cache,
+                                                VkPipeline *pipeline) {
+          return GetLibraries(desc, shaders, &linked_libraries->Libraries,
+                              &linked_libraries->Layout) &&
+                 Link(linked_libraries->Libraries, linked_libraries->Layout,
+                      0, cache, pipeline);
+        });
+    PipelineFuture fast_link = entry.Linked;
+    entry.Future = compiler_->Compile(
+        [this, desc, shaders, linked_libraries, fast_link](
+            VkPipelineCache cache, VkPipeline *pipeline) {
+          if (fast_link.Wait() == VK_NULL_HANDLE) {
+            return Build(desc, shaders, cache, pipeline);
+          }
+          return Link(linked_libraries->Libraries, linked_libraries->Layout,
+                      VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT,
+                      cache, pipeline);
+        });
+  } else {
+    entry.Future = compiler_->Compile(
+        [this, desc, shaders](VkPipelineCache cache, VkPipeline *pipeline) {
+          return Build(desc, shaders, cache, pipeline);
+        });
+  }
+  *linked = entry.Linked;
+  *future = entry.Future;
+  entries_.insert(std::make_pair(hash, std::move(entry)));
+  return true;
+}
+
+void PipelineRegistry::Release(VkPipeline pipeline) {
+  if ((device_ == VK_NULL_HANDLE) || (pipeline == VK_NULL_HANDLE)) {
+    return;
+  }
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = entries_.begin();
+    while ((found != entries_.end()) &&
+           (found->second.Future.Get() != pipeline) &&
+           (found->second.Linked.Get() != pipeline)) {
+      ++found;
+    }
+    if (found == entries_.end()) {
+      return;
+    }
+    entry = std::move(found->second);
+    entries_.erase(found);
+  }
+
+  // Pipelines handed out come from entries whose jobs are normally done; a
+  // job still running would use the libraries below
+  std::vector<VkPipeline> pipelines;
+  for (const PipelineFuture *future : {&entry.Linked, &entry.Future}) {
+    VkPipeline result = future->Wait();
+    if (result != VK_NULL_HANDLE) {
+      pipelines.push_back(result);
+    }
+  }
+  if (entry.Libraries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReleaseLibraries(*entry.Libraries);
+  }
+
+  VkDevice device = device_;
+  timeline_->DeferRelease([device, pipelines]() {
+    for (VkPipeline released : pipelines) {
+      vkDestroyPipeline(device, released, nullptr);
+    }
+  });
+}
+
+VkPipelineLayout PipelineRegistry::GetPipelineLayout(const PipelineDesc &desc) {
+  Shaders shaders;
+  if (!GetShaders(desc, &shaders)) {
+    return VK_NULL_HANDLE;
+  }
+  std::vector<const ShaderReflection *> stages = {shaders.VertexReflection};
+  if (shaders.FragmentReflection != nullptr) {
+    stages.push_back(shaders.FragmentReflection);
+  }
+  return layout_cache_->GetPipelineLayout(stages);
+}
+
+size_t PipelineRegistry::GetPipelineCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+bool PipelineRegistry::GetShaders(const PipelineDesc &desc,
+                                  Shaders *shaders) {
+  *shaders = Shaders();
+  shaders->VertexModule = shader_library_->GetModule(desc.VertexShader);
+  shaders->VertexReflection =
+      shader_library_->GetReflection(desc.VertexShader);
+  shaders->VertexHash = shader_library_->GetHash(desc.VertexShader);
+  if (shaders->VertexModule == VK_NULL_HANDLE) {
+    return false;
+  }
+  // Depth only pipelines have no fragment shader
+  if (!desc.FragmentShader.empty()) {
+    shaders->FragmentModule = shader_library_->GetModule(desc.FragmentShader);
+    shaders->FragmentReflection =
+        shader_library_->GetReflection(desc.FragmentShader);
+    shaders->FragmentHash = shader_library_->GetHash(desc.FragmentShader);
+    if (shaders->FragmentModule == VK_NULL_HANDLE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<uint32_t> PipelineRegistry::GetKey(const PipelineDesc &desc,
+                                               const Shaders &shaders) {
+  std::vector<uint32_t> key = {
+      static_cast<uint32_t>(shaders.VertexHash),
+      static_cast<uint32_t>(shaders.VertexHash >> 32),
+      static_cast<uint32_t>(shaders.FragmentHash),
+      static_cast<uint32_t>(shaders.FragmentHash >> 32),
+      desc.VertexStride,
+      static_cast<uint32_t>(desc.Topology),
+      static_cast<uint32_t>(desc.PolygonMode),
+      desc.CullMode,
+      static_cast<uint32_t>(desc.FrontFace),
+      static_cast<uint32_t>(desc.Samples),
+      desc.DepthTest,
+      desc.DepthWrite,
+      static_cast<uint32_t>(desc.DepthCompareOp),
+      desc.Blend.blendEnable,
+      static_cast<uint32_t>(desc.Blend.srcColorBlendFactor),
+      static_cast<uint32_t>(desc.Blend.dstColorBlendFactor),
+      static_cast<uint32_t>(desc.Blend.colorBlendOp),
+      static_cast<uint32_t>(desc.Blend.srcAlphaBlendFactor),
+      static_cast<uint32_t>(desc.Blend.dstAlphaBlendFactor),
+      static_cast<uint32_t>(desc.Blend.alphaBlendOp),
+      desc.Blend.colorWriteMask,
+      static_cast<uint32_t>(desc.ColorFormat),
+      static_cast<uint32_t>(desc.DepthFormat),
+      desc.Subpass};
+  // Only constants the shaders declare make a variant, so a feature toggle
+  // that doesn't apply to these shaders still shares their pipeline
+  for (const SpecializationConstant &constant : desc.Constants) {
+    if (DeclaresConstant(shaders.VertexReflection, constant.ConstantId) ||
+        DeclaresConstant(shaders.FragmentReflection, constant.ConstantId)) {
+      key.push_back(constant.ConstantId);
+      key.push_back(constant.Value);
+    }
+  }
+  return key;
+}
+
+bool PipelineRegistry::GetState(const PipelineDesc &desc,
+                                const Shaders &shaders,
+                                PipelineState *state) {
+  std::vector<const ShaderReflection *> stages;
+  VkPipelineShaderStageCreateInfo shader_stage_create_info = {};
+  shader_stage_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shader_stage_create_info.stage = shaders.VertexReflection->GetStage();
+  shader_stage_create_info.module = shaders.VertexModule;
+  shader_stage_create_info.pName = "main";
+  state->Stages.push_back(shader_stage_create_info);
+  stages.push_back(shaders.VertexReflection);
+  if (shaders.FragmentModule != VK_NULL_HANDLE) {
+    shader_stage_create_info.stage = shaders.FragmentReflection->GetStage();
+    shader_stage_create_info.module = shaders.FragmentModule;
+    state->Stages.push_back(shader_stage_create_info);
+    stages.push_back(shaders.FragmentReflection);
+  }
+
+  for (size_t i = 0; i < stages.size(); ++i) {
+    if (!GetSpecialization(desc, stages[i], &state->Specializations[i])) {
+      return false;
+    }
+    if (!state->Specializations[i].MapEntries.empty()) {
+      state->Stages[i].pSpecializationInfo = &state->Specializations[i].Info;
+    }
+  }
+
+  // Stages, vertex inputs and the layout come from the shaders themselves
+  // so they can't get out of sync with the GLSL
+  for (const ReflectedVertexInput &input :
+       shaders.VertexReflection->GetVertexInputs()) {
+    if (input.Format == VK_FORMAT_UNDEFINED) {
+      std::cout << "Could not derive vertex input at location "
+                << input.Location << " of " << desc.VertexShader
+                << ", its type is not supported!" << std::endl;
+      return false;
+    }
+  }
+  state->Binding.binding = 0;
+  state->Binding.stride = shaders.VertexReflection->GetVertexAttributes(
+      0, &state->Attributes);
+  state->Binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  if (state->Binding.stride != desc.VertexStride) {
+    std::cout << "Vertex stride of " << desc.VertexShader << " is "
+              << state->Binding.stride << " instead of " << desc.VertexStride
+              << "!" << std::endl;
+    return false;
+  }
+
+  state->VertexInput.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  if (!state->Attributes.empty()) {
+    state->VertexInput.vertexBindingDescriptionCount = 1;
+    state->VertexInput.pVertexBindingDescriptions = &state->Binding;
+    state->VertexInput.vertexAttributeDescriptionCount =
+        static_cast<uint32_t>(state->Attributes.size());
+    state->VertexInput.pVertexAttributeDescriptions =
+        state->Attributes.data();
+  }
+
+  state->InputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  state->InputAssembly.topology = desc.Topology;
+
+  // Viewport and scissor are dynamic so pipelines survive swap chain
+  // recreation
+  state->Viewport.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  state->Viewport.viewportCount = 1;
+  state->Viewport.scissorCount = 1;
+
+  state->DynamicStates[0] = VK_DYNAMIC_STATE_VIEWPORT;
+  state->DynamicStates[1] = VK_DYNAMIC_STATE_SCISSOR;
+  state->Dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  state->Dynamic.dynamicStateCount = 2;
+  state->Dynamic.pDynamicStates = state->DynamicStates;
+
+  state->Rasterization.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  state->Rasterization.polygonMode = desc.PolygonMode;
+  state->Rasterization.cullMode = desc.CullMode;
+  state->Rasterization.frontFace = desc.FrontFace;
+  state->Rasterization.lineWidth = 1.0f;
+
+  state->Multisample.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  state->Multisample.rasterizationSamples = desc.Samples;
+  state->Multisample.minSampleShading = 1.0f;
+
+  state->DepthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  state->DepthStencil.depthTestEnable = desc.DepthTest;
+  state->DepthStencil.depthWriteEnable = desc.DepthWrite;
+  state->DepthStencil.depthCompareOp = desc.DepthCompareOp;
+  state->DepthStencil.maxDepthBounds = 1.0f;
+
+  state->ColorBlend.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  state->ColorBlend.logicOp = VK_LOGIC_OP_COPY;
+  if (desc.ColorFormat != VK_FORMAT_UNDEFINED) {
+    state->ColorBlend.attachmentCount = 1;
+    state->ColorBlend.pAttachments = &desc.Blend;
+  }
+
+  state->Layout = layout_cache_->GetPipelineLayout(stages);
+  return state->Layout != VK_NULL_HANDLE;
+}
+
+bool PipelineRegistry::Build(const PipelineDesc &desc, const Shaders &shaders,
+                             VkPipelineCache cache, VkPipeline *pipeline) {
+  TraceZone zone("Build pipeline");
+  PipelineState state;
+  if (!GetState(desc, shaders, &state)) {
+    return false;
+  }
+
+  VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+  pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_create_info.stageCount =
+      static_cast<uint32_t>(state.Stages.size());
+  pipeline_create_info.pStages = state.Stages.data();
+  pipeline_create_info.pVertexInputState = &state.VertexInput;
+  pipeline_create_info.pInputAssemblyState = &state.InputAssembly;
+  pipeline_create_info.pViewportState = &state.Viewport;
+  pipeline_create_info.pRasterizationState = &state.Rasterization;
+  pipeline_create_info.pMultisampleState = &state.Multisample;
+  if (desc.DepthFormat != VK_FORMAT_UNDEFINED) {
+    pipeline_create_info.pDepthStencilState = &state.DepthStencil;
+  }
+  pipeline_create_info.pColorBlendState = &state.ColorBlend;
+  pipeline_create_info.pDynamicState = &state.Dynamic;
+  pipeline_create_info.layout = state.Layout;
+  pipeline_create_info.renderPass = desc.RenderPass;
+  pipeline_create_info.subpass = desc.Subpass;
+  pipeline_create_info.basePipelineIndex = -1;
+
+  if (vkCreateGraphicsPipelines(device_, cache, 1, &pipeline_create_info,
+                                nullptr, pipeline) != VK_SUCCESS) {
+    std::cout << "Could not create graphics pipeline!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool PipelineRegistry::GetLibraries(const PipelineDesc &desc,
+                                    const Shaders &shaders,
+                                    std::vector<VkPipeline> *libraries,
+                                    VkPipelineLayout *layout) {
+  TraceZone zone("Get pipeline libraries");
+  PipelineState state;
+  if (!GetState(desc, shaders, &state)) {
+    return false;
+  }
+  static const VkGraphicsPipelineLibraryFlagsEXT parts[] = {
+      VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+      VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+      VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+      VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT};
+  for (VkGraphicsPipelineLibraryFlagsEXT part : parts) {
+    VkPipeline library = FindOrCreateLibrary(part, desc, shaders, state);
+    if (library == VK_NULL_HANDLE) {
+      return false;
+    }
+    libraries->push_back(library);
+  }
+  *layout = state.Layout;
+  return true;
+}
+
+VkPipeline PipelineRegistry::FindOrCreateLibrary(
+    VkGraphicsPipelineLibraryFlagsEXT part, const PipelineDesc &desc,
+    const Shaders &shaders, const PipelineState &state) {
+  // Each part is keyed only by the state it consumes, so e.g. pipelines
+  // differing in blending share their shader libraries
+  std::vector<uint32_t> key = {part};
+  VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+  switch (part) {
+    case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+      AppendHandle(shaders.VertexHash, &key);
+      key.push_back(desc.VertexStride);
+      key.push_back(static_cast<uint32_t>(desc.Topology));
+      pipeline_create_info.pVertexInputState = &state.VertexInput;
+      pipeline_create_info.pInputAssemblyState = &state.InputAssembly;
+      break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+      AppendHandle(shaders.VertexHash, &key);
+      AppendConstants(desc, shaders.VertexReflection, &key);
+      AppendHandle(GetHandleValue(state.Layout), &key);
+      key.push_back(static_cast<uint32_t>(desc.PolygonMode));
+      key.push_back(desc.CullMode);
+      key.push_back(static_cast<uint32_t>(desc.FrontFace));
+      pipeline_create_info.stageCount = 1;
+      pipeline_create_info.pStages = &state.Stages[0];
+      pipeline_create_info.pViewportState = &state.Viewport;
+      pipeline_create_info.pRasterizationState = &state.Rasterization;
+      pipeline_create_info.pDynamicState = &state.Dynamic;
+      pipeline_create_info.layout = state.Layout;
+      break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+      AppendHandle(shaders.FragmentHash, &key);
+      AppendConstants(desc, shaders.FragmentReflection, &key);
+      AppendHandle(GetHandleValue(state.Layout), &key);
+      key.push_back(static_cast<uint32_t>(desc.Samples));
+      key.push_back(desc.DepthTest);
+      key.push_back(desc.DepthWrite);
+      key.push_back(static_cast<uint32_t>(desc.DepthCompareOp));
+      // Depth only pipelines still need the part, without a shader
+      pipeline_create_info.stageCount =
+          static_cast<uint32_t>(state.Stages.size() - 1);
+      pipeline_create_info.pStages =
+          state.Stages.size() > 1 ? &state.Stages[1] : nullptr;
+      pipeline_create_info.pMultisampleState = &state.Multisample;
+      if (desc.DepthFormat != VK_FORMAT_UNDEFINED) {
+        pipeline_create_info.pDepthStencilState = &state.DepthStencil;
+      }
+      pipeline_create_info.layout = state.Layout;
+      break;
+    default:
+      key.push_back(static_cast<uint32_t>(desc.Samples));
+      key.push_back(desc.Blend.blendEnable);
+      key.push_back(static_cast<uint32_t>(desc.Blend.srcColorBlendFactor));
+      key.push_back(static_cast<uint32_t>(desc.Blend.dstColorBlendFactor));
+      key.push_back(static_cast<uint32_t>(desc.Blend.colorBlendOp));
+      key.push_back(static_cast<uint32_t>(desc.Blend.srcAlphaBlendFactor));
+      key.push_back(static_cast<uint32_t>(desc.Blend.dstAlphaBlendFactor));
+      key.push_back(static_cast<uint32_t>(desc.Blend.alphaBlendOp));
+      key.push_back(desc.Blend.colorWriteMask);
+      pipeline_create_info.pColorBlendState = &state.ColorBlend;
+      pipeline_create_info.pMultisampleState = &state.Multisample;
+      break;
+  }
+  if (part != VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT) {
+    key.push_back(static_cast<uint32_t>(desc.ColorFormat));
+    key.push_back(static_cast<uint32_t>(desc.DepthFormat));
+    key.push_back(desc.Subpass);
+    pipeline_create_info.renderPass = desc.RenderPass;
+    pipeline_create_info.subpass = desc.Subpass;
+  }
+
+  uint64_t hash =
+      ShaderLibrary::HashCode(key.data(), key.size() * sizeof(uint32_t));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto range = libraries_.equal_range(hash);
+    for (auto library = range.first; library != range.second; ++library) {
+      if (library->second.Key == key) {
+        ++library->second.References;
+        return library->second.Handle;
+      }
+    }
+  }
+
+  VkGraphicsPipelineLibraryCreateInfoEXT library_create_info = {};
+  library_create_info.sType =
+      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+  library_create_info.flags = part;
+  pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_create_info.pNext = &library_create_info;
+  // Link time optimization of the background build needs the libraries'
+  // intermediate representation
+  pipeline_create_info.flags =
+      VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+      VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+  pipeline_create_info.basePipelineIndex = -1;
+
+  Library library;
+  library.Key = std::move(key);
+  library.Handle = VK_NULL_HANDLE;
+  library.References = 1;
+  if (vkCreateGraphicsPipelines(device_, compiler_->GetCache(), 1,
+                                &pipeline_create_info, nullptr,
+                                &library.Handle) != VK_SUCCESS) {
+    std::cout << "Could not create graphics pipeline library!" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+
+  // Another worker may have created the same library in the meantime; the
+  // first one inserted is shared
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto range = libraries_.equal_range(hash);
+  for (auto existing = range.first; existing != range.second; ++existing) {
+    if (existing->second.Key == library.Key) {
+      vkDestroyPipeline(device_, library.Handle, nullptr);
+      ++existing->second.References;
+      return existing->second.Handle;
+    }
+  }
+  VkPipeline handle = library.Handle;
+  libraries_.insert(std::make_pair(hash, std::move(library)));
+  return handle;
+}
+
+bool PipelineRegistry::Link(const std::vector<VkPipeline> &libraries,
+                            VkPipelineLayout layout,
+                            VkPipelineCreateFlags flags,
+                            VkPipelineCache cache, VkPipeline *pipeline) {
+  TraceZone zone("Link pipeline");
+  VkPipelineLibraryCreateInfoKHR library_create_info = {};
+  library_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+  library_create_info.libraryCount = static_cast<uint32_t>(libraries.size());
+  library_create_info.pLibraries = libraries.data();
+
+  VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+  pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_create_info.pNext = &library_create_info;
+  pipeline_create_info.flags = flags;
+  pipeline_create_info.layout = layout;
+  pipeline_create_info.basePipelineIndex = -1;
+
+  if (vkCreateGraphicsPipelines(device_, cache, 1, &pipeline_create_info,
+                                nullptr, pipeline) != VK_SUCCESS) {
+    std::cout << "Could not link graphics pipeline!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PipelineRegistry::ReleaseLibraries(const LinkedLibraries &libraries) {
+  for (VkPipeline handle : libraries.Libraries) {
+    for (auto library = libraries_.begin(); library != libraries_.end();
+         ++library) {
+      if (library->second.Handle != handle) {
+        continue;
+      }
+      if (--library->second.References == 0) {
+        vkDestroyPipeline(device_, handle, nullptr);
+        libraries_.erase(library);
+      }
+      break;
+    }
+  }
+}
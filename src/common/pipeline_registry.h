@@ -0,0 +1,188 @@
+#ifndef PIPELINE_REGISTRY_H_
+#define PIPELINE_REGISTRY_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pipeline_compiler.h"
+#include "pipeline_layout_cache.h"
+#include "shader_library.h"
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// SpecializationConstant                                       //
+//                                                              //
+// Value of a 32-bit specialization constant; floats are stored //
+// by their bits and booleans as VkBool32                       //
+// ************************************************************ //
+struct SpecializationConstant {
+  uint32_t ConstantId;
+  uint32_t Value;
+
+  SpecializationConstant() : ConstantId(0), Value(0) {}
+};
+
+// ************************************************************ //
+// PipelineDesc                                                 //
+//                                                              //
+// Compact description of a graphics pipeline; everything not   //
+// listed is fixed: viewport and scissor are dynamic and all    //
+// reflected vertex inputs are read tightly packed from vertex  //
+// buffer binding 0                                             //
+// ************************************************************ //
+struct PipelineDesc {
+  // Names as used by ShaderLibrary; pipelines are keyed by the shaders'
+  // code, so reloaded shaders get new pipelines
+  std::string VertexShader;
+  std::string FragmentShader;
+  // Checked against the stride derived from the vertex shader inputs
+  uint32_t VertexStride;
+  VkPrimitiveTopology Topology;
+  VkPolygonMode PolygonMode;
+  VkCullModeFlags CullMode;
+  VkFrontFace FrontFace;
+  VkSampleCountFlagBits Samples;
+  VkBool32 DepthTest;
+  VkBool32 DepthWrite;
+  VkCompareOp DepthCompareOp;
+  VkPipelineColorBlendAttachmentState Blend;
+  // Render pass compatibility; a pipeline is shared by all render passes
+  // with these formats, RenderPass is only the one it is created with
+  VkFormat ColorFormat;
+  VkFormat DepthFormat;
+  uint32_t Subpass;
+  VkRenderPass RenderPass;
+  // Compile-time variant of the shaders, sorted by id; each stage gets the
+  // constants it declares, the others don't create separate pipelines
+  std::vector<SpecializationConstant> Constants;
+
+  PipelineDesc();
+  void SetConstant(uint32_t constant_id, uint32_t value);
+  void SetFloatConstant(uint32_t constant_id, float value);
+};
+
+// ************************************************************ //
+// PipelineRegistry                                             //
+//                                                              //
+// Deduplicates pipeline descriptions by hash and hands out one //
+// shared VkPipeline per unique description; pipelines are      //
+// owned by the registry and live until they are released or    //
+// the device is destroyed. With                                //
+// VK_EXT_graphics_pipeline_library pipelines are fast-linked   //
+// from cached vertex input, pre-rasterization, fragment and    //
+// output libraries and optimized in the background             //
+// ************************************************************ //
+class PipelineRegistry {
+ public:
+  PipelineRegistry();
+  ~PipelineRegistry();
+  // use_libraries requires VK_EXT_graphics_pipeline_library with fast
+  // linking to be enabled on device; released pipelines are destroyed
+  // through timeline
+  bool Create(VkDevice device, ShaderLibrary *shader_library,
+              PipelineLayoutCache *layout_cache, PipelineCompiler *compiler,
+              TimelineScheduler *timeline, bool use_libraries);
+  // Waits for pending pipelines and destroys all of them; the GPU must be
+  // done with them
+  void Destroy();
+  // Blocks until a usable pipeline exists: the fast-linked one when using
+  // libraries, the fully compiled one otherwise; VK_NULL_HANDLE on failure
+  VkPipeline GetPipeline(const PipelineDesc &desc);
+  // Compiles the pipeline on the compiler's workers unless it already
+  // exists; never compiles on the calling thread. The future returns
+  // fallback until a pipeline is ready; when using libraries the
+  // fast-linked one comes first and is replaced by the optimized one
+  PipelineFuture GetPipelineAsync(const PipelineDesc &desc,
+                                  VkPipeline fallback = VK_NULL_HANDLE);
+  // Drops the entry pipeline belongs to, e.g. once a reloaded shader
+  // replaced it, along with libraries no other entry uses. Its pipelines
+  // are destroyed after everything submitted so far, so no command buffer
+  // recorded afterwards may use them, by any user of the description.
+  // Called on the render thread
+  void Release(VkPipeline pipeline);
+  // Layout derived from the shaders' reflection, needed to bind descriptors
+  VkPipelineLayout GetPipelineLayout(const PipelineDesc &desc);
+  // Number of unique pipelines the registry holds
+  size_t GetPipelineCount();
+
+ private:
+  // Shader state resolved on the requesting thread, so a shader reloaded
+  // in the meantime can't end up in a pipeline keyed by the old code
+  struct Shaders {
+    VkShaderModule VertexModule;
+    VkShaderModule FragmentModule;
+    const ShaderReflection *VertexReflection;
+    const ShaderReflection *FragmentReflection;
+    uint64_t VertexHash;
+    uint64_t FragmentHash;
+  };
+  // Libraries the fast-link job used, for the optimizing job after it
+  struct LinkedLibraries {
+    std::vector<VkPipeline> Libraries;
+    VkPipelineLayout Layout;
+  };
+  struct Entry {
+    std::vector<uint32_t> Key;
+    PipelineFuture Future;
+    // Fast-linked from libraries, used until Future is ready; not valid
+    // without libraries
+    PipelineFuture Linked;
+    // Null without libraries; complete once Linked is ready
+    std::shared_ptr<LinkedLibraries> Libraries;
+  };
+  struct Library {
+    std::vector<uint32_t> Key;
+    VkPipeline Handle;
+    // Entries whose LinkedLibraries include it
+    uint32_t References;
+  };
+  // Create infos of all pipeline state, defined in the source file
+  struct PipelineState;
+
+  PipelineRegistry(const PipelineRegistry &);
+  PipelineRegistry &operator=(const PipelineRegistry &);
+  // Finds or queues the jobs of a description; linked is left invalid when
+  // not using libraries
+  bool GetEntry(const PipelineDesc &desc, PipelineFuture *linked,
+                PipelineFuture *future);
+  bool GetShaders(const PipelineDesc &desc, Shaders *shaders);
+  static std::vector<uint32_t> GetKey(const PipelineDesc &desc,
+                                      const Shaders &shaders);
+  bool GetState(const PipelineDesc &desc, const Shaders &shaders,
+                PipelineState *state);
+  bool Build(const PipelineDesc &desc, const Shaders &shaders,
+             VkPipelineCache cache, VkPipeline *pipeline);
+  // Called on the compiler's workers; mutex_ is only held to look up and
+  // insert libraries, not while compiling them
+  bool GetLibraries(const PipelineDesc &desc, const Shaders &shaders,
+                    std::vector<VkPipeline> *libraries,
+                    VkPipelineLayout *layout);
+  VkPipeline FindOrCreateLibrary(VkGraphicsPipelineLibraryFlagsEXT part,
+                                 const PipelineDesc &desc,
+                                 const Shaders &shaders,
+                                 const PipelineState &state);
+  bool Link(const std::vector<VkPipeline> &libraries, VkPipelineLayout layout,
+            VkPipelineCreateFlags flags, VkPipelineCache cache,
+            VkPipeline *pipeline);
+  // Drops the references of an entry whose jobs are done and destroys the
+  // libraries left unused, which linked pipelines don't depend on. Callers
+  // hold mutex_
+  void ReleaseLibraries(const LinkedLibraries &libraries);
+  VkDevice device_;
+  ShaderLibrary *shader_library_;
+  PipelineLayoutCache *layout_cache_;
+  PipelineCompiler *compiler_;
+  TimelineScheduler *timeline_;
+  bool use_libraries_;
+  std::mutex mutex_;
+  std::unordered_multimap<uint64_t, Entry> entries_;
+  std::unordered_multimap<uint64_t, Library> libraries_;
+};
+
+#endif
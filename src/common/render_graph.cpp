@@ -0,0 +1,1000 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+const VkAccessFlags kWriteAccess =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+VkImageAspectFlags GetAspectMask(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_S8_UINT:
+      return VK_IMAGE_ASPECT_STENCIL_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+      return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+bool HasMemoryType(const VkPhysicalDeviceMemoryProperties &memory_properties,
+                   uint32_t memory_type_bits, VkMemoryPropertyFlags flags) {
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+    if ((memory_type_bits & (1 << i)) &&
+        ((memory_properties.memoryTypes[i].propertyFlags & flags) == flags)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Keys are the raw bytes of the values; handles are pointers or 64-bit
+// integers depending on the platform, either way their bytes identify them
+template <typename T>
+void AppendValue(const T &value, std::string *key) {
+  key->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+}  // namespace
+
+RenderGraph::RenderGraph()
+    : device_(VK_NULL_HANDLE),
+      allocator_(nullptr),
+      timeline_(nullptr),
+      queue_family_index_(VK_QUEUE_FAMILY_IGNORED),
+      images_(),
+      passes_(),
+      batches_(),
+      render_passes_(),
+      framebuffers_() {}
+
+RenderGraph::~RenderGraph() { Destroy(); }
+
+bool RenderGraph::Create(VkDevice device, GpuAllocator *allocator,
+                         TimelineScheduler *timeline,
+                         uint32_t queue_family_index) {
+  device_ = device;
+  allocator_ = allocator;
+  timeline_ = timeline;
+  queue_family_index_ = queue_family_index;
+  return true;
+}
+
+void RenderGraph::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  Reset();
+  // Destruction waits for the device to be idle, so render passes can go
+  // right away
+  for (auto &render_pass : render_passes_) {
+    vkDestroyRenderPass(device_, render_pass.second, nullptr);
+  }
+  render_passes_.clear();
+  device_ = VK_NULL_HANDLE;
+  allocator_ = nullptr;
+  timeline_ = nullptr;
+}
+
+void RenderGraph::Reset() {
+  ReleaseFrameObjects();
+  images_.clear();
+  passes_.clear();
+  batches_.clear();
+}
+
+uint32_t RenderGraph::ImportImage(const std::string &name, VkFormat format,
+                                  VkExtent2D extent,
+                                  const RenderGraphImageState &initial_state,
+                                  const RenderGraphImageState &final_state) {
+  uint32_t image = AddImage(name, format, extent, true);
+  images_[image].InitialState = initial_state;
+  images_[image].FinalState = final_state;
+  return image;
+}
+
+uint32_t RenderGraph::CreateImage(const std::string &name, VkFormat format,
+                                  VkExtent2D extent) {
+  return AddImage(name, format, extent, false);
+}
+
+uint32_t RenderGraph::AddImage(const std::string &name, VkFormat format,
+                               VkExtent2D extent, bool imported) {
+  Image image;
+  image.Name = name;
+  image.Format = format;
+  image.Extent = extent;
+  image.Imported = imported;
+  image.Usage = 0;
+  image.Handle = VK_NULL_HANDLE;
+  image.View = VK_NULL_HANDLE;
+  image.FirstLevel = UINT32_MAX;
+  image.LastLevel = 0;
+  image.TransientAttachment = false;
+  image.MemoryRequirements = VkMemoryRequirements();
+  image.AliasedMemory = UINT32_MAX;
+  image.MemoryOffset = 0;
+  images_.push_back(image);
+  return static_cast<uint32_t>(images_.size() - 1);
+}
+
+uint32_t RenderGraph::AddPass(const std::string &name, RecordFunction record) {
+  Pass pass;
+  pass.Name = name;
+  pass.Record = record;
+  pass.Culled = false;
+  pass.Level = 0;
+  pass.RenderPass = VK_NULL_HANDLE;
+  passes_.push_back(pass);
+  return static_cast<uint32_t>(passes_.size() - 1);
+}
+
+void RenderGraph::AddColorOutput(uint32_t pass, uint32_t image,
+                                 VkAttachmentLoadOp load_op,
+                                 VkClearColorValue clear_color) {
+  Access access = {};
+  access.Image = image;
+  access.Layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  access.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  access.AccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  access.Read = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+  if (access.Read) {
+    access.AccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+  }
+  access.Write = true;
+  access.Attachment = kColorAttachment;
+  access.LoadOp = load_op;
+  access.ClearValue.color = clear_color;
+  AddAccess(pass, access);
+}
+
+void RenderGraph::AddDepthOutput(uint32_t pass, uint32_t image,
+                                 VkAttachmentLoadOp load_op,
+                                 VkClearDepthStencilValue clear_value) {
+  Access access = {};
+  access.Image = image;
+  access.Layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  access.Stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  // Depth tests read the attachment even when its contents were cleared
+  access.AccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  access.Read = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+  access.Write = true;
+  access.Attachment = kDepthAttachment;
+  access.LoadOp = load_op;
+  access.ClearValue.depthStencil = clear_value;
+  AddAccess(pass, access);
+}
+
+void RenderGraph::AddTextureInput(uint32_t pass, uint32_t image,
+                                  VkPipelineStageFlags stages) {
+  Access access = {};
+  access.Image = image;
+  access.Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  access.Stages = stages;
+  access.AccessMask = VK_ACCESS_SHADER_READ_BIT;
+  access.Read = true;
+  access.Write = false;
+  access.Attachment = kNoAttachment;
+  access.LoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  AddAccess(pass, access);
+}
+
+void RenderGraph::AddImageAccess(uint32_t pass, uint32_t image,
+                                 VkImageLayout layout,
+                                 VkPipelineStageFlags stages,
+                                 VkAccessFlags access_mask) {
+  // Write-only accesses are expected to overwrite the whole image, so the
+  // previous contents are discarded
+  Access access = {};
+  access.Image = image;
+  access.Layout = layout;
+  access.Stages = stages;
+  access.AccessMask = access_mask;
+  access.Read = (access_mask & ~kWriteAccess) != 0;
+  access.Write = (access_mask & kWriteAccess) != 0;
+  access.Attachment = kNoAttachment;
+  access.LoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  AddAccess(pass, access);
+}
+
+void RenderGraph::AddAccess(uint32_t pass, const Access &access) {
+  if ((pass >= passes_.size()) || (access.Image >= images_.size())) {
+    std::cout << "Could not add image access, unknown pass or image!"
+              << std::endl;
+    return;
+  }
+  for (const Access &other : passes_[pass].Accesses) {
+    if (other.Image == access.Image) {
+      std::cout << "Could not add image \"" << images_[access.Image].Name
+                << "\" to pass \"" << passes_[pass].Name
+                << "\" twice!" << std::endl;
+      return;
+    }
+  }
+
+  Image &image = images_[access.Image];
+  switch (access.Attachment) {
+    case kColorAttachment:
+      image.Usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+      break;
+    case kDepthAttachment:
+      image.Usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+      break;
+    case kNoAttachment:
+      break;
+  }
+  if (access.Layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    image.Usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  }
+  if ((access.Layout == VK_IMAGE_LAYOUT_GENERAL) &&
+      (access.AccessMask &
+       (VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT))) {
+    image.Usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  }
+  if (access.AccessMask & VK_ACCESS_TRANSFER_READ_BIT) {
+    image.Usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  if (access.AccessMask & VK_ACCESS_TRANSFER_WRITE_BIT) {
+    image.Usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  passes_[pass].Accesses.push_back(access);
+}
+
+bool RenderGraph::Compile() {
+  ReleaseFrameObjects();
+  CullPasses();
+  std::vector<uint32_t> order = SortPasses();
+  // Barriers depend on which images share memory
+  if (!CreateImages()) {
+    return false;
+  }
+  CreateBatches(order);
+  for (Pass &pass : passes_) {
+    pass.RenderPass = VK_NULL_HANDLE;
+    if (pass.Culled) {
+      continue;
+    }
+    bool has_attachments = false;
+    for (const Access &access : pass.Accesses) {
+      has_attachments |= access.Attachment != kNoAttachment;
+    }
+    if (has_attachments) {
+      pass.RenderPass = FindOrCreateRenderPass(pass);
+      if (pass.RenderPass == VK_NULL_HANDLE) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void RenderGraph::CullPasses() {
+  // Walks backwards from the imported images, which are the results of the
+  // frame; a pass stays if a later pass or the frame needs what it writes
+  std::vector<bool> needed(images_.size());
+  for (size_t i = 0; i < images_.size(); ++i) {
+    needed[i] = images_[i].Imported;
+  }
+  for (size_t i = passes_.size(); i-- > 0;) {
+    Pass &pass = passes_[i];
+    pass.Culled = true;
+    for (const Access &access : pass.Accesses) {
+      if (access.Write && needed[access.Image]) {
+        pass.Culled = false;
+      }
+    }
+    if (pass.Culled) {
+      continue;
+    }
+    for (Access &access : pass.Accesses) {
+      if (access.Write) {
+        access.Store = needed[access.Image];
+        needed[access.Image] = false;
+      }
+    }
+    for (const Access &access : pass.Accesses) {
+      if (access.Read) {
+        needed[access.Image] = true;
+      }
+    }
+  }
+}
+
+std::vector<uint32_t> RenderGraph::SortPasses() {
+  // A pass goes one level after the last pass writing an image it uses;
+  // writes and layout changes also wait for the reads before them. Passes
+  // on the same level are independent and share one barrier batch
+  std::vector<int32_t> write_levels(images_.size(), -1);
+  std::vector<int32_t> read_levels(images_.size(), -1);
+  std::vector<VkImageLayout> layouts(images_.size());
+  for (size_t i = 0; i < images_.size(); ++i) {
+    layouts[i] = images_[i].InitialState.Layout;
+  }
+
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i < passes_.size(); ++i) {
+    Pass &pass = passes_[i];
+    if (pass.Culled) {
+      continue;
+    }
+    int32_t level = 0;
+    for (const Access &access : pass.Accesses) {
+      level = std::max(level, write_levels[access.Image] + 1);
+      if (access.Write || (access.Layout != layouts[access.Image])) {
+        level = std::max(level, read_levels[access.Image] + 1);
+      }
+    }
+    for (const Access &access : pass.Accesses) {
+      if (access.Write || (access.Layout != layouts[access.Image])) {
+        write_levels[access.Image] = level;
+        read_levels[access.Image] = -1;
+        layouts[access.Image] = access.Layout;
+      } else {
+        read_levels[access.Image] = std::max(read_levels[access.Image], level);
+      }
+    }
+    pass.Level = static_cast<uint32_t>(level);
+    order.push_back(i);
+  }
+
+  std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return passes_[a].Level < passes_[b].Level;
+  });
+  return order;
+}
+
+void RenderGraph::CreateBatches(const std::vector<uint32_t> &order) {
+  batches_.clear();
+  std::vector<ImageState> states(images_.size());
+  for (size_t i = 0; i < images_.size(); ++i) {
+    const RenderGraphImageState &initial_state = images_[i].InitialState;
+    states[i].Layout = initial_state.Layout;
+    states[i].WriteStages = initial_state.Stages;
+    states[i].WriteAccess = initial_state.Access;
+    states[i].ReadStages = 0;
+    states[i].VisibleStages = 0;
+    states[i].VisibleAccess = 0;
+    states[i].QueueFamilyIndex = initial_state.QueueFamilyIndex;
+  }
+
+  for (uint32_t index : order) {
+    const Pass &pass = passes_[index];
+    if (batches_.empty() || batches_.back().Passes.empty() ||
+        (passes_[batches_.back().Passes.back()].Level != pass.Level)) {
+      batches_.push_back(Batch());
+      batches_.back().SrcStages = 0;
+      batches_.back().DstStages = 0;
+    }
+    Batch &batch = batches_.back();
+    for (const Access &access : pass.Accesses) {
+      AddBarrier(access, &states[access.Image], &batch);
+    }
+    batch.Passes.push_back(index);
+  }
+
+  // Memory of an image created by the graph was last used by the images
+  // sharing it, earlier in this frame or in the previous one, and by the
+  // image itself in the previous frame; its first barrier waits for them
+  for (uint32_t i = 0; i < images_.size(); ++i) {
+    if (images_[i].Imported || (images_[i].Handle == VK_NULL_HANDLE)) {
+      continue;
+    }
+    VkPipelineStageFlags stages = 0;
+    VkAccessFlags access = 0;
+    for (uint32_t j = 0; j < images_.size(); ++j) {
+      if ((j == i) || SharesMemory(i, j)) {
+        stages |= states[j].WriteStages | states[j].ReadStages;
+        access |= states[j].WriteAccess;
+      }
+    }
+    bool found = false;
+    for (Batch &batch : batches_) {
+      for (Barrier &barrier : batch.Barriers) {
+        if (barrier.Image == i) {
+          barrier.SrcAccess |= access;
+          batch.SrcStages |= stages;
+          found = true;
+          break;
+        }
+      }
+      if (found) {
+        break;
+      }
+    }
+  }
+
+  // Hands imported images over in the state the code after the graph
+  // expects, e.g. ready for presentation
+  Batch final_batch;
+  final_batch.SrcStages = 0;
+  final_batch.DstStages = 0;
+  for (uint32_t i = 0; i < images_.size(); ++i) {
+    if (!images_[i].Imported) {
+      continue;
+    }
+    const ImageState &state = states[i];
+    const RenderGraphImageState &final_state = images_[i].FinalState;
+    VkImageLayout layout = final_state.Layout != VK_IMAGE_LAYOUT_UNDEFINED
+                               ? final_state.Layout
+                               : state.Layout;
+    bool release =
+        (final_state.QueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED) &&
+        (final_state.QueueFamilyIndex != queue_family_index_);
+    if ((layout == state.Layout) && !release && (final_state.Access == 0)) {
+      continue;
+    }
+    Barrier barrier;
+    barrier.Image = i;
+    barrier.OldLayout = state.Layout;
+    barrier.NewLayout = layout;
+    barrier.SrcAccess = state.WriteAccess;
+    barrier.DstAccess = final_state.Access;
+    barrier.SrcQueueFamilyIndex =
+        release ? queue_family_index_ : VK_QUEUE_FAMILY_IGNORED;
+    barrier.DstQueueFamilyIndex =
+        release ? final_state.QueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+    final_batch.Barriers.push_back(barrier);
+    final_batch.SrcStages |= state.WriteStages | state.ReadStages;
+    final_batch.DstStages |= final_state.Stages;
+  }
+  if (!final_batch.Barriers.empty()) {
+    batches_.push_back(final_batch);
+  }
+}
+
+void RenderGraph::AddBarrier(const Access &access, ImageState *state,
+                             Batch *batch) {
+  // Another pass of the batch already moved the image into this layout;
+  // only the destination scope grows
+  for (Barrier &barrier : batch->Barriers) {
+    if (barrier.Image == access.Image) {
+      barrier.DstAccess |= access.AccessMask;
+      batch->DstStages |= access.Stages;
+      state->ReadStages |= access.Stages;
+      state->VisibleStages |= access.Stages;
+      state->VisibleAccess |= access.AccessMask;
+      return;
+    }
+  }
+
+  bool discard = access.Write && !access.Read;
+  bool transition = access.Layout != state->Layout;
+  bool acquire = !discard &&
+                 (state->QueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED) &&
+                 (state->QueueFamilyIndex != queue_family_index_);
+
+  Barrier barrier;
+  barrier.Image = access.Image;
+  barrier.OldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state->Layout;
+  barrier.NewLayout = access.Layout;
+  barrier.SrcAccess = state->WriteAccess;
+  barrier.DstAccess = access.AccessMask;
+  barrier.SrcQueueFamilyIndex =
+      acquire ? state->QueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+  barrier.DstQueueFamilyIndex =
+      acquire ? queue_family_index_ : VK_QUEUE_FAMILY_IGNORED;
+  VkPipelineStageFlags src_stages = 0;
+  bool needed = false;
+
+  if (access.Write || transition) {
+    // Waits for the last write and every read since (write-after-read only
+    // needs the execution dependency, but one barrier covers both)
+    src_stages = state->WriteStages | state->ReadStages;
+    needed = (src_stages != 0) || transition || acquire;
+    state->Layout = access.Layout;
+    state->WriteStages = access.Stages;
+    state->WriteAccess = access.AccessMask & kWriteAccess;
+    if (access.Write) {
+      state->ReadStages = 0;
+      state->VisibleStages = 0;
+      state->VisibleAccess = 0;
+    } else {
+      state->ReadStages = access.Stages;
+      state->VisibleStages = access.Stages;
+      state->VisibleAccess = access.AccessMask;
+    }
+  } else {
+    // Read after read needs nothing; a read after a write only once for
+    // every stage and access type
+    bool visible = ((access.Stages & ~state->VisibleStages) == 0) &&
+                   ((access.AccessMask & ~state->VisibleAccess) == 0);
+    src_stages = state->WriteStages;
+    needed = (!visible && (src_stages != 0)) || acquire;
+    state->ReadStages |= access.Stages;
+    state->VisibleStages |= access.Stages;
+    state->VisibleAccess |= access.AccessMask;
+  }
+  if (needed) {
+    batch->Barriers.push_back(barrier);
+    batch->SrcStages |= src_stages;
+    batch->DstStages |= access.Stages;
+  }
+  state->QueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+}
+
+bool RenderGraph::CreateImages() {
+  memory_stats_ = RenderGraphMemoryStats();
+  for (Image &image : images_) {
+    image.FirstLevel = UINT32_MAX;
+    image.LastLevel = 0;
+    image.TransientAttachment = true;
+  }
+  for (const Pass &pass : passes_) {
+    if (pass.Culled) {
+      continue;
+    }
+    for (const Access &access : pass.Accesses) {
+      Image &image = images_[access.Image];
+      image.FirstLevel = std::min(image.FirstLevel, pass.Level);
+      image.LastLevel = std::max(image.LastLevel, pass.Level);
+      if ((access.Attachment == kNoAttachment) || access.Read ||
+          access.Store) {
+        image.TransientAttachment = false;
+      }
+    }
+  }
+
+  std::vector<uint32_t> aliased_images;
+  for (uint32_t i = 0; i < images_.size(); ++i) {
+    Image &image = images_[i];
+    if (image.Imported || (image.FirstLevel == UINT32_MAX)) {
+      continue;
+    }
+
+    VkImageCreateInfo image_create_info = {};
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.imageType = VK_IMAGE_TYPE_2D;
+    image_create_info.format = image.Format;
+    image_create_info.extent = {image.Extent.width, image.Extent.height, 1};
+    image_create_info.mipLevels = 1;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = image.Usage;
+    if (image.TransientAttachment) {
+      image_create_info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device_, &image_create_info, nullptr, &image.Handle) !=
+        VK_SUCCESS) {
+      std::cout << "Could not create image \"" << image.Name << "\"!"
+                << std::endl;
+      return false;
+    }
+    vkGetImageMemoryRequirements(device_, image.Handle,
+                                 &image.MemoryRequirements);
+    ++memory_stats_.ImageCount;
+
+    // Tile-based GPUs keep such attachments in tile memory, lazily allocated
+    // memory is then never backed by physical pages
+    if (image.TransientAttachment &&
+        HasMemoryType(allocator_->GetMemoryProperties(),
+                      image.MemoryRequirements.memoryTypeBits,
+                      VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+      if (!allocator_->AllocateForImage(
+              image.Handle, VK_IMAGE_TILING_OPTIMAL,
+              VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &image.Memory)) {
+        std::cout << "Could not allocate memory for image \"" << image.Name
+                  << "\"!" << std::endl;
+        return false;
+      }
+      ++memory_stats_.LazyImageCount;
+      continue;
+    }
+    aliased_images.push_back(i);
+  }
+  if (!AllocateAliasedMemory(aliased_images)) {
+    return false;
+  }
+
+  for (Image &image : images_) {
+    if (image.Imported || (image.Handle == VK_NULL_HANDLE)) {
+      continue;
+    }
+    VkImageViewCreateInfo image_view_create_info = {};
+    image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_create_info.image = image.Handle;
+    image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    image_view_create_info.format = image.Format;
+    image_view_create_info.subresourceRange.aspectMask =
+        GetAspectMask(image.Format);
+    image_view_create_info.subresourceRange.levelCount = 1;
+    image_view_create_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device_, &image_view_create_info, nullptr,
+                          &image.View) != VK_SUCCESS) {
+      std::cout << "Could not create view of image \"" << image.Name << "\"!"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RenderGraph::AllocateAliasedMemory(std::vector<uint32_t> images) {
+  // Largest images first, each at the lowest offset of the first allocation
+  // with a compatible memory type where it doesn't overlap images in use
+  // during its lifetime. Allocations grow as needed while being planned
+  std::stable_sort(images.begin(), images.end(), [this](uint32_t a,
+                                                         uint32_t b) {
+    return images_[a].MemoryRequirements.size >
+           images_[b].MemoryRequirements.size;
+  });
+  std::vector<VkMemoryRequirements> requirements;
+  std::vector<std::vector<uint32_t>> placed;
+  for (uint32_t index : images) {
+    Image &image = images_[index];
+    const VkMemoryRequirements &image_requirements = image.MemoryRequirements;
+    memory_stats_.RequiredBytes += image_requirements.size;
+
+    image.AliasedMemory = UINT32_MAX;
+    for (uint32_t i = 0; i < requirements.size(); ++i) {
+      if (requirements[i].memoryTypeBits & image_requirements.memoryTypeBits) {
+        image.AliasedMemory = i;
+        break;
+      }
+    }
+    if (image.AliasedMemory == UINT32_MAX) {
+      image.AliasedMemory = static_cast<uint32_t>(requirements.size());
+      requirements.push_back(image_requirements);
+      requirements.back().size = 0;
+      placed.push_back(std::vector<uint32_t>());
+    }
+    VkMemoryRequirements &memory = requirements[image.AliasedMemory];
+    memory.memoryTypeBits &= image_requirements.memoryTypeBits;
+    memory.alignment = std::max(memory.alignment, image_requirements.alignment);
+
+    // Ranges of the images alive at the same time, by offset
+    std::vector<std::pair<VkDeviceSize, VkDeviceSize>> ranges;
+    for (uint32_t other_index : placed[image.AliasedMemory]) {
+      const Image &other = images_[other_index];
+      if ((other.FirstLevel <= image.LastLevel) &&
+          (image.FirstLevel <= other.LastLevel)) {
+        ranges.push_back(std::make_pair(
+            other.MemoryOffset,
+            other.MemoryOffset + other.MemoryRequirements.size));
+      }
+    }
+    std::sort(ranges.begin(), ranges.end());
+    VkDeviceSize alignment = image_requirements.alignment;
+    VkDeviceSize offset = 0;
+    for (const std::pair<VkDeviceSize, VkDeviceSize> &range : ranges) {
+      if (offset + image_requirements.size <= range.first) {
+        break;
+      }
+      offset = std::max(offset,
+                        (range.second + alignment - 1) / alignment * alignment);
+    }
+    image.MemoryOffset = offset;
+    memory.size = std::max(memory.size, offset + image_requirements.size);
+    placed[image.AliasedMemory].push_back(index);
+  }
+
+  for (uint32_t i = 0; i < requirements.size(); ++i) {
+    GpuAllocation allocation;
+    if (!allocator_->Allocate(requirements[i], false,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                              &allocation)) {
+      std::cout << "Could not allocate memory for render graph images!"
+                << std::endl;
+      return false;
+    }
+    aliased_memory_.push_back(allocation);
+    memory_stats_.AllocatedBytes += requirements[i].size;
+
+    for (uint32_t index : placed[i]) {
+      const Image &image = images_[index];
+      if (vkBindImageMemory(device_, image.Handle, allocation.Memory,
+                            allocation.Offset + image.MemoryOffset) !=
+          VK_SUCCESS) {
+        std::cout << "Could not bind memory to image \"" << image.Name
+                  << "\"!" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool RenderGraph::SharesMemory(uint32_t a, uint32_t b) const {
+  const Image &first = images_[a];
+  const Image &second = images_[b];
+  if ((first.AliasedMemory == UINT32_MAX) ||
+      (first.AliasedMemory != second.AliasedMemory)) {
+    return false;
+  }
+  return (first.MemoryOffset <
+          second.MemoryOffset + second.MemoryRequirements.size) &&
+         (second.MemoryOffset <
+          first.MemoryOffset + first.MemoryRequirements.size);
+}
+
+VkRenderPass RenderGraph::FindOrCreateRenderPass(const Pass &pass) {
+  std::vector<VkAttachmentDescription> attachments;
+  std::vector<VkAttachmentReference> color_references;
+  VkAttachmentReference depth_reference = {};
+  bool has_depth = false;
+  std::string key;
+
+  for (const Access &access : pass.Accesses) {
+    if (access.Attachment == kNoAttachment) {
+      continue;
+    }
+    // Barriers put the attachments into their layout, so the render pass
+    // neither transitions them nor needs external dependencies
+    VkAttachmentDescription attachment = {};
+    attachment.format = images_[access.Image].Format;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = access.LoadOp;
+    attachment.storeOp = access.Store ? VK_ATTACHMENT_STORE_OP_STORE
+                                      : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    if ((access.Attachment == kDepthAttachment) &&
+        (GetAspectMask(attachment.format) & VK_IMAGE_ASPECT_STENCIL_BIT)) {
+      attachment.stencilLoadOp = attachment.loadOp;
+      attachment.stencilStoreOp = attachment.storeOp;
+    }
+    attachment.initialLayout = access.Layout;
+    attachment.finalLayout = access.Layout;
+
+    VkAttachmentReference reference = {};
+    reference.attachment = static_cast<uint32_t>(attachments.size());
+    reference.layout = access.Layout;
+    if (access.Attachment == kColorAttachment) {
+      color_references.push_back(reference);
+    } else {
+      depth_reference = reference;
+      has_depth = true;
+    }
+    attachments.push_back(attachment);
+
+    AppendValue(access.Attachment, &key);
+    AppendValue(attachment.format, &key);
+    AppendValue(attachment.loadOp, &key);
+    AppendValue(attachment.storeOp, &key);
+    AppendValue(attachment.initialLayout, &key);
+  }
+
+  auto render_pass = render_passes_.find(key);
+  if (render_pass != render_passes_.end()) {
+    return render_pass->second;
+  }
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(color_references.size());
+  subpass.pColorAttachments = color_references.data();
+  subpass.pDepthStencilAttachment = has_depth ? &depth_reference : nullptr;
+
+  VkRenderPassCreateInfo render_pass_create_info = {};
+  render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_create_info.attachmentCount =
+      static_cast<uint32_t>(attachments.size());
+  render_pass_create_info.pAttachments = attachments.data();
+  render_pass_create_info.subpassCount = 1;
+  render_pass_create_info.pSubpasses = &subpass;
+
+  VkRenderPass handle = VK_NULL_HANDLE;
+  if (vkCreateRenderPass(device_, &render_pass_create_info, nullptr,
+                         &handle) != VK_SUCCESS) {
+    std::cout << "Could not create render pass for pass \"" << pass.Name
+              << "\"!" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  render_passes_[key] = handle;
+  return handle;
+}
+
+VkFramebuffer RenderGraph::FindOrCreateFramebuffer(const Pass &pass,
+                                                   VkExtent2D *extent) {
+  std::vector<VkImageView> views;
+  std::string key;
+  AppendValue(pass.RenderPass, &key);
+  for (const Access &access : pass.Accesses) {
+    if (access.Attachment == kNoAttachment) {
+      continue;
+    }
+    const Image &image = images_[access.Image];
+    if (views.empty()) {
+      *extent = image.Extent;
+    }
+    views.push_back(image.View);
+    AppendValue(image.View, &key);
+  }
+
+  auto framebuffer = framebuffers_.find(key);
+  if (framebuffer != framebuffers_.end()) {
+    return framebuffer->second;
+  }
+
+  VkFramebufferCreateInfo framebuffer_create_info = {};
+  framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_create_info.renderPass = pass.RenderPass;
+  framebuffer_create_info.attachmentCount = static_cast<uint32_t>(views.size());
+  framebuffer_create_info.pAttachments = views.data();
+  framebuffer_create_info.width = extent->width;
+  framebuffer_create_info.height = extent->height;
+  framebuffer_create_info.layers = 1;
+
+  VkFramebuffer handle = VK_NULL_HANDLE;
+  if (vkCreateFramebuffer(device_, &framebuffer_create_info, nullptr,
+                          &handle) != VK_SUCCESS) {
+    std::cout << "Could not create a framebuffer for pass \"" << pass.Name
+              << "\"!" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  framebuffers_[key] = handle;
+  return handle;
+}
+
+void RenderGraph::ReleaseFrameObjects() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  // Frames in flight may still use the graph's images and framebuffers
+  std::vector<Image> images;
+  for (Image &image : images_) {
+    if (!image.Imported && (image.Handle != VK_NULL_HANDLE)) {
+      images.push_back(image);
+      image.Handle = VK_NULL_HANDLE;
+      image.View = VK_NULL_HANDLE;
+      image.Memory = GpuAllocation();
+      image.AliasedMemory = UINT32_MAX;
+    }
+  }
+  std::vector<VkFramebuffer> framebuffers;
+  for (auto &framebuffer : framebuffers_) {
+    framebuffers.push_back(framebuffer.second);
+  }
+  framebuffers_.clear();
+  std::vector<GpuAllocation> aliased_memory;
+  aliased_memory.swap(aliased_memory_);
+  if (images.empty() && framebuffers.empty() && aliased_memory.empty()) {
+    return;
+  }
+
+  VkDevice device = device_;
+  GpuAllocator *allocator = allocator_;
+  timeline_->DeferRelease([device, allocator, images, framebuffers,
+                           aliased_memory]() mutable {
+    for (VkFramebuffer framebuffer : framebuffers) {
+      vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    for (Image &image : images) {
+      if (image.View != VK_NULL_HANDLE) {
+        vkDestroyImageView(device, image.View, nullptr);
+      }
+      vkDestroyImage(device, image.Handle, nullptr);
+      allocator->Free(image.Memory);
+    }
+    for (GpuAllocation &allocation : aliased_memory) {
+      allocator->Free(allocation);
+    }
+  });
+}
+
+VkRenderPass RenderGraph::GetRenderPass(uint32_t pass) const {
+  return pass < passes_.size() ? passes_[pass].RenderPass : VK_NULL_HANDLE;
+}
+
+bool RenderGraph::IsPassCulled(uint32_t pass) const {
+  return pass < passes_.size() ? passes_[pass].Culled : true;
+}
+
+RenderGraphMemoryStats RenderGraph::GetMemoryStats() const {
+  return memory_stats_;
+}
+
+uint32_t RenderGraph::GetBarrierBatchCount() const {
+  uint32_t count = 0;
+  for (const Batch &batch : batches_) {
+    if (!batch.Barriers.empty()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void RenderGraph::SetImage(uint32_t image, VkImage handle, VkImageView view) {
+  if ((image >= images_.size()) || !images_[image].Imported) {
+    std::cout << "Could not set image, it isn't imported!" << std::endl;
+    return;
+  }
+  images_[image].Handle = handle;
+  images_[image].View = view;
+}
+
+bool RenderGraph::Execute(VkCommandBuffer command_buffer) {
+  std::vector<VkImageMemoryBarrier> image_barriers;
+  std::vector<VkClearValue> clear_values;
+
+  for (const Batch &batch : batches_) {
+    if (!batch.Barriers.empty()) {
+      image_barriers.clear();
+      for (const Barrier &barrier : batch.Barriers) {
+        const Image &image = images_[barrier.Image];
+        if (image.Handle == VK_NULL_HANDLE) {
+          std::cout << "Could not execute render graph, image \"" << image.Name
+                    << "\" has no handle!" << std::endl;
+          return false;
+        }
+        VkImageMemoryBarrier image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.srcAccessMask = barrier.SrcAccess;
+        image_barrier.dstAccessMask = barrier.DstAccess;
+        image_barrier.oldLayout = barrier.OldLayout;
+        image_barrier.newLayout = barrier.NewLayout;
+        image_barrier.srcQueueFamilyIndex = barrier.SrcQueueFamilyIndex;
+        image_barrier.dstQueueFamilyIndex = barrier.DstQueueFamilyIndex;
+        image_barrier.image = image.Handle;
+        image_barrier.subresourceRange.aspectMask =
+            GetAspectMask(image.Format);
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.layerCount = 1;
+        image_barriers.push_back(image_barrier);
+      }
+      // Stages are empty when there is nothing to wait for, e.g. for images
+      // the graph just created
+      vkCmdPipelineBarrier(
+          command_buffer,
+          batch.SrcStages != 0 ? batch.SrcStages
+                               : static_cast<VkPipelineStageFlags>(
+                                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+          batch.DstStages != 0 ? batch.DstStages
+                               : static_cast<VkPipelineStageFlags>(
+                                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT),
+          0, 0, nullptr, 0, nullptr,
+          static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+    }
+
+    for (uint32_t index : batch.Passes) {
+      const Pass &pass = passes_[index];
+      if (pass.RenderPass == VK_NULL_HANDLE) {
+        pass.Record(command_buffer);
+        continue;
+      }
+
+      VkExtent2D extent = {};
+      VkFramebuffer framebuffer = FindOrCreateFramebuffer(pass, &extent);
+      if (framebuffer == VK_NULL_HANDLE) {
+        return false;
+      }
+      clear_values.clear();
+      for (const Access &access : pass.Accesses) {
+        if (access.Attachment != kNoAttachment) {
+          clear_values.push_back(access.ClearValue);
+        }
+      }
+
+      VkRenderPassBeginInfo render_pass_begin_info = {};
+      render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      render_pass_begin_info.renderPass = pass.RenderPass;
+      render_pass_begin_info.framebuffer = framebuffer;
+      render_pass_begin_info.renderArea = {{0, 0}, extent};
+      render_pass_begin_info.clearValueCount =
+          static_cast<uint32_t>(clear_values.size());
+      render_pass_begin_info.pClearValues = clear_values.data();
+      vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
+                           VK_SUBPASS_CONTENTS_INLINE);
+      pass.Record(command_buffer);
+      vkCmdEndRenderPass(command_buffer);
+    }
+  }
+  return true;
+}
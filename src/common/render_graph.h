@@ -0,0 +1,237 @@
+#ifndef RENDER_GRAPH_H_
+#define RENDER_GRAPH_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gpu_allocator.h"
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// RenderGraphImageState                                        //
+//                                                              //
+// Layout of an image and the scope of the commands accessing   //
+// it outside of the graph                                      //
+// ************************************************************ //
+struct RenderGraphImageState {
+  VkImageLayout Layout;
+  VkPipelineStageFlags Stages;
+  VkAccessFlags Access;
+  // Queue family owning the image there; VK_QUEUE_FAMILY_IGNORED for the
+  // graph's own queue
+  uint32_t QueueFamilyIndex;
+
+  RenderGraphImageState()
+      : Layout(VK_IMAGE_LAYOUT_UNDEFINED),
+        Stages(0),
+        Access(0),
+        QueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED) {}
+};
+
+// ************************************************************ //
+// RenderGraphMemoryStats                                       //
+//                                                              //
+// Memory of the images created by the last Compile()           //
+// ************************************************************ //
+struct RenderGraphMemoryStats {
+  uint32_t ImageCount;
+  // Backed by LAZILY_ALLOCATED memory, which tile-based GPUs may never
+  // commit; not aliased and not part of AllocatedBytes
+  uint32_t LazyImageCount;
+  // What the other images would take with memory of their own
+  VkDeviceSize RequiredBytes;
+  // What they take sharing memory across their lifetimes
+  VkDeviceSize AllocatedBytes;
+
+  RenderGraphMemoryStats()
+      : ImageCount(0),
+        LazyImageCount(0),
+        RequiredBytes(0),
+        AllocatedBytes(0) {}
+};
+
+// ************************************************************ //
+// RenderGraph                                                  //
+//                                                              //
+// Frame described as passes declaring the images they read and //
+// write; compiling it culls passes whose results are never     //
+// used, orders the rest by dependency level and derives render //
+// passes and batched barriers from the declared accesses.      //
+// Images created by the graph alias memory when their          //
+// lifetimes don't overlap. Not thread safe                     //
+// ************************************************************ //
+class RenderGraph {
+ public:
+  // Records the commands of a pass; passes with attachments are called
+  // inside their render pass
+  typedef std::function<void(VkCommandBuffer command_buffer)> RecordFunction;
+
+  RenderGraph();
+  ~RenderGraph();
+  // Images created by the graph come from allocator; objects still used by
+  // the GPU are released through timeline
+  bool Create(VkDevice device, GpuAllocator *allocator,
+              TimelineScheduler *timeline, uint32_t queue_family_index);
+  void Destroy();
+  // Drops passes, images and framebuffers so the frame can be described
+  // again, e.g. after the swap chain changed. Render passes are kept, so
+  // pipelines created for them stay valid
+  void Reset();
+
+  // Image owned by someone else, e.g. a swap chain image; its handle is set
+  // with SetImage() before Execute(). Its contents are a result of the
+  // frame, so passes writing it are never culled
+  uint32_t ImportImage(const std::string &name, VkFormat format,
+                       VkExtent2D extent,
+                       const RenderGraphImageState &initial_state,
+                       const RenderGraphImageState &final_state);
+  // Image created by Compile() with the usage its accesses need; contents
+  // don't survive the frame, so the memory is shared with images used
+  // before or after it. Attachments never loaded or stored only live inside
+  // their render pass and get lazily allocated memory where available
+  uint32_t CreateImage(const std::string &name, VkFormat format,
+                       VkExtent2D extent);
+  uint32_t AddPass(const std::string &name, RecordFunction record);
+  // LOAD keeps the previous contents, so the pass reads the image as well
+  void AddColorOutput(uint32_t pass, uint32_t image,
+                      VkAttachmentLoadOp load_op,
+                      VkClearColorValue clear_color = VkClearColorValue());
+  void AddDepthOutput(uint32_t pass, uint32_t image,
+                      VkAttachmentLoadOp load_op,
+                      VkClearDepthStencilValue clear_value =
+                          VkClearDepthStencilValue());
+  // Sampled in the shaders of stages
+  void AddTextureInput(uint32_t pass, uint32_t image,
+                       VkPipelineStageFlags stages);
+  // Any other access, e.g. storage images or transfers; writes are told
+  // apart by the access flags
+  void AddImageAccess(uint32_t pass, uint32_t image, VkImageLayout layout,
+                      VkPipelineStageFlags stages, VkAccessFlags access);
+  bool Compile();
+  // Render pass of a pass with attachments, for pipeline creation; valid
+  // after Compile() until Destroy()
+  VkRenderPass GetRenderPass(uint32_t pass) const;
+  bool IsPassCulled(uint32_t pass) const;
+  // Number of vkCmdPipelineBarrier() calls Execute() records
+  uint32_t GetBarrierBatchCount() const;
+  RenderGraphMemoryStats GetMemoryStats() const;
+  void SetImage(uint32_t image, VkImage handle, VkImageView view);
+  // Records the compiled passes together with their barriers
+  bool Execute(VkCommandBuffer command_buffer);
+
+ private:
+  enum AttachmentType { kNoAttachment, kColorAttachment, kDepthAttachment };
+
+  struct Image {
+    std::string Name;
+    VkFormat Format;
+    VkExtent2D Extent;
+    bool Imported;
+    RenderGraphImageState InitialState;
+    RenderGraphImageState FinalState;
+    // Accumulated from the accesses of images created by the graph
+    VkImageUsageFlags Usage;
+    VkImage Handle;
+    VkImageView View;
+    // Levels of the first and last pass using the image
+    uint32_t FirstLevel;
+    uint32_t LastLevel;
+    // Only accessed as an attachment that is neither loaded nor stored
+    bool TransientAttachment;
+    VkMemoryRequirements MemoryRequirements;
+    // Own memory of lazily allocated images
+    GpuAllocation Memory;
+    // Range of aliased_memory_[AliasedMemory] the image is bound to;
+    // UINT32_MAX when it has memory of its own
+    uint32_t AliasedMemory;
+    VkDeviceSize MemoryOffset;
+  };
+  struct Access {
+    uint32_t Image;
+    VkImageLayout Layout;
+    VkPipelineStageFlags Stages;
+    VkAccessFlags AccessMask;
+    bool Read;
+    bool Write;
+    AttachmentType Attachment;
+    VkAttachmentLoadOp LoadOp;
+    // Contents are used after the pass; decided by Compile()
+    bool Store;
+    VkClearValue ClearValue;
+  };
+  struct Pass {
+    std::string Name;
+    RecordFunction Record;
+    std::vector<Access> Accesses;
+    bool Culled;
+    uint32_t Level;
+    VkRenderPass RenderPass;
+  };
+  struct Barrier {
+    uint32_t Image;
+    VkImageLayout OldLayout;
+    VkImageLayout NewLayout;
+    VkAccessFlags SrcAccess;
+    VkAccessFlags DstAccess;
+    uint32_t SrcQueueFamilyIndex;
+    uint32_t DstQueueFamilyIndex;
+  };
+  // Barriers recorded in one call ahead of a group of independent passes
+  struct Batch {
+    VkPipelineStageFlags SrcStages;
+    VkPipelineStageFlags DstStages;
+    std::vector<Barrier> Barriers;
+    std::vector<uint32_t> Passes;
+  };
+  // Synchronization state of an image while barriers are generated
+  struct ImageState {
+    VkImageLayout Layout;
+    // Last write, or the last barrier's destination for a layout change
+    VkPipelineStageFlags WriteStages;
+    VkAccessFlags WriteAccess;
+    // Reads since the last write, ordered before the next write
+    VkPipelineStageFlags ReadStages;
+    // Scope the last write was already made visible to
+    VkPipelineStageFlags VisibleStages;
+    VkAccessFlags VisibleAccess;
+    uint32_t QueueFamilyIndex;
+  };
+
+  RenderGraph(const RenderGraph &);
+  RenderGraph &operator=(const RenderGraph &);
+  uint32_t AddImage(const std::string &name, VkFormat format,
+                    VkExtent2D extent, bool imported);
+  void AddAccess(uint32_t pass, const Access &access);
+  void CullPasses();
+  std::vector<uint32_t> SortPasses();
+  void CreateBatches(const std::vector<uint32_t> &order);
+  void AddBarrier(const Access &access, ImageState *state, Batch *batch);
+  bool CreateImages();
+  bool AllocateAliasedMemory(std::vector<uint32_t> images);
+  bool SharesMemory(uint32_t a, uint32_t b) const;
+  VkRenderPass FindOrCreateRenderPass(const Pass &pass);
+  VkFramebuffer FindOrCreateFramebuffer(const Pass &pass,
+                                        VkExtent2D *extent);
+  void ReleaseFrameObjects();
+  VkDevice device_;
+  GpuAllocator *allocator_;
+  TimelineScheduler *timeline_;
+  uint32_t queue_family_index_;
+  std::vector<Image> images_;
+  std::vector<Pass> passes_;
+  std::vector<Batch> batches_;
+  // Allocations shared by images with disjoint lifetimes
+  std::vector<GpuAllocation> aliased_memory_;
+  RenderGraphMemoryStats memory_stats_;
+  // Keyed by attachment formats, operations and layouts
+  std::unordered_map<std::string, VkRenderPass> render_passes_;
+  // Keyed by render pass and attachment views
+  std::unordered_map<std::string, VkFramebuffer> framebuffers_;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "shader_library.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "shader_registry.h"
+#include "tools.h"
+
+ShaderLibrary::ShaderLibrary()
+    : device_(VK_NULL_HANDLE), hashes_by_name_(), modules_by_hash_() {}
+
+ShaderLibrary::~ShaderLibrary() { Destroy(); }
+
+bool ShaderLibrary::Create(VkDevice device) {
+  device_ = device;
+  return true;
+}
+
+void ShaderLibrary::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  for (auto &module : modules_by_hash_) {
+    vkDestroyShaderModule(device_, module.second.Handle, nullptr);
+  }
+  modules_by_hash_.clear();
+  hashes_by_name_.clear();
+  device_ = VK_NULL_HANDLE;
+}
+
+VkShaderModule ShaderLibrary::GetModule(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Module *module = FindOrCreateModule(name);
+  return module != nullptr ? module->Handle : VK_NULL_HANDLE;
+}
+
+const ShaderReflection *ShaderLibrary::GetReflection(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Module *module = FindOrCreateModule(name);
+  return module != nullptr ? &module->Reflection : nullptr;
+}
+
+bool ShaderLibrary::Reload(const std::string &name,
+                           std::vector<uint32_t> code) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Module module;
+  module.Handle = VK_NULL_HANDLE;
+  module.Storage = std::move(code);
+  module.Code = module.Storage.data();
+  module.CodeSize = module.Storage.size() * sizeof(uint32_t);
+  uint64_t code_hash = HashCode(module.Code, module.CodeSize);
+
+  auto existing = modules_by_hash_.find(code_hash);
+  if (existing != modules_by_hash_.end()) {
+    if ((existing->second.CodeSize != module.CodeSize) ||
+        (memcmp(existing->second.Code, module.Code, module.CodeSize) != 0)) {
+      std::cout << "SPIR-V hash collision for shader \"" << name << "\"!"
+                << std::endl;
+      return false;
+    }
+  } else {
+    if (!CreateModule(name, &module)) {
+      return false;
+    }
+    modules_by_hash_[code_hash] = std::move(module);
+  }
+  hashes_by_name_[name] = code_hash;
+  return true;
+}
+
+uint64_t ShaderLibrary::GetHash(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto hash = hashes_by_name_.find(name);
+  return hash != hashes_by_name_.end() ? hash->second : 0;
+}
+
+uint64_t ShaderLibrary::HashCode(const uint32_t *code, size_t code_size) {
+  // FNV-1a style mixing one SPIR-V word at a time followed by a final
+  // avalanche, SPIR-V is always a whole number of words
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < code_size / sizeof(uint32_t); ++i) {
+    hash = (hash ^ code[i]) * 0x100000001b3ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+ShaderLibrary::Module *ShaderLibrary::FindOrCreateModule(
+    const std::string &name) {
+  auto hash = hashes_by_name_.find(name);
+  if (hash != hashes_by_name_.end()) {
+    return &modules_by_hash_[hash->second];
+  }
+
+  Module module;
+  if (!LoadCode(name, &module)) {
+    return nullptr;
+  }
+  uint64_t code_hash = HashCode(module.Code, module.CodeSize);
+
+  // Same code under another name; sizes are compared as a cheap guard
+  // against hash collisions
+  auto existing = modules_by_hash_.find(code_hash);
+  if (existing != modules_by_hash_.end()) {
+    if ((existing->second.CodeSize == module.CodeSize) &&
+        (memcmp(existing->second.Code, module.Code, module.CodeSize) == 0)) {
+      hashes_by_name_[name] = code_hash;
+      return &existing->second;
+    }
+    std::cout << "SPIR-V hash collision for shader \"" << name << "\"!"
+              << std::endl;
+    return nullptr;
+  }
+
+  if (!CreateModule(name, &module)) {
+    return nullptr;
+  }
+  hashes_by_name_[name] = code_hash;
+  Module &stored = modules_by_hash_[code_hash];
+  stored = std::move(module);
+  return &stored;
+}
+
+bool ShaderLibrary::CreateModule(const std::string &name, Module *module) {
+  if (!module->Reflection.Parse(module->Code, module->CodeSize)) {
+    std::cout << "Could not reflect shader \"" << name << "\"!" << std::endl;
+    return false;
+  }
+
+  VkShaderModuleCreateInfo shader_module_create_info = {};
+  shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shader_module_create_info.codeSize = module->CodeSize;
+  shader_module_create_info.pCode = module->Code;
+
+  if (vkCreateShaderModule(device_, &shader_module_create_info, nullptr,
+                           &module->Handle) != VK_SUCCESS) {
+    std::cout << "Could not create shader module \"" << name << "\"!"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ShaderLibrary::LoadCode(const std::string &name, Module *module) {
+  module->Handle = VK_NULL_HANDLE;
+
+  // Embedded SPIR-V is used in place, files are only read as a fallback
+  const EmbeddedShader *embedded_shader = ShaderRegistry::Get().Find(name);
+  if (embedded_shader != nullptr) {
+    module->Code = embedded_shader->Code;
+    module->CodeSize = embedded_shader->CodeSize;
+    return true;
+  }
+
+  std::vector<char> file_code =
+      Tools::GetBinaryFileContents("data/" + name + ".spv");
+  if ((file_code.size() == 0) || (file_code.size() % sizeof(uint32_t) != 0)) {
+    std::cout << "Could not load shader \"" << name << "\"!" << std::endl;
+    return false;
+  }
+  module->Storage.resize(file_code.size() / sizeof(uint32_t));
+  memcpy(module->Storage.data(), file_code.data(), file_code.size());
+  module->Code = module->Storage.data();
+  module->CodeSize = file_code.size();
+  return true;
+}
@@ -0,0 +1,64 @@
+#ifndef SHADER_LIBRARY_H_
+#define SHADER_LIBRARY_H_
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shader_reflection.h"
+
+// ************************************************************ //
+// ShaderLibrary                                                //
+//                                                              //
+// Creates every shader module once and keeps it for the        //
+// device's lifetime; modules are looked up by name and shared  //
+// by hash of their SPIR-V, so names with identical code get    //
+// the same module                                              //
+// ************************************************************ //
+class ShaderLibrary {
+ public:
+  ShaderLibrary();
+  ~ShaderLibrary();
+  bool Create(VkDevice device);
+  // Destroys all modules; pipelines created from them stay valid
+  void Destroy();
+  // Embedded SPIR-V registered as name or "data/<name>.spv"; returns
+  // VK_NULL_HANDLE if the shader can't be loaded
+  VkShaderModule GetModule(const std::string &name);
+  // Interface of the shader, parsed once when its module is created; nullptr
+  // if the shader can't be loaded
+  const ShaderReflection *GetReflection(const std::string &name);
+  // Points name at new SPIR-V, e.g. recompiled by ShaderWatcher; modules
+  // previously returned for name stay valid until Destroy() since pipelines
+  // may still be built from them on other threads
+  bool Reload(const std::string &name, std::vector<uint32_t> code);
+  // 64-bit hash of the SPIR-V behind name or 0 if it isn't loaded
+  uint64_t GetHash(const std::string &name);
+  static uint64_t HashCode(const uint32_t *code, size_t code_size);
+
+ private:
+  struct Module {
+    VkShaderModule Handle;
+    const uint32_t *Code;
+    size_t CodeSize;
+    // Owns the code of shaders loaded from files or reloaded
+    std::vector<uint32_t> Storage;
+    ShaderReflection Reflection;
+  };
+
+  ShaderLibrary(const ShaderLibrary &);
+  ShaderLibrary &operator=(const ShaderLibrary &);
+  // Callers hold mutex_
+  Module *FindOrCreateModule(const std::string &name);
+  bool CreateModule(const std::string &name, Module *module);
+  bool LoadCode(const std::string &name, Module *module);
+  VkDevice device_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, uint64_t> hashes_by_name_;
+  std::unordered_map<uint64_t, Module> modules_by_hash_;
+};
+
+#endif
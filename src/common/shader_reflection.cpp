@@ -0,0 +1,520 @@
+#include "shader_reflection.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// Subset of the SPIR-V specification needed to reflect the shader interface
+const uint32_t kSpirvMagic = 0x07230203;
+const uint32_t kSpirvHeaderWords = 5;
+
+enum SpirvOp : uint32_t {
+  kOpEntryPoint = 15,
+  kOpTypeBool = 20,
+  kOpTypeInt = 21,
+  kOpTypeFloat = 22,
+  kOpTypeVector = 23,
+  kOpTypeMatrix = 24,
+  kOpTypeImage = 25,
+  kOpTypeSampler = 26,
+  kOpTypeSampledImage = 27,
+  kOpTypeArray = 28,
+  kOpTypeRuntimeArray = 29,
+  kOpTypeStruct = 30,
+  kOpTypePointer = 32,
+  kOpConstant = 43,
+  kOpSpecConstantTrue = 48,
+  kOpSpecConstantFalse = 49,
+  kOpSpecConstant = 50,
+  kOpVariable = 59,
+  kOpDecorate = 71,
+  kOpMemberDecorate = 72
+};
+
+enum SpirvDecoration : uint32_t {
+  kDecorationSpecId = 1,
+  kDecorationBlock = 2,
+  kDecorationBufferBlock = 3,
+  kDecorationArrayStride = 6,
+  kDecorationMatrixStride = 7,
+  kDecorationBuiltIn = 11,
+  kDecorationLocation = 30,
+  kDecorationBinding = 33,
+  kDecorationDescriptorSet = 34,
+  kDecorationOffset = 35
+};
+
+enum SpirvStorageClass : uint32_t {
+  kStorageClassUniformConstant = 0,
+  kStorageClassInput = 1,
+  kStorageClassUniform = 2,
+  kStorageClassPushConstant = 9,
+  kStorageClassStorageBuffer = 12
+};
+
+const uint32_t kDimBuffer = 5;
+const uint32_t kDimSubpassData = 6;
+
+// ************************************************************ //
+// SpirvId                                                      //
+//                                                              //
+// Instruction defining an id together with its decorations     //
+// ************************************************************ //
+struct SpirvId {
+  uint32_t Opcode;
+  // Operands following the result id
+  const uint32_t *Operands;
+  uint32_t OperandCount;
+  // Result type of constants and variables
+  uint32_t Type;
+  bool HasLocation;
+  uint32_t Location;
+  bool HasSpecId;
+  uint32_t SpecId;
+  uint32_t Set;
+  uint32_t Binding;
+  bool BuiltIn;
+  bool Block;
+  bool BufferBlock;
+  uint32_t ArrayStride;
+  std::vector<uint32_t> MemberOffsets;
+  std::vector<uint32_t> MemberMatrixStrides;
+
+  SpirvId()
+      : Opcode(0),
+        Operands(nullptr),
+        OperandCount(0),
+        Type(0),
+        HasLocation(false),
+        Location(0),
+        HasSpecId(false),
+        SpecId(0),
+        Set(0),
+        Binding(0),
+        BuiltIn(false),
+        Block(false),
+        BufferBlock(false),
+        ArrayStride(0),
+        MemberOffsets(),
+        MemberMatrixStrides() {}
+};
+
+void SetMemberDecoration(std::vector<uint32_t> &values, uint32_t member,
+                         uint32_t value) {
+  if (values.size() <= member) {
+    values.resize(member + 1, 0);
+  }
+  values[member] = value;
+}
+
+uint32_t GetMemberDecoration(const std::vector<uint32_t> &values,
+                             uint32_t member) {
+  return member < values.size() ? values[member] : 0;
+}
+
+uint32_t GetArrayLength(const std::vector<SpirvId> &ids, uint32_t length_id) {
+  const SpirvId &length = ids[length_id];
+  if ((length.Opcode != kOpConstant) || (length.OperandCount == 0)) {
+    return 1;
+  }
+  return length.Operands[0];
+}
+
+// Size in bytes as laid out by explicit offset and stride decorations, which
+// is what push constant blocks use
+uint32_t GetTypeSize(const std::vector<SpirvId> &ids, uint32_t type_id,
+                     uint32_t matrix_stride) {
+  const SpirvId &type = ids[type_id];
+  switch (type.Opcode) {
+    case kOpTypeBool:
+      return 4;
+    case kOpTypeInt:
+    case kOpTypeFloat:
+      return type.Operands[0] / 8;
+    case kOpTypeVector:
+      return type.Operands[1] * GetTypeSize(ids, type.Operands[0], 0);
+    case kOpTypeMatrix:
+      if (matrix_stride == 0) {
+        matrix_stride = GetTypeSize(ids, type.Operands[0], 0);
+      }
+      return type.Operands[1] * matrix_stride;
+    case kOpTypeArray: {
+      uint32_t stride = type.ArrayStride;
+      if (stride == 0) {
+        stride = GetTypeSize(ids, type.Operands[0], matrix_stride);
+      }
+      return GetArrayLength(ids, type.Operands[1]) * stride;
+    }
+    case kOpTypeStruct: {
+      uint32_t size = 0;
+      for (uint32_t i = 0; i < type.OperandCount; ++i) {
+        uint32_t end =
+            GetMemberDecoration(type.MemberOffsets, i) +
+            GetTypeSize(ids, type.Operands[i],
+                        GetMemberDecoration(type.MemberMatrixStrides, i));
+        size = std::max(size, end);
+      }
+      return size;
+    }
+    default:
+      return 0;
+  }
+}
+
+VkFormat GetVertexInputFormat(const std::vector<SpirvId> &ids,
+                              uint32_t type_id, uint32_t *size) {
+  static const VkFormat float_formats[] = {
+      VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+      VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+  static const VkFormat sint_formats[] = {
+      VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT,
+      VK_FORMAT_R32G32B32A32_SINT};
+  static const VkFormat uint_formats[] = {
+      VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+      VK_FORMAT_R32G32B32A32_UINT};
+
+  const SpirvId *type = &ids[type_id];
+  uint32_t component_count = 1;
+  if (type->Opcode == kOpTypeVector) {
+    component_count = type->Operands[1];
+    type = &ids[type->Operands[0]];
+  }
+  // Only 32-bit components are supported, wider types and matrices span
+  // several locations
+  if ((component_count < 1) || (component_count > 4) ||
+      ((type->Opcode != kOpTypeFloat) && (type->Opcode != kOpTypeInt)) ||
+      (type->Operands[0] != 32)) {
+    return VK_FORMAT_UNDEFINED;
+  }
+  *size = component_count * 4;
+  if (type->Opcode == kOpTypeFloat) {
+    return float_formats[component_count - 1];
+  }
+  return type->Operands[1] != 0 ? sint_formats[component_count - 1]
+                                : uint_formats[component_count - 1];
+}
+
+bool GetDescriptorType(const std::vector<SpirvId> &ids,
+                       uint32_t storage_class, uint32_t type_id,
+                       VkDescriptorType *descriptor_type, uint32_t *count) {
+  *count = 1;
+  const SpirvId *type = &ids[type_id];
+  while ((type->Opcode == kOpTypeArray) ||
+         (type->Opcode == kOpTypeRuntimeArray)) {
+    if (type->Opcode == kOpTypeArray) {
+      *count *= GetArrayLength(ids, type->Operands[1]);
+    }
+    type = &ids[type->Operands[0]];
+  }
+
+  switch (storage_class) {
+    case kStorageClassUniform:
+      *descriptor_type = type->BufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                                           : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      return true;
+    case kStorageClassStorageBuffer:
+      *descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      return true;
+    case kStorageClassUniformConstant:
+      break;
+    default:
+      return false;
+  }
+
+  switch (type->Opcode) {
+    case kOpTypeSampler:
+      *descriptor_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+      return true;
+    case kOpTypeSampledImage:
+      *descriptor_type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      return true;
+    case kOpTypeImage: {
+      // Operands: sampled type, dim, depth, arrayed, ms, sampled, format
+      uint32_t dim = type->Operands[1];
+      bool storage = type->Operands[5] == 2;
+      if (dim == kDimSubpassData) {
+        *descriptor_type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      } else if (dim == kDimBuffer) {
+        *descriptor_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                   : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+      } else {
+        *descriptor_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                   : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+VkShaderStageFlagBits GetShaderStage(uint32_t execution_model) {
+  switch (execution_model) {
+    case 0:
+      return VK_SHADER_STAGE_VERTEX_BIT;
+    case 1:
+      return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case 2:
+      return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case 3:
+      return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case 4:
+      return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case 5:
+      return VK_SHADER_STAGE_COMPUTE_BIT;
+    default:
+      return VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
+  }
+}
+
+}  // namespace
+
+ShaderReflection::ShaderReflection()
+    : stage_(VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM),
+      vertex_inputs_(),
+      bindings_(),
+      push_constant_size_(0),
+      specialization_constants_() {}
+
+bool ShaderReflection::Parse(const uint32_t *code, size_t code_size) {
+  stage_ = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
+  vertex_inputs_.clear();
+  bindings_.clear();
+  push_constant_size_ = 0;
+  specialization_constants_.clear();
+
+  size_t word_count = code_size / sizeof(uint32_t);
+  if ((word_count < kSpirvHeaderWords) || (code[0] != kSpirvMagic)) {
+    std::cout << "Could not reflect shader, code is not SPIR-V!"
+              << std::endl;
+    return false;
+  }
+  // Header word 3 is the bound all ids are below
+  std::vector<SpirvId> ids(code[3]);
+  std::vector<uint32_t> variables;
+  std::vector<uint32_t> spec_constants;
+
+  // Single pass over the instructions collecting every id we may need;
+  // types can only be resolved once decorations have been seen
+  size_t offset = kSpirvHeaderWords;
+  while (offset < word_count) {
+    uint32_t opcode = code[offset] & 0xffff;
+    uint32_t instruction_words = code[offset] >> 16;
+    if ((instruction_words == 0) || (offset + instruction_words > word_count)) {
+      std::cout << "Could not reflect shader, SPIR-V is malformed!"
+                << std::endl;
+      return false;
+    }
+    const uint32_t *instruction = code + offset;
+    offset += instruction_words;
+
+    switch (opcode) {
+      case kOpEntryPoint:
+        if (stage_ == VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM) {
+          stage_ = GetShaderStage(instruction[1]);
+        }
+        break;
+      case kOpTypeBool:
+      case kOpTypeInt:
+      case kOpTypeFloat:
+      case kOpTypeVector:
+      case kOpTypeMatrix:
+      case kOpTypeImage:
+      case kOpTypeSampler:
+      case kOpTypeSampledImage:
+      case kOpTypeArray:
+      case kOpTypeRuntimeArray:
+      case kOpTypeStruct:
+      case kOpTypePointer:
+        if (instruction[1] < ids.size()) {
+          ids[instruction[1]].Opcode = opcode;
+          ids[instruction[1]].Operands = instruction + 2;
+          ids[instruction[1]].OperandCount = instruction_words - 2;
+        }
+        break;
+      case kOpConstant:
+      case kOpSpecConstantTrue:
+      case kOpSpecConstantFalse:
+      case kOpSpecConstant:
+      case kOpVariable:
+        if (instruction[2] < ids.size()) {
+          ids[instruction[2]].Opcode = opcode;
+          ids[instruction[2]].Type = instruction[1];
+          ids[instruction[2]].Operands = instruction + 3;
+          ids[instruction[2]].OperandCount = instruction_words - 3;
+          if (opcode == kOpVariable) {
+            variables.push_back(instruction[2]);
+          } else if (opcode != kOpConstant) {
+            spec_constants.push_back(instruction[2]);
+          }
+        }
+        break;
+      case kOpDecorate: {
+        if ((instruction[1] >= ids.size()) || (instruction_words < 3)) {
+          break;
+        }
+        SpirvId &id = ids[instruction[1]];
+        uint32_t value = instruction_words > 3 ? instruction[3] : 0;
+        switch (instruction[2]) {
+          case kDecorationSpecId:
+            id.HasSpecId = true;
+            id.SpecId = value;
+            break;
+          case kDecorationBlock:
+            id.Block = true;
+            break;
+          case kDecorationBufferBlock:
+            id.BufferBlock = true;
+            break;
+          case kDecorationArrayStride:
+            id.ArrayStride = value;
+            break;
+          case kDecorationBuiltIn:
+            id.BuiltIn = true;
+            break;
+          case kDecorationLocation:
+            id.HasLocation = true;
+            id.Location = value;
+            break;
+          case kDecorationBinding:
+            id.Binding = value;
+            break;
+          case kDecorationDescriptorSet:
+            id.Set = value;
+            break;
+        }
+        break;
+      }
+      case kOpMemberDecorate: {
+        if ((instruction[1] >= ids.size()) || (instruction_words < 5)) {
+          break;
+        }
+        SpirvId &id = ids[instruction[1]];
+        if (instruction[3] == kDecorationOffset) {
+          SetMemberDecoration(id.MemberOffsets, instruction[2],
+                              instruction[4]);
+        } else if (instruction[3] == kDecorationMatrixStride) {
+          SetMemberDecoration(id.MemberMatrixStrides, instruction[2],
+                              instruction[4]);
+        } else if (instruction[3] == kDecorationBuiltIn) {
+          id.BuiltIn = true;
+        }
+        break;
+      }
+    }
+  }
+
+  if (stage_ == VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM) {
+    std::cout << "Could not reflect shader, no supported entry point!"
+              << std::endl;
+    return false;
+  }
+
+  for (uint32_t variable_id : variables) {
+    const SpirvId &variable = ids[variable_id];
+    if (variable.Type >= ids.size()) {
+      continue;
+    }
+    const SpirvId &pointer = ids[variable.Type];
+    if ((pointer.Opcode != kOpTypePointer) || (pointer.OperandCount < 2) ||
+        (pointer.Operands[1] >= ids.size())) {
+      continue;
+    }
+    uint32_t storage_class = pointer.Operands[0];
+    uint32_t type_id = pointer.Operands[1];
+
+    if (storage_class == kStorageClassInput) {
+      // Inputs of later stages come from the previous stage, not from
+      // vertex buffers; built-ins like gl_VertexIndex aren't fetched either
+      if ((stage_ != VK_SHADER_STAGE_VERTEX_BIT) || variable.BuiltIn ||
+          ids[type_id].BuiltIn || !variable.HasLocation) {
+        continue;
+      }
+      ReflectedVertexInput input;
+      input.Location = variable.Location;
+      // Unsupported types are kept, the module itself is still valid and
+      // only deriving vertex attributes from it fails
+      input.Format = GetVertexInputFormat(ids, type_id, &input.Size);
+      vertex_inputs_.push_back(input);
+    } else if (storage_class == kStorageClassPushConstant) {
+      push_constant_size_ =
+          std::max(push_constant_size_, GetTypeSize(ids, type_id, 0));
+    } else {
+      ReflectedBinding binding;
+      if (!GetDescriptorType(ids, storage_class, type_id, &binding.Type,
+                             &binding.Count)) {
+        continue;
+      }
+      binding.Set = variable.Set;
+      binding.Binding = variable.Binding;
+      bindings_.push_back(binding);
+    }
+  }
+
+  // Constants without SpecId are operations on other constants and can't be
+  // set by the application
+  for (uint32_t constant_id : spec_constants) {
+    const SpirvId &constant = ids[constant_id];
+    if (!constant.HasSpecId || (constant.Type >= ids.size())) {
+      continue;
+    }
+    ReflectedSpecializationConstant specialization_constant;
+    specialization_constant.ConstantId = constant.SpecId;
+    specialization_constant.Size = GetTypeSize(ids, constant.Type, 0);
+    specialization_constants_.push_back(specialization_constant);
+  }
+
+  std::sort(vertex_inputs_.begin(), vertex_inputs_.end(),
+            [](const ReflectedVertexInput &a, const ReflectedVertexInput &b) {
+              return a.Location < b.Location;
+            });
+  std::sort(bindings_.begin(), bindings_.end(),
+            [](const ReflectedBinding &a, const ReflectedBinding &b) {
+              return (a.Set < b.Set) ||
+                     ((a.Set == b.Set) && (a.Binding < b.Binding));
+            });
+  std::sort(specialization_constants_.begin(),
+            specialization_constants_.end(),
+            [](const ReflectedSpecializationConstant &a,
+               const ReflectedSpecializationConstant &b) {
+              return a.ConstantId < b.ConstantId;
+            });
+  return true;
+}
+
+VkShaderStageFlagBits ShaderReflection::GetStage() const { return stage_; }
+
+const std::vector<ReflectedVertexInput> &ShaderReflection::GetVertexInputs()
+    const {
+  return vertex_inputs_;
+}
+
+const std::vector<ReflectedBinding> &ShaderReflection::GetBindings() const {
+  return bindings_;
+}
+
+uint32_t ShaderReflection::GetPushConstantSize() const {
+  return push_constant_size_;
+}
+
+const std::vector<ReflectedSpecializationConstant>
+    &ShaderReflection::GetSpecializationConstants() const {
+  return specialization_constants_;
+}
+
+uint32_t ShaderReflection::GetVertexAttributes(
+    uint32_t binding,
+    std::vector<VkVertexInputAttributeDescription> *attributes) const {
+  uint32_t offset = 0;
+  for (const ReflectedVertexInput &input : vertex_inputs_) {
+    VkVertexInputAttributeDescription attribute = {};
+    attribute.location = input.Location;
+    attribute.binding = binding;
+    attribute.format = input.Format;
+    attribute.offset = offset;
+    attributes->push_back(attribute);
+    offset += input.Size;
+  }
+  return offset;
+}
@@ -0,0 +1,96 @@
+#ifndef SHADER_REFLECTION_H_
+#define SHADER_REFLECTION_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ************************************************************ //
+// ReflectedVertexInput                                         //
+//                                                              //
+// Vertex shader input variable                                 //
+// ************************************************************ //
+struct ReflectedVertexInput {
+  uint32_t Location;
+  // VK_FORMAT_UNDEFINED for types no single attribute format exists for,
+  // e.g. matrices, doubles or arrays
+  VkFormat Format;
+  // In bytes
+  uint32_t Size;
+
+  ReflectedVertexInput()
+      : Location(0), Format(VK_FORMAT_UNDEFINED), Size(0) {}
+};
+
+// ************************************************************ //
+// ReflectedBinding                                             //
+//                                                              //
+// Descriptor used by a shader                                  //
+// ************************************************************ //
+struct ReflectedBinding {
+  uint32_t Set;
+  uint32_t Binding;
+  VkDescriptorType Type;
+  // Unsized arrays are reported with a count of 1
+  uint32_t Count;
+
+  ReflectedBinding()
+      : Set(0),
+        Binding(0),
+        Type(VK_DESCRIPTOR_TYPE_MAX_ENUM),
+        Count(1) {}
+};
+
+// ************************************************************ //
+// ReflectedSpecializationConstant                              //
+//                                                              //
+// Specialization constant declared by a shader                 //
+// ************************************************************ //
+struct ReflectedSpecializationConstant {
+  uint32_t ConstantId;
+  // In bytes; booleans are VkBool32
+  uint32_t Size;
+
+  ReflectedSpecializationConstant() : ConstantId(0), Size(0) {}
+};
+
+// ************************************************************ //
+// ShaderReflection                                             //
+//                                                              //
+// Interface of a SPIR-V module: its stage, vertex inputs,      //
+// descriptors, push constant block and specialization         //
+// constants; only the first entry point of a module is taken   //
+// into account                                                 //
+// ************************************************************ //
+class ShaderReflection {
+ public:
+  ShaderReflection();
+  bool Parse(const uint32_t *code, size_t code_size);
+  VkShaderStageFlagBits GetStage() const;
+  // Sorted by location; empty for stages other than vertex
+  const std::vector<ReflectedVertexInput> &GetVertexInputs() const;
+  // Sorted by set and binding
+  const std::vector<ReflectedBinding> &GetBindings() const;
+  // 0 when the shader has no push constant block
+  uint32_t GetPushConstantSize() const;
+  // Sorted by constant id
+  const std::vector<ReflectedSpecializationConstant> &
+  GetSpecializationConstants() const;
+  // Describes all vertex inputs as tightly packed, interleaved attributes of
+  // a single vertex buffer binding; returns the vertex stride. Every input
+  // needs a format, see ReflectedVertexInput
+  uint32_t GetVertexAttributes(
+      uint32_t binding,
+      std::vector<VkVertexInputAttributeDescription> *attributes) const;
+
+ private:
+  VkShaderStageFlagBits stage_;
+  std::vector<ReflectedVertexInput> vertex_inputs_;
+  std::vector<ReflectedBinding> bindings_;
+  uint32_t push_constant_size_;
+  std::vector<ReflectedSpecializationConstant> specialization_constants_;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#include "shader_registry.h"
+
+ShaderRegistry &ShaderRegistry::Get() {
+  static ShaderRegistry registry;
+  return registry;
+}
+
+ShaderRegistry::ShaderRegistry() : shaders_() {}
+
+void ShaderRegistry::Register(const EmbeddedShader *shaders, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    shaders_[shaders[i].Name] = &shaders[i];
+  }
+}
+
+const EmbeddedShader *ShaderRegistry::Find(const std::string &name) const {
+  auto shader = shaders_.find(name);
+  if (shader == shaders_.end()) {
+    return nullptr;
+  }
+  return shader->second;
+}
+
+ShaderRegistrar::ShaderRegistrar(const EmbeddedShader *shaders, size_t count) {
+  ShaderRegistry::Get().Register(shaders, count);
+}
@@ -0,0 +1,55 @@
+#ifndef SHADER_REGISTRY_H_
+#define SHADER_REGISTRY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// ************************************************************ //
+// EmbeddedShader                                               //
+//                                                              //
+// SPIR-V binary compiled into the executable                   //
+// ************************************************************ //
+struct EmbeddedShader {
+  // "<demo>/<shader file name>", e.g. "2.1.hello_triangle/shader.vert"
+  const char *Name;
+  const uint32_t *Code;
+  // In bytes, as expected by VkShaderModuleCreateInfo::codeSize
+  size_t CodeSize;
+};
+
+// ************************************************************ //
+// ShaderRegistry                                               //
+//                                                              //
+// Name lookup of embedded SPIR-V; binaries are registered by   //
+// sources generated by the build (cmake/embed_spirv.cmake)     //
+// during static initialization                                 //
+// ************************************************************ //
+class ShaderRegistry {
+ public:
+  static ShaderRegistry &Get();
+  void Register(const EmbeddedShader *shaders, size_t count);
+  // Returns nullptr when the shader isn't embedded, callers then fall back
+  // to loading "data/<name>.spv"
+  const EmbeddedShader *Find(const std::string &name) const;
+
+ private:
+  ShaderRegistry();
+  ShaderRegistry(const ShaderRegistry &);
+  ShaderRegistry &operator=(const ShaderRegistry &);
+  std::unordered_map<std::string, const EmbeddedShader *> shaders_;
+};
+
+// ************************************************************ //
+// ShaderRegistrar                                              //
+//                                                              //
+// Registers embedded shaders from a static object's            //
+// constructor                                                  //
+// ************************************************************ //
+class ShaderRegistrar {
+ public:
+  ShaderRegistrar(const EmbeddedShader *shaders, size_t count);
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "shader_watcher.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#include "tools.h"
+#include "tracer.h"
+
+namespace {
+
+bool IsShaderSource(const std::string &file_name) {
+  static const char *extensions[] = {".vert", ".frag", ".comp",
+                                     ".geom", ".tesc", ".tese"};
+  for (const char *extension : extensions) {
+    size_t length = strlen(extension);
+    if ((file_name.size() > length) &&
+        (file_name.compare(file_name.size() - length, length, extension) ==
+         0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#if defined(__linux__)
+// Runs arguments[0] found through PATH and waits for it; no shell is
+// involved, so the arguments are passed on exactly as they are
+bool RunProcess(std::vector<std::string> arguments) {
+  std::vector<char *> argv;
+  for (std::string &argument : arguments) {
+    argv.push_back(&argument[0]);
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = 0;
+  if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+      0) {
+    return false;
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+#endif
+
+}  // namespace
+
+ShaderWatcher::ShaderWatcher()
+    : source_directory_(),
+      prefix_(),
+      compiler_(),
+      inotify_fd_(-1),
+      stop_pipe_{-1, -1},
+      thread_(),
+      compiled_() {}
+
+ShaderWatcher::~ShaderWatcher() { Stop(); }
+
+bool ShaderWatcher::Start(const std::string &source_directory,
+                          const std::string &prefix,
+                          const std::string &compiler) {
+#if defined(__linux__)
+  Stop();
+  source_directory_ = source_directory;
+  prefix_ = prefix;
+  compiler_ = compiler;
+
+  inotify_fd_ = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    std::cout << "Could not initialize inotify!" << std::endl;
+    return false;
+  }
+  // Editors often save by renaming a temporary file over the source
+  if (inotify_add_watch(inotify_fd_, source_directory_.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    std::cout << "Could not watch shader directory \"" << source_directory_
+              << "\"!" << std::endl;
+    Stop();
+    return false;
+  }
+  if (pipe(stop_pipe_) != 0) {
+    std::cout << "Could not create shader watcher pipe!" << std::endl;
+    Stop();
+    return false;
+  }
+  thread_ = std::thread(&ShaderWatcher::Run, this);
+  return true;
+#else
+  (void)source_directory;
+  (void)prefix;
+  (void)compiler;
+  std::cout << "Shader hot reload is only supported on Linux!" << std::endl;
+  return false;
+#endif
+}
+
+void ShaderWatcher::Stop() {
+#if defined(__linux__)
+  if (thread_.joinable()) {
+    char quit = 0;
+    if (write(stop_pipe_[1], &quit, 1) == 1) {
+      thread_.join();
+    } else {
+      thread_.detach();
+    }
+  }
+  for (int *fd : {&inotify_fd_, &stop_pipe_[0], &stop_pipe_[1]}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+#endif
+}
+
+bool ShaderWatcher::IsRunning() const { return thread_.joinable(); }
+
+void ShaderWatcher::Collect(std::vector<CompiledShader> *shaders) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (CompiledShader &shader : compiled_) {
+    shaders->push_back(std::move(shader));
+  }
+  compiled_.clear();
+}
+
+void ShaderWatcher::Run() {
+#if defined(__linux__)
+  alignas(struct inotify_event) char buffer[4096];
+  while (true) {
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Anything else won't go away by polling again
+      std::cout << "Could not poll shader directory!" << std::endl;
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+
+    // A single save may produce several events, each file is compiled once
+    // per batch
+    std::set<std::string> changed_files;
+    ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length;) {
+      const inotify_event *event =
+          reinterpret_cast<const inotify_event *>(buffer + offset);
+      if ((event->len > 0) && IsShaderSource(event->name)) {
+        changed_files.insert(event->name);
+      }
+      offset += sizeof(inotify_event) + event->len;
+    }
+
+    for (const std::string &file_name : changed_files) {
+      CompiledShader shader;
+      if (!Compile(file_name, &shader)) {
+        continue;
+      }
+      std::cout << "Reloaded shader " << shader.Name << std::endl;
+      std::lock_guard<std::mutex> lock(mutex_);
+      compiled_.push_back(std::move(shader));
+    }
+  }
+#endif
+}
+
+bool ShaderWatcher::Compile(const std::string &file_name,
+                            CompiledShader *shader) {
+#if defined(__linux__)
+  TraceZone zone("Compile shader");
+  std::string source = source_directory_ + "/" + file_name;
+  // A unique file keeps several watchers of the same directory apart and
+  // can't be a link planted by someone else
+  std::string output = std::string(P_tmpdir) + "/shader_XXXXXX";
+  int output_fd = mkstemp(&output[0]);
+  if (output_fd < 0) {
+    std::cout << "Could not create temporary shader file!" << std::endl;
+    return false;
+  }
+  close(output_fd);
+  // Debug info is kept and optimisation skipped, iteration speed matters
+  // more than the generated code here. The file name comes from inotify,
+  // so it must never reach a shell
+  if (!RunProcess({compiler_, "-V", "-g", "-o", output, source})) {
+    std::remove(output.c_str());
+    std::cout << "Could not compile shader \"" << source << "\"!"
+              << std::endl;
+    return false;
+  }
+
+  std::vector<char> code = Tools::GetBinaryFileContents(output);
+  std::remove(output.c_str());
+  if ((code.size() == 0) || (code.size() % sizeof(uint32_t) != 0)) {
+    std::cout << "Could not read compiled shader \"" << output << "\"!"
+              << std::endl;
+    return false;
+  }
+  shader->Name = prefix_ + "/" + file_name;
+  shader->Code.resize(code.size() / sizeof(uint32_t));
+  memcpy(shader->Code.data(), code.data(), code.size());
+  return true;
+#else
+  (void)file_name;
+  (void)shader;
+  return false;
+#endif
+}
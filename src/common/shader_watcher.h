@@ -0,0 +1,60 @@
+#ifndef SHADER_WATCHER_H_
+#define SHADER_WATCHER_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ************************************************************ //
+// CompiledShader                                               //
+//                                                              //
+// SPIR-V recompiled from a changed GLSL source                 //
+// ************************************************************ //
+struct CompiledShader {
+  // Same naming as ShaderLibrary, "<prefix>/<source file name>"
+  std::string Name;
+  std::vector<uint32_t> Code;
+
+  CompiledShader() : Name(), Code() {}
+};
+
+// ************************************************************ //
+// ShaderWatcher                                                //
+//                                                              //
+// Development aid watching a directory of GLSL sources with    //
+// inotify; changed files are compiled to SPIR-V on a           //
+// background thread and picked up with Collect(). Only         //
+// available on Linux                                           //
+// ************************************************************ //
+class ShaderWatcher {
+ public:
+  ShaderWatcher();
+  ~ShaderWatcher();
+  // compiler is the glslangValidator executable shaders are built with
+  bool Start(const std::string &source_directory, const std::string &prefix,
+             const std::string &compiler);
+  void Stop();
+  bool IsRunning() const;
+  // Moves shaders compiled since the last call to shaders; never waits for
+  // a compilation in progress
+  void Collect(std::vector<CompiledShader> *shaders);
+
+ private:
+  ShaderWatcher(const ShaderWatcher &);
+  ShaderWatcher &operator=(const ShaderWatcher &);
+  void Run();
+  bool Compile(const std::string &file_name, CompiledShader *shader);
+  std::string source_directory_;
+  std::string prefix_;
+  std::string compiler_;
+  int inotify_fd_;
+  // Written by Stop() to wake the thread up
+  int stop_pipe_[2];
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<CompiledShader> compiled_;
+};
+
+#endif
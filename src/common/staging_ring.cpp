@@ -0,0 +1,112 @@
+#include "staging_ring.h"
+
+#include <iostream>
+
+StagingRing::StagingRing()
+    : device_(VK_NULL_HANDLE),
+      allocator_(nullptr),
+      buffer_(VK_NULL_HANDLE),
+      memory_(),
+      size_(0),
+      head_(0),
+      tail_(0),
+      empty_(true) {}
+
+StagingRing::~StagingRing() { Destroy(); }
+
+bool StagingRing::Create(VkDevice device, GpuAllocator *allocator,
+                         VkDeviceSize size) {
+  device_ = device;
+  allocator_ = allocator;
+
+  VkBufferCreateInfo buffer_create_info = {};
+  buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_create_info.size = size;
+  buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device_, &buffer_create_info, nullptr, &buffer_) !=
+      VK_SUCCESS) {
+    std::cout << "Could not create a staging buffer!" << std::endl;
+    return false;
+  }
+
+  // The CPU only writes the ring sequentially so uncached memory is fine
+  if (!allocator_->AllocateForBuffer(buffer_,
+                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                     0, &memory_)) {
+    std::cout << "Could not allocate memory for a staging buffer!"
+              << std::endl;
+    return false;
+  }
+  size_ = size;
+  Reset();
+  return true;
+}
+
+void StagingRing::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  if (buffer_ != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device_, buffer_, nullptr);
+    buffer_ = VK_NULL_HANDLE;
+  }
+  allocator_->Free(memory_);
+  device_ = VK_NULL_HANDLE;
+}
+
+bool StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment,
+                           VkDeviceSize *offset) {
+  if (empty_) {
+    head_ = 0;
+    tail_ = 0;
+  }
+  VkDeviceSize aligned_head = head_;
+  if (alignment > 1) {
+    aligned_head = (head_ + alignment - 1) / alignment * alignment;
+  }
+
+  if (empty_ || (head_ > tail_)) {
+    // Used range is [tail, head); free space is at the end and, after
+    // wrapping, in front of the tail
+    if (aligned_head + size <= size_) {
+      *offset = aligned_head;
+    } else if (size <= tail_) {
+      *offset = 0;
+    } else {
+      return false;
+    }
+  } else if (head_ < tail_) {
+    if (aligned_head + size > tail_) {
+      return false;
+    }
+    *offset = aligned_head;
+  } else {
+    // Head caught up with the tail of a non-empty ring
+    return false;
+  }
+
+  head_ = *offset + size;
+  empty_ = false;
+  return true;
+}
+
+VkDeviceSize StagingRing::GetHead() const { return head_; }
+
+void StagingRing::Release(VkDeviceSize head) { tail_ = head; }
+
+void StagingRing::Reset() {
+  head_ = 0;
+  tail_ = 0;
+  empty_ = true;
+}
+
+VkBuffer StagingRing::GetBuffer() const { return buffer_; }
+
+VkDeviceSize StagingRing::GetSize() const { return size_; }
+
+void *StagingRing::GetMapped(VkDeviceSize offset) const {
+  return static_cast<char *>(memory_.Mapped) + offset;
+}
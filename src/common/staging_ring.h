@@ -0,0 +1,48 @@
+#ifndef STAGING_RING_H_
+#define STAGING_RING_H_
+
+#include <vulkan/vulkan.h>
+
+#include "gpu_allocator.h"
+
+// ************************************************************ //
+// StagingRing                                                  //
+//                                                              //
+// Persistently mapped, host visible transfer source buffer     //
+// handed out as a ring; space is given back in allocation      //
+// order once the GPU has consumed it                           //
+// ************************************************************ //
+class StagingRing {
+ public:
+  StagingRing();
+  ~StagingRing();
+  bool Create(VkDevice device, GpuAllocator *allocator, VkDeviceSize size);
+  void Destroy();
+  // Returns false when the ring has no room for size bytes right now
+  bool Allocate(VkDeviceSize size, VkDeviceSize alignment,
+                VkDeviceSize *offset);
+  // Position right after the latest allocation; passing it to Release()
+  // later frees everything allocated up to that point
+  VkDeviceSize GetHead() const;
+  void Release(VkDeviceSize head);
+  // Marks the whole ring as free
+  void Reset();
+  VkBuffer GetBuffer() const;
+  VkDeviceSize GetSize() const;
+  void *GetMapped(VkDeviceSize offset) const;
+
+ private:
+  StagingRing(const StagingRing &);
+  StagingRing &operator=(const StagingRing &);
+  VkDevice device_;
+  GpuAllocator *allocator_;
+  VkBuffer buffer_;
+  GpuAllocation memory_;
+  VkDeviceSize size_;
+  VkDeviceSize head_;
+  VkDeviceSize tail_;
+  // Distinguishes a full ring from an empty one when head meets tail
+  bool empty_;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "timeline_scheduler.h"
+
+#include <iostream>
+
+TimelineScheduler::TimelineScheduler()
+    : device_(VK_NULL_HANDLE),
+      semaphore_(VK_NULL_HANDLE),
+      last_submitted_value_(0),
+      completed_value_(0),
+      get_semaphore_counter_value_(nullptr),
+      wait_semaphores_(nullptr),
+      pending_releases_() {}
+
+TimelineScheduler::~TimelineScheduler() { Destroy(); }
+
+bool TimelineScheduler::Create(VkDevice device) {
+  device_ = device;
+
+  // Instance is created for Vulkan 1.0 so entry points come from
+  // VK_KHR_timeline_semaphore rather than from the core API
+  get_semaphore_counter_value_ =
+      reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+          vkGetDeviceProcAddr(device_, "vkGetSemaphoreCounterValueKHR"));
+  wait_semaphores_ = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+      vkGetDeviceProcAddr(device_, "vkWaitSemaphoresKHR"));
+  if ((get_semaphore_counter_value_ == nullptr) ||
+      (wait_semaphores_ == nullptr)) {
+    std::cout << "Could not load timeline semaphore functions!" << std::endl;
+    return false;
+  }
+
+  VkSemaphoreTypeCreateInfoKHR semaphore_type_create_info = {};
+  semaphore_type_create_info.sType =
+      VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+  semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  semaphore_type_create_info.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphore_create_info = {};
+  semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_create_info.pNext = &semaphore_type_create_info;
+
+  if (vkCreateSemaphore(device_, &semaphore_create_info, nullptr,
+                        &semaphore_) != VK_SUCCESS) {
+    std::cout << "Could not create timeline semaphore!" << std::endl;
+    return false;
+  }
+  last_submitted_value_ = 0;
+  completed_value_ = 0;
+  return true;
+}
+
+void TimelineScheduler::Destroy() {
+  if (semaphore_ == VK_NULL_HANDLE) {
+    return;
+  }
+  Wait(last_submitted_value_);
+  CollectReleases();
+
+  vkDestroySemaphore(device_, semaphore_, nullptr);
+  semaphore_ = VK_NULL_HANDLE;
+}
+
+VkSemaphore TimelineScheduler::GetSemaphore() const { return semaphore_; }
+
+uint64_t TimelineScheduler::GetNextSubmitValue() const {
+  return last_submitted_value_ + 1;
+}
+
+void TimelineScheduler::OnSubmitted(uint64_t value) {
+  if (value > last_submitted_value_) {
+    last_submitted_value_ = value;
+  }
+}
+
+uint64_t TimelineScheduler::GetLastSubmittedValue() const {
+  return last_submitted_value_;
+}
+
+uint64_t TimelineScheduler::GetCompletedValue() {
+  if (semaphore_ == VK_NULL_HANDLE) {
+    return completed_value_;
+  }
+
+  uint64_t value = 0;
+  if (get_semaphore_counter_value_(device_, semaphore_, &value) ==
+      VK_SUCCESS) {
+    completed_value_ = value;
+  }
+  return completed_value_;
+}
+
+bool TimelineScheduler::IsComplete(uint64_t value) {
+  if (value <= completed_value_) {
+    return true;
+  }
+  return value <= GetCompletedValue();
+}
+
+bool TimelineScheduler::Wait(uint64_t value, uint64_t timeout) {
+  if (IsComplete(value)) {
+    return true;
+  }
+
+  VkSemaphoreWaitInfoKHR semaphore_wait_info = {};
+  semaphore_wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+  semaphore_wait_info.semaphoreCount = 1;
+  semaphore_wait_info.pSemaphores = &semaphore_;
+  semaphore_wait_info.pValues = &value;
+
+  if (wait_semaphores_(device_, &semaphore_wait_info, timeout) != VK_SUCCESS) {
+    return false;
+  }
+  if (value > completed_value_) {
+    completed_value_ = value;
+  }
+  return true;
+}
+
+void TimelineScheduler::DeferRelease(std::function<void()> release) {
+  DeferRelease(last_submitted_value_, std::move(release));
+}
+
+void TimelineScheduler::DeferRelease(uint64_t value,
+                                     std::function<void()> release) {
+  if (IsComplete(value)) {
+    release();
+    return;
+  }
+
+  // Keep releases sorted by value so collection only looks at the front
+  auto position = pending_releases_.end();
+  while ((position != pending_releases_.begin()) &&
+         ((position - 1)->first > value)) {
+    --position;
+  }
+  pending_releases_.emplace(position, value, std::move(release));
+}
+
+void TimelineScheduler::CollectReleases() {
+  while (!pending_releases_.empty() &&
+         IsComplete(pending_releases_.front().first)) {
+    std::function<void()> release = std::move(pending_releases_.front().second);
+    pending_releases_.pop_front();
+    release();
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef TIMELINE_SCHEDULER_H_
+#define TIMELINE_SCHEDULER_H_
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <functional>
+#include <utility>
+
+// ************************************************************ //
+// TimelineScheduler                                            //
+//                                                              //
+// Tracks GPU progress of a single queue with one timeline      //
+// semaphore; every submission signals the next value of a      //
+// monotonically increasing counter                             //
+// ************************************************************ //
+class TimelineScheduler {
+ public:
+  TimelineScheduler();
+  ~TimelineScheduler();
+  bool Create(VkDevice device);
+  // Waits for all outstanding work, runs pending releases and destroys the
+  // semaphore
+  void Destroy();
+  VkSemaphore GetSemaphore() const;
+  // Value the next submission on the queue signals; it only counts as
+  // submitted after OnSubmitted(), so a failed submission can't leave
+  // Wait() or Destroy() waiting for a value that is never signaled
+  uint64_t GetNextSubmitValue() const;
+  void OnSubmitted(uint64_t value);
+  uint64_t GetLastSubmittedValue() const;
+  uint64_t GetCompletedValue();
+  bool IsComplete(uint64_t value);
+  bool Wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+  // Runs release once everything submitted so far has completed on the GPU
+  void DeferRelease(std::function<void()> release);
+  void DeferRelease(uint64_t value, std::function<void()> release);
+  // Runs releases whose values have already been reached
+  void CollectReleases();
+
+ private:
+  TimelineScheduler(const TimelineScheduler &);
+  TimelineScheduler &operator=(const TimelineScheduler &);
+  VkDevice device_;
+  VkSemaphore semaphore_;
+  uint64_t last_submitted_value_;
+  // Cached counter value so polling doesn't always go to the driver
+  uint64_t completed_value_;
+  PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value_;
+  PFN_vkWaitSemaphoresKHR wait_semaphores_;
+  std::deque<std::pair<uint64_t, std::function<void()>>> pending_releases_;
+};
+
+#endif
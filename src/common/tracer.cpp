@@ -0,0 +1,217 @@
+#include "tracer.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+// Events kept per thread; further events of a capture are dropped
+static const uint32_t kEventsPerThread = 32768;
+
+static uint64_t GetClockNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void WriteJsonString(std::ostream &stream, const char *text) {
+  stream << '"';
+  for (; *text != '\0'; ++text) {
+    if ((*text == '"') || (*text == '\\')) {
+      stream << '\\';
+    }
+    if (static_cast<unsigned char>(*text) >= 0x20) {
+      stream << *text;
+    }
+  }
+  stream << '"';
+}
+
+Tracer &Tracer::Get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::Tracer()
+    : epoch_(GetClockNanoseconds()),
+      enabled_(false),
+      filename_(),
+      frames_left_(0),
+      thread_buffers_(),
+      gpu_buffer_(),
+      gpu_calibrated_(false),
+      gpu_offset_(0) {
+  gpu_buffer_.ThreadId = 0;
+  gpu_buffer_.Events.reset(new Event[kEventsPerThread]);
+  gpu_buffer_.Count = 0;
+  gpu_buffer_.FirstExported = 0;
+}
+
+void Tracer::Start(const std::string &filename, uint32_t frame_count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  filename_ = filename;
+  frames_left_ = frame_count;
+  gpu_calibrated_ = false;
+
+  // Events of earlier captures stay in the buffers but are skipped
+  for (std::unique_ptr<ThreadBuffer> &buffer : thread_buffers_) {
+    buffer->FirstExported = buffer->Count.load(std::memory_order_acquire);
+  }
+  gpu_buffer_.FirstExported = gpu_buffer_.Count.load(std::memory_order_acquire);
+  enabled_.store(true, std::memory_order_release);
+}
+
+void Tracer::Stop() { enabled_.store(false, std::memory_order_release); }
+
+bool Tracer::IsEnabled() const {
+  return enabled_.load(std::memory_order_relaxed);
+}
+
+void Tracer::EndFrame() {
+  if (!IsEnabled() || (frames_left_ == 0)) {
+    return;
+  }
+  if (--frames_left_ == 0) {
+    Write();
+    Stop();
+  }
+}
+
+bool Tracer::Write() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ofstream file(filename_, std::ios::out | std::ios::trunc);
+  if (!file) {
+    std::cout << "Could not open trace file \"" << filename_ << "\"!"
+              << std::endl;
+    return false;
+  }
+  file << std::fixed << std::setprecision(3);
+
+  std::vector<ThreadBuffer *> buffers;
+  buffers.push_back(&gpu_buffer_);
+  for (std::unique_ptr<ThreadBuffer> &buffer : thread_buffers_) {
+    buffers.push_back(buffer.get());
+  }
+
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (ThreadBuffer *buffer : buffers) {
+    if (!first) {
+      file << ",";
+    }
+    first = false;
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << buffer->ThreadId << ",\"args\":{\"name\":\"";
+    if (buffer == &gpu_buffer_) {
+      file << "GPU";
+    } else {
+      file << "CPU thread " << buffer->ThreadId;
+    }
+    file << "\"}}";
+
+    // Trace timestamps are in microseconds; fixed notation keeps nanosecond
+    // resolution however long the capture runs
+    uint32_t count = buffer->Count.load(std::memory_order_acquire);
+    for (uint32_t i = buffer->FirstExported; i < count; ++i) {
+      const Event &event = buffer->Events[i];
+      file << ",{\"name\":";
+      WriteJsonString(file, event.Name);
+      file << ",\"cat\":\"" << (buffer == &gpu_buffer_ ? "gpu" : "cpu")
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->ThreadId
+           << ",\"ts\":" << event.Start / 1000.0
+           << ",\"dur\":" << event.Duration / 1000.0 << "}";
+    }
+  }
+  file << "]}" << std::endl;
+
+  std::cout << "Trace written to \"" << filename_ << "\"" << std::endl;
+  return true;
+}
+
+uint64_t Tracer::Now() const { return GetClockNanoseconds() - epoch_; }
+
+uint64_t Tracer::FromClock(uint64_t clock_nanoseconds) const {
+  return clock_nanoseconds - epoch_;
+}
+
+void Tracer::CalibrateGpu(uint64_t gpu_time, uint64_t cpu_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  gpu_offset_ = static_cast<int64_t>(cpu_time) - static_cast<int64_t>(gpu_time);
+  gpu_calibrated_ = true;
+}
+
+void Tracer::BoundGpu(uint64_t gpu_time, uint64_t cpu_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The GPU may have been busy with earlier work when the submission was
+  // made, which only loosens the bound; an idle GPU makes it exact
+  int64_t offset =
+      static_cast<int64_t>(cpu_time) - static_cast<int64_t>(gpu_time);
+  if (!gpu_calibrated_ || (offset > gpu_offset_)) {
+    gpu_offset_ = offset;
+    gpu_calibrated_ = true;
+  }
+}
+
+void Tracer::RecordCpuZone(const char *name, uint64_t start, uint64_t end) {
+  if (!IsEnabled()) {
+    return;
+  }
+  Record(GetThreadBuffer(), name, start, end);
+}
+
+void Tracer::RecordGpuZone(const char *name, uint64_t gpu_start,
+                           uint64_t gpu_end) {
+  if (!IsEnabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!gpu_calibrated_) {
+    return;
+  }
+  int64_t start = static_cast<int64_t>(gpu_start) + gpu_offset_;
+  int64_t end = static_cast<int64_t>(gpu_end) + gpu_offset_;
+  if (start < 0) {
+    return;
+  }
+  Record(&gpu_buffer_, name, static_cast<uint64_t>(start),
+         static_cast<uint64_t>(end));
+}
+
+Tracer::ThreadBuffer *Tracer::GetThreadBuffer() {
+  thread_local ThreadBuffer *thread_buffer = nullptr;
+  if (thread_buffer == nullptr) {
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+    buffer->Events.reset(new Event[kEventsPerThread]);
+    buffer->Count = 0;
+    buffer->FirstExported = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer->ThreadId = static_cast<uint32_t>(thread_buffers_.size() + 1);
+    thread_buffer = buffer.get();
+    thread_buffers_.push_back(std::move(buffer));
+  }
+  return thread_buffer;
+}
+
+void Tracer::Record(ThreadBuffer *buffer, const char *name, uint64_t start,
+                    uint64_t end) {
+  uint32_t index = buffer->Count.load(std::memory_order_relaxed);
+  if (index >= kEventsPerThread) {
+    return;
+  }
+  Event &event = buffer->Events[index];
+  strncpy(event.Name, name, sizeof(event.Name) - 1);
+  event.Name[sizeof(event.Name) - 1] = '\0';
+  event.Start = start;
+  event.Duration = end > start ? end - start : 0;
+  buffer->Count.store(index + 1, std::memory_order_release);
+}
+
+TraceZone::TraceZone(const char *name)
+    : name_(name), start_(Tracer::Get().Now()) {}
+
+TraceZone::~TraceZone() {
+  Tracer &tracer = Tracer::Get();
+  tracer.RecordCpuZone(name_, start_, tracer.Now());
+}
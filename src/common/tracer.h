@@ -0,0 +1,99 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ************************************************************ //
+// Tracer                                                       //
+//                                                              //
+// Collects CPU and GPU zones into per-thread buffers and       //
+// writes them as a Chrome trace (chrome://tracing, Perfetto)   //
+// JSON file; recording a zone never takes a lock               //
+// ************************************************************ //
+class Tracer {
+ public:
+  static Tracer &Get();
+  // Starts a capture; when frame_count is non-zero the trace is written to
+  // filename automatically after that many EndFrame() calls
+  void Start(const std::string &filename, uint32_t frame_count = 0);
+  void Stop();
+  bool IsEnabled() const;
+  // Marks the end of a frame on the calling thread
+  void EndFrame();
+  // Writes everything recorded since Start() without ending the capture
+  bool Write();
+  // Nanoseconds since the tracer was created
+  uint64_t Now() const;
+  // Converts nanoseconds of std::chrono::steady_clock, CLOCK_MONOTONIC on
+  // Linux, to the time base of Now()
+  uint64_t FromClock(uint64_t clock_nanoseconds) const;
+  // Maps the device's timestamp counter onto Now() with a GPU and a CPU
+  // time of the same instant, e.g. from vkGetCalibratedTimestampsEXT
+  void CalibrateGpu(uint64_t gpu_time, uint64_t cpu_time);
+  // For devices without calibrated timestamps: cpu_time was taken before
+  // submitting the work that wrote timestamp gpu_time, so the GPU clock is
+  // at least that far behind; the tightest bound seen so far is used
+  void BoundGpu(uint64_t gpu_time, uint64_t cpu_time);
+  void RecordCpuZone(const char *name, uint64_t start, uint64_t end);
+  // GPU times are in nanoseconds of the device's timestamp counter; zones
+  // are dropped until CalibrateGpu() or BoundGpu() was called
+  void RecordGpuZone(const char *name, uint64_t gpu_start, uint64_t gpu_end);
+
+ private:
+  struct Event {
+    // Names are copied since GPU zone names don't outlive their frame
+    char Name[48];
+    uint64_t Start;
+    uint64_t Duration;
+  };
+  // Written only by its owning thread; Count is published with release
+  // semantics once an event is complete
+  struct ThreadBuffer {
+    uint32_t ThreadId;
+    std::unique_ptr<Event[]> Events;
+    std::atomic<uint32_t> Count;
+    uint32_t FirstExported;
+  };
+
+  Tracer();
+  Tracer(const Tracer &);
+  Tracer &operator=(const Tracer &);
+  ThreadBuffer *GetThreadBuffer();
+  void Record(ThreadBuffer *buffer, const char *name, uint64_t start,
+              uint64_t end);
+  uint64_t epoch_;
+  std::atomic<bool> enabled_;
+  std::string filename_;
+  uint32_t frames_left_;
+  // Guards buffer registration, the GPU track and writing the file
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> thread_buffers_;
+  ThreadBuffer gpu_buffer_;
+  bool gpu_calibrated_;
+  int64_t gpu_offset_;
+};
+
+// ************************************************************ //
+// TraceZone                                                    //
+//                                                              //
+// Records a CPU zone covering its lifetime; name must be a     //
+// string that outlives the zone                                //
+// ************************************************************ //
+class TraceZone {
+ public:
+  explicit TraceZone(const char *name);
+  ~TraceZone();
+
+ private:
+  TraceZone(const TraceZone &);
+  TraceZone &operator=(const TraceZone &);
+  const char *name_;
+  uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "upload_service.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Staging offsets are kept aligned so copies stay friendly to DMA engines
+static const VkDeviceSize kStagingAlignment = 16;
+
+UploadService::UploadService()
+    : device_(VK_NULL_HANDLE),
+      timeline_(nullptr),
+      queue_(VK_NULL_HANDLE),
+      command_pool_(VK_NULL_HANDLE),
+      free_command_buffers_(),
+      staging_ring_(),
+      pending_copies_(),
+      batches_() {}
+
+UploadService::~UploadService() { Destroy(); }
+
+bool UploadService::Create(VkDevice device, GpuAllocator *allocator,
+                           TimelineScheduler *timeline, VkQueue queue,
+                           uint32_t queue_family_index,
+                           VkDeviceSize staging_size) {
+  device_ = device;
+  timeline_ = timeline;
+  queue_ = queue;
+
+  VkCommandPoolCreateInfo cmd_pool_create_info = {};
+  cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                               VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  cmd_pool_create_info.queueFamilyIndex = queue_family_index;
+
+  if (vkCreateCommandPool(device_, &cmd_pool_create_info, nullptr,
+                          &command_pool_) != VK_SUCCESS) {
+    std::cout << "Could not create command pool for uploads!" << std::endl;
+    return false;
+  }
+
+  return staging_ring_.Create(device_, allocator, staging_size);
+}
+
+void UploadService::Destroy() {
+  if (device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  if (!batches_.empty()) {
+    timeline_->Wait(batches_.back().TimelineValue);
+  }
+  batches_.clear();
+  pending_copies_.clear();
+  free_command_buffers_.clear();
+
+  if (command_pool_ != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(device_, command_pool_, nullptr);
+    command_pool_ = VK_NULL_HANDLE;
+  }
+  staging_ring_.Destroy();
+  device_ = VK_NULL_HANDLE;
+}
+
+bool UploadService::Upload(VkBuffer buffer, VkDeviceSize offset,
+                           const void *data, VkDeviceSize size) {
+  const char *source = static_cast<const char *>(data);
+  while (size > 0) {
+    VkDeviceSize chunk_size = std::min(size, staging_ring_.GetSize());
+    VkDeviceSize staging_offset;
+    if (!AllocateStaging(chunk_size, &staging_offset)) {
+      return false;
+    }
+    memcpy(staging_ring_.GetMapped(staging_offset), source,
+           static_cast<size_t>(chunk_size));
+
+    PendingCopy copy;
+    copy.Buffer = buffer;
+    copy.Region.srcOffset = staging_offset;
+    copy.Region.dstOffset = offset;
+    copy.Region.size = chunk_size;
+    pending_copies_.push_back(copy);
+
+    source += chunk_size;
+    offset += chunk_size;
+    size -= chunk_size;
+  }
+  return true;
+}
+
+bool UploadService::Flush(uint64_t *timeline_value) {
+  ReclaimBatches();
+  if (pending_copies_.empty()) {
+    if (timeline_value != nullptr) {
+      *timeline_value = batches_.empty() ? timeline_->GetCompletedValue()
+                                         : batches_.back().TimelineValue;
+    }
+    return true;
+  }
+
+  VkCommandBuffer command_buffer;
+  if (!AcquireCommandBuffer(&command_buffer)) {
+    return false;
+  }
+
+  VkCommandBufferBeginInfo command_buffer_begin_info = {};
+  command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  command_buffer_begin_info.flags =
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+
+  // Consecutive copies into the same buffer go out as a single command
+  std::vector<VkBufferCopy> regions;
+  for (size_t i = 0; i < pending_copies_.size(); ++i) {
+    regions.push_back(pending_copies_[i].Region);
+    if ((i + 1 == pending_copies_.size()) ||
+        (pending_copies_[i + 1].Buffer != pending_copies_[i].Buffer)) {
+      vkCmdCopyBuffer(command_buffer, staging_ring_.GetBuffer(),
+                      pending_copies_[i].Buffer,
+                      static_cast<uint32_t>(regions.size()), regions.data());
+      regions.clear();
+    }
+  }
+
+  // Batches go to the same queue as rendering, so a single barrier makes the
+  // copies visible to every later submission
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memory_barrier.dstAccessMask =
+      VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+      VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    std::cout << "Could not record upload command buffer!" << std::endl;
+    free_command_buffers_.push_back(command_buffer);
+    return false;
+  }
+
+  uint64_t value = timeline_->GetNextSubmitValue();
+  VkSemaphore timeline_semaphore = timeline_->GetSemaphore();
+
+  VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {};
+  timeline_submit_info.sType =
+      VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_submit_info.signalSemaphoreValueCount = 1;
+  timeline_submit_info.pSignalSemaphoreValues = &value;
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_submit_info;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &timeline_semaphore;
+
+  if (vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+    std::cout << "Could not submit uploads!" << std::endl;
+    return false;
+  }
+  timeline_->OnSubmitted(value);
+
+  Batch batch;
+  batch.CommandBuffer = command_buffer;
+  batch.TimelineValue = value;
+  batch.RingEnd = staging_ring_.GetHead();
+  batches_.push_back(batch);
+  pending_copies_.clear();
+
+  if (timeline_value != nullptr) {
+    *timeline_value = value;
+  }
+  return true;
+}
+
+bool UploadService::HasPendingUploads() const {
+  return !pending_copies_.empty();
+}
+
+bool UploadService::AllocateStaging(VkDeviceSize size, VkDeviceSize *offset) {
+  for (;;) {
+    ReclaimBatches();
+    if (staging_ring_.Allocate(size, kStagingAlignment, offset)) {
+      return true;
+    }
+
+    // Ring is full: push out what was staged so far, then wait for the
+    // oldest batch to give its space back
+    if (!pending_copies_.empty()) {
+      if (!Flush()) {
+        return false;
+      }
+      continue;
+    }
+    if (batches_.empty()) {
+      std::cout << "Upload does not fit into the staging buffer!" << std::endl;
+      return false;
+    }
+    if (!timeline_->Wait(batches_.front().TimelineValue)) {
+      std::cout << "Waiting for an upload batch failed!" << std::endl;
+      return false;
+    }
+  }
+}
+
+void UploadService::ReclaimBatches() {
+  while (!batches_.empty() &&
+         timeline_->IsComplete(batches_.front().TimelineValue)) {
+    staging_ring_.Release(batches_.front().RingEnd);
+    free_command_buffers_.push_back(batches_.front().CommandBuffer);
+    batches_.pop_front();
+  }
+  if (batches_.empty() && pending_copies_.empty()) {
+    staging_ring_.Reset();
+  }
+}
+
+bool UploadService::AcquireCommandBuffer(VkCommandBuffer *command_buffer) {
+  // Buffers of completed batches are reset implicitly by
+  // vkBeginCommandBuffer thanks to the pool's reset flag
+  if (!free_command_buffers_.empty()) {
+    *command_buffer = free_command_buffers_.back();
+    free_command_buffers_.pop_back();
+    return true;
+  }
+
+  VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+  command_buffer_allocate_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_allocate_info.commandPool = command_pool_;
+  command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  command_buffer_allocate_info.commandBufferCount = 1;
+
+  if (vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                               command_buffer) != VK_SUCCESS) {
+    std::cout << "Could not allocate upload command buffer!" << std::endl;
+    return false;
+  }
+  return true;
+}
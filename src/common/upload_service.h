@@ -0,0 +1,70 @@
+#ifndef UPLOAD_SERVICE_H_
+#define UPLOAD_SERVICE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <vector>
+
+#include "gpu_allocator.h"
+#include "staging_ring.h"
+#include "timeline_scheduler.h"
+
+// ************************************************************ //
+// UploadService                                                //
+//                                                              //
+// Copies CPU data into device local buffers through a          //
+// persistently mapped staging ring; copies are batched and     //
+// submitted together, each batch signaling the next value of   //
+// the queue's timeline                                         //
+// ************************************************************ //
+class UploadService {
+ public:
+  UploadService();
+  ~UploadService();
+  bool Create(VkDevice device, GpuAllocator *allocator,
+              TimelineScheduler *timeline, VkQueue queue,
+              uint32_t queue_family_index,
+              VkDeviceSize staging_size = 4 * 1024 * 1024);
+  // Waits for batches in flight and releases the staging ring
+  void Destroy();
+  // Stages data for a copy into buffer at offset; the copy is executed by
+  // the next Flush(). Data larger than the staging ring is split and may
+  // flush and wait for earlier batches on the way
+  bool Upload(VkBuffer buffer, VkDeviceSize offset, const void *data,
+              VkDeviceSize size);
+  // Submits all staged copies; completion is signaled by the returned
+  // timeline value (or the last submitted value when nothing was staged)
+  bool Flush(uint64_t *timeline_value = nullptr);
+  bool HasPendingUploads() const;
+
+ private:
+  // Copies recorded by one Flush()
+  struct Batch {
+    VkCommandBuffer CommandBuffer;
+    uint64_t TimelineValue;
+    // Staging ring head after the batch; everything before it is free once
+    // the batch completes
+    VkDeviceSize RingEnd;
+  };
+  struct PendingCopy {
+    VkBuffer Buffer;
+    VkBufferCopy Region;
+  };
+
+  UploadService(const UploadService &);
+  UploadService &operator=(const UploadService &);
+  bool AllocateStaging(VkDeviceSize size, VkDeviceSize *offset);
+  void ReclaimBatches();
+  bool AcquireCommandBuffer(VkCommandBuffer *command_buffer);
+  VkDevice device_;
+  TimelineScheduler *timeline_;
+  VkQueue queue_;
+  VkCommandPool command_pool_;
+  std::vector<VkCommandBuffer> free_command_buffers_;
+  StagingRing staging_ring_;
+  std::vector<PendingCopy> pending_copies_;
+  std::deque<Batch> batches_;
+};
+
+#endif
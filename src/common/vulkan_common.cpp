@@ -4,24 +4,51 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
 
+// Size of the per-frame transient buffer used by AllocateTransient()
+static const VkDeviceSize kTransientBufferSize = 1024 * 1024;
+
 VulkanCommon::VulkanCommon() {}
 
 VulkanCommon::~VulkanCommon() {
   if (vulkan_.Device != VK_NULL_HANDLE) {
     vkDeviceWaitIdle(vulkan_.Device);
 
+    shader_watcher_.Stop();
+    pipeline_compiler_.Destroy();
+    pipeline_registry_.Destroy();
+    render_graph_.Destroy();
+    async_upload_engine_.Destroy();
+    upload_service_.Destroy();
+    transfer_timeline_.Destroy();
+    graphics_timeline_.Destroy();
+    readback_.Destroy();
+    recorder_.Destroy();
+    pipeline_cache_.Destroy();
+    shader_library_.Destroy();
+    pipeline_layout_cache_.Destroy();
+    profiler_.Destroy();
+    DestroyFrameResources();
+
     for (size_t i = 0; i < vulkan_.SwapChain.Images.size(); ++i) {
       if (vulkan_.SwapChain.Images[i].View != VK_NULL_HANDLE) {
         vkDestroyImageView(GetDevice(), vulkan_.SwapChain.Images[i].View,
                            nullptr);
       }
+      // Offscreen targets of headless mode are owned by us
+      if (vulkan_.SwapChain.Images[i].Memory.Memory != VK_NULL_HANDLE) {
+        vkDestroyImage(GetDevice(), vulkan_.SwapChain.Images[i].Handle,
+                       nullptr);
+        allocator_.Free(vulkan_.SwapChain.Images[i].Memory);
+      }
     }
+    allocator_.Destroy();
 
     if (vulkan_.SwapChain.Handle != VK_NULL_HANDLE) {
       vkDestroySwapchainKHR(vulkan_.Device, vulkan_.SwapChain.Handle, nullptr);
@@ -50,11 +77,16 @@ bool VulkanCommon::CheckExtensionAvailability(
 }
 
 std::vector<const char *> VulkanCommon::GetRequiredExtensions() {
-  uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionCount);
+  std::vector<const char *> extensions;
+  // Surface extensions are only needed when presenting to a window
+  if (!headless_) {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
+  // Required by VK_KHR_timeline_semaphore on a Vulkan 1.0 instance
+  extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
   return extensions;
 }
 
@@ -133,7 +165,10 @@ bool VulkanCommon::CheckPhysicalDeviceProperties(
   }
 
   std::vector<const char *> device_extensions = {
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+      VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
+  if (!headless_) {
+    device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
 
   for (std::size_t i = 0; i < device_extensions.size(); ++i) {
     if (!CheckExtensionAvailability(device_extensions[i],
@@ -180,9 +215,13 @@ bool VulkanCommon::CheckPhysicalDeviceProperties(
   uint32_t present_queue_family_index = UINT32_MAX;
 
   for (uint32_t i = 0; i < queue_families_count; ++i) {
-    vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i,
-                                         vulkan_.PresentationSurface,
-                                         &queue_present_support[i]);
+    if (headless_) {
+      queue_present_support[i] = VK_FALSE;
+    } else {
+      vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i,
+                                           vulkan_.PresentationSurface,
+                                           &queue_present_support[i]);
+    }
 
     if ((queue_family_properties[i].queueCount > 0) &&
         (queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
@@ -191,8 +230,9 @@ bool VulkanCommon::CheckPhysicalDeviceProperties(
         graphics_queue_family_index = i;
       }
 
-      // If there is queue that supports both graphics and present - prefer it
-      if (queue_present_support[i]) {
+      // If there is queue that supports both graphics and present - prefer it;
+      // headless rendering never presents so any graphics queue will do
+      if (headless_ || queue_present_support[i]) {
         selected_graphics_queue_family_index = i;
         selected_present_queue_family_index = i;
         return true;
@@ -224,6 +264,153 @@ bool VulkanCommon::CheckPhysicalDeviceProperties(
   return true;
 }
 
+bool VulkanCommon::CheckGraphicsPipelineLibrarySupport(
+    VkPhysicalDevice physical_device) {
+  uint32_t extensions_count = 0;
+  if (vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                           &extensions_count,
+                                           nullptr) != VK_SUCCESS) {
+    return false;
+  }
+  std::vector<VkExtensionProperties> available_extensions(extensions_count);
+  if ((vkEnumerateDeviceExtensionProperties(
+           physical_device, nullptr, &extensions_count,
+           available_extensions.data()) != VK_SUCCESS) ||
+      !CheckExtensionAvailability(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+                                  available_extensions) ||
+      !CheckExtensionAvailability(
+          VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+          available_extensions)) {
+    return false;
+  }
+
+  // Vulkan 1.0 instance, so the queries come from
+  // VK_KHR_get_physical_device_properties2
+  PFN_vkGetPhysicalDeviceFeatures2KHR get_features =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+          vkGetInstanceProcAddr(vulkan_.Instance,
+                                "vkGetPhysicalDeviceFeatures2KHR"));
+  PFN_vkGetPhysicalDeviceProperties2KHR get_properties =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+          vkGetInstanceProcAddr(vulkan_.Instance,
+                                "vkGetPhysicalDeviceProperties2KHR"));
+  if ((get_features == nullptr) || (get_properties == nullptr)) {
+    return false;
+  }
+
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library_features = {};
+  library_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  VkPhysicalDeviceFeatures2KHR features = {};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+  features.pNext = &library_features;
+  get_features(physical_device, &features);
+
+  VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT library_properties =
+      {};
+  library_properties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+  VkPhysicalDeviceProperties2KHR properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+  properties.pNext = &library_properties;
+  get_properties(physical_device, &properties);
+
+  // Without fast linking a link costs about as much as a full compile, so
+  // libraries would only add overhead
+  return (library_features.graphicsPipelineLibrary == VK_TRUE) &&
+         (library_properties.graphicsPipelineLibraryFastLinking == VK_TRUE);
+}
+
+bool VulkanCommon::CheckCalibratedTimestampSupport(
+    VkPhysicalDevice physical_device) {
+#if defined(__linux__)
+  uint32_t extensions_count = 0;
+  if (vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                           &extensions_count,
+                                           nullptr) != VK_SUCCESS) {
+    return false;
+  }
+  std::vector<VkExtensionProperties> available_extensions(extensions_count);
+  if ((vkEnumerateDeviceExtensionProperties(
+           physical_device, nullptr, &extensions_count,
+           available_extensions.data()) != VK_SUCCESS) ||
+      !CheckExtensionAvailability(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME,
+                                  available_extensions)) {
+    return false;
+  }
+
+  PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_time_domains =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT>(
+          vkGetInstanceProcAddr(
+              vulkan_.Instance,
+              "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT"));
+  uint32_t time_domains_count = 0;
+  if ((get_time_domains == nullptr) ||
+      (get_time_domains(physical_device, &time_domains_count, nullptr) !=
+       VK_SUCCESS)) {
+    return false;
+  }
+  std::vector<VkTimeDomainEXT> time_domains(time_domains_count);
+  if (get_time_domains(physical_device, &time_domains_count,
+                       time_domains.data()) != VK_SUCCESS) {
+    return false;
+  }
+  bool device_domain = false;
+  bool monotonic_domain = false;
+  for (VkTimeDomainEXT time_domain : time_domains) {
+    device_domain |= time_domain == VK_TIME_DOMAIN_DEVICE_EXT;
+    monotonic_domain |= time_domain == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+  }
+  return device_domain && monotonic_domain;
+#else
+  // steady_clock doesn't match any time domain elsewhere
+  (void)physical_device;
+  return false;
+#endif
+}
+
+void VulkanCommon::SelectAuxiliaryQueueFamilies(
+    VkPhysicalDevice physical_device, uint32_t graphics_queue_family_index,
+    uint32_t &selected_transfer_queue_family_index,
+    uint32_t &selected_compute_queue_family_index) {
+  uint32_t queue_families_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                           &queue_families_count, nullptr);
+  std::vector<VkQueueFamilyProperties> queue_family_properties(
+      queue_families_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      physical_device, &queue_families_count, queue_family_properties.data());
+
+  selected_transfer_queue_family_index = graphics_queue_family_index;
+  selected_compute_queue_family_index = graphics_queue_family_index;
+
+  // Transfer only family usually maps to a dedicated DMA engine
+  for (uint32_t i = 0; i < queue_families_count; ++i) {
+    VkQueueFlags flags = queue_family_properties[i].queueFlags;
+    if ((queue_family_properties[i].queueCount > 0) &&
+        (flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      selected_transfer_queue_family_index = i;
+      break;
+    }
+  }
+
+  // Compute families support transfers implicitly, so any non-graphics
+  // family still takes copies off the graphics queue
+  for (uint32_t i = 0; i < queue_families_count; ++i) {
+    VkQueueFlags flags = queue_family_properties[i].queueFlags;
+    if ((queue_family_properties[i].queueCount > 0) &&
+        (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      selected_compute_queue_family_index = i;
+      if (selected_transfer_queue_family_index ==
+          graphics_queue_family_index) {
+        selected_transfer_queue_family_index = i;
+      }
+      break;
+    }
+  }
+}
+
 bool VulkanCommon::CreateDevice() {
   uint32_t num_devices = 0;
   if ((vkEnumeratePhysicalDevices(vulkan_.Instance, &num_devices, nullptr) !=
@@ -260,28 +447,74 @@ bool VulkanCommon::CreateDevice() {
     return false;
   }
 
+  uint32_t selected_transfer_queue_family_index = UINT32_MAX;
+  uint32_t selected_compute_queue_family_index = UINT32_MAX;
+  SelectAuxiliaryQueueFamilies(vulkan_.PhysicalDevice,
+                               selected_graphics_queue_family_index,
+                               selected_transfer_queue_family_index,
+                               selected_compute_queue_family_index);
+
+  // One queue from every distinct family
+  std::vector<uint32_t> queue_family_indices = {
+      selected_graphics_queue_family_index, selected_present_queue_family_index,
+      selected_transfer_queue_family_index,
+      selected_compute_queue_family_index};
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
   std::vector<float> queue_priorities = {1.0f};
-  VkDeviceQueueCreateInfo graphic_create_info = {};
-  graphic_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  graphic_create_info.queueFamilyIndex = selected_graphics_queue_family_index;
-  graphic_create_info.queueCount = queue_priorities.size();
-  graphic_create_info.pQueuePriorities = queue_priorities.data();
-  queue_create_infos.push_back(graphic_create_info);
-
-  if (selected_graphics_queue_family_index !=
-      selected_present_queue_family_index) {
-    VkDeviceQueueCreateInfo present_create_info = {};
-    present_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    present_create_info.queueFamilyIndex = selected_present_queue_family_index;
-    present_create_info.queueCount = queue_priorities.size();
-    present_create_info.pQueuePriorities = queue_priorities.data();
-    queue_create_infos.push_back(present_create_info);
-  }
-
-  std::vector<const char *> extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+  for (size_t i = 0; i < queue_family_indices.size(); ++i) {
+    bool already_created = false;
+    for (size_t j = 0; j < i; ++j) {
+      if (queue_family_indices[j] == queue_family_indices[i]) {
+        already_created = true;
+      }
+    }
+    if (already_created) {
+      continue;
+    }
+
+    VkDeviceQueueCreateInfo queue_create_info = {};
+    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_create_info.queueFamilyIndex = queue_family_indices[i];
+    queue_create_info.queueCount = queue_priorities.size();
+    queue_create_info.pQueuePriorities = queue_priorities.data();
+    queue_create_infos.push_back(queue_create_info);
+  }
+
+  std::vector<const char *> extensions = {
+      VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
+  if (!headless_) {
+    extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+  graphics_pipeline_library_ =
+      CheckGraphicsPipelineLibrarySupport(vulkan_.PhysicalDevice);
+  if (graphics_pipeline_library_) {
+    extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+    extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+  }
+  bool calibrated_timestamps =
+      CheckCalibratedTimestampSupport(vulkan_.PhysicalDevice);
+  if (calibrated_timestamps) {
+    extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+  }
+
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT
+      graphics_pipeline_library_features = {};
+  graphics_pipeline_library_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  graphics_pipeline_library_features.graphicsPipelineLibrary = VK_TRUE;
+
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features =
+      {};
+  timeline_semaphore_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+  if (graphics_pipeline_library_) {
+    timeline_semaphore_features.pNext = &graphics_pipeline_library_features;
+  }
+  timeline_semaphore_features.timelineSemaphore = VK_TRUE;
+
   VkDeviceCreateInfo device_create_info = {};
   device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_create_info.pNext = &timeline_semaphore_features;
   device_create_info.queueCreateInfoCount = queue_create_infos.size();
   device_create_info.pQueueCreateInfos = queue_create_infos.data();
   device_create_info.enabledExtensionCount = extensions.size();
@@ -292,9 +525,16 @@ bool VulkanCommon::CreateDevice() {
     std::cout << "Could not create Vulkan device!" << std::endl;
     return false;
   }
+  if (calibrated_timestamps) {
+    get_calibrated_timestamps_ =
+        reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(vkGetDeviceProcAddr(
+            vulkan_.Device, "vkGetCalibratedTimestampsEXT"));
+  }
 
   vulkan_.GraphicsQueue.FamilyIndex = selected_graphics_queue_family_index;
   vulkan_.PresentQueue.FamilyIndex = selected_present_queue_family_index;
+  vulkan_.TransferQueue.FamilyIndex = selected_transfer_queue_family_index;
+  vulkan_.ComputeQueue.FamilyIndex = selected_compute_queue_family_index;
   return true;
 }
 
@@ -303,6 +543,10 @@ bool VulkanCommon::GetDeviceQueue() {
                    &vulkan_.GraphicsQueue.Handle);
   vkGetDeviceQueue(vulkan_.Device, vulkan_.PresentQueue.FamilyIndex, 0,
                    &vulkan_.PresentQueue.Handle);
+  vkGetDeviceQueue(vulkan_.Device, vulkan_.TransferQueue.FamilyIndex, 0,
+                   &vulkan_.TransferQueue.Handle);
+  vkGetDeviceQueue(vulkan_.Device, vulkan_.ComputeQueue.FamilyIndex, 0,
+                   &vulkan_.ComputeQueue.Handle);
   return true;
 }
 
@@ -374,7 +618,10 @@ VkImageUsageFlags VulkanCommon::GetSwapChainUsageFlags(
   // supported
   if (surface_capabilities.supportedUsageFlags &
       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) {
-    return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // Frame readback copies out of swap chain images
+    return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+           (surface_capabilities.supportedUsageFlags &
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
   }
   std::cout << "VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT image usage is not "
                "supported by the swap chain!"
@@ -468,20 +715,29 @@ VkPresentModeKHR VulkanCommon::GetSwapChainPresentMode(
 }
 
 bool VulkanCommon::CreateSwapChain() {
-  can_render_ = false;
-
-  if (vulkan_.Device != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(vulkan_.Device);
+  if (headless_) {
+    return CreateOffscreenTargets();
   }
+  can_render_ = false;
 
+  // Image views of the old swap chain may still be used by frames in flight,
+  // so they are retired to the graphics timeline instead of draining the GPU
+  VkDevice device = vulkan_.Device;
+  std::vector<VkImageView> old_image_views;
   for (std::size_t i = 0; i < vulkan_.SwapChain.Images.size(); ++i) {
     if (vulkan_.SwapChain.Images[i].View != VK_NULL_HANDLE) {
-      vkDestroyImageView(GetDevice(), vulkan_.SwapChain.Images[i].View,
-                         nullptr);
+      old_image_views.push_back(vulkan_.SwapChain.Images[i].View);
       vulkan_.SwapChain.Images[i].View = VK_NULL_HANDLE;
     }
   }
   vulkan_.SwapChain.Images.clear();
+  if (!old_image_views.empty()) {
+    graphics_timeline_.DeferRelease([device, old_image_views]() {
+      for (VkImageView image_view : old_image_views) {
+        vkDestroyImageView(device, image_view, nullptr);
+      }
+    });
+  }
 
   VkSurfaceCapabilitiesKHR surface_capabilities;
   if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
@@ -581,7 +837,9 @@ bool VulkanCommon::CreateSwapChain() {
     return false;
   }
   if (old_swap_chain != VK_NULL_HANDLE) {
-    vkDestroySwapchainKHR(vulkan_.Device, old_swap_chain, nullptr);
+    graphics_timeline_.DeferRelease([device, old_swap_chain]() {
+      vkDestroySwapchainKHR(device, old_swap_chain, nullptr);
+    });
   }
 
   vulkan_.SwapChain.Format = desired_format.format;
@@ -606,8 +864,119 @@ bool VulkanCommon::CreateSwapChain() {
     vulkan_.SwapChain.Images[i].Handle = images[i];
   }
   vulkan_.SwapChain.Extent = desired_extent;
+  vulkan_.SwapChain.Usage = desired_usage;
+  vulkan_.SwapChain.FinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  images_in_flight_.assign(image_count, 0);
+  image_submit_times_.assign(image_count, 0);
+  if (!profiler_.SetSlotCount(image_count)) {
+    return false;
+  }
+
+  if (!CreateSwapChainImageViews()) {
+    return false;
+  }
+  return UpdateReadbackTargets();
+}
+
+bool VulkanCommon::CreateOffscreenTargets() {
+  can_render_ = false;
+
+  // Same as with a swap chain, frames in flight may still render into the
+  // old targets
+  VkDevice device = vulkan_.Device;
+  GpuAllocator *allocator = &allocator_;
+  std::vector<ImageParameters> old_images = vulkan_.SwapChain.Images;
+  vulkan_.SwapChain.Images.clear();
+  if (!old_images.empty()) {
+    graphics_timeline_.DeferRelease([device, allocator, old_images]() mutable {
+      for (ImageParameters &image : old_images) {
+        if (image.View != VK_NULL_HANDLE) {
+          vkDestroyImageView(device, image.View, nullptr);
+        }
+        if (image.Handle != VK_NULL_HANDLE) {
+          vkDestroyImage(device, image.Handle, nullptr);
+        }
+        allocator->Free(image.Memory);
+      }
+    });
+  }
+
+  // Targets are read back rather than presented, hence the transfer usage
+  // and final layout
+  VkImageCreateInfo image_create_info = {};
+  image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_create_info.imageType = VK_IMAGE_TYPE_2D;
+  image_create_info.format = vulkan_.SwapChain.Format;
+  image_create_info.extent = {vulkan_.SwapChain.Extent.width,
+                              vulkan_.SwapChain.Extent.height, 1};
+  image_create_info.mipLevels = 1;
+  image_create_info.arrayLayers = 1;
+  image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                            VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  vulkan_.SwapChain.Images.resize(headless_image_count_);
+  bool created = true;
+  for (ImageParameters &image : vulkan_.SwapChain.Images) {
+    if (vkCreateImage(vulkan_.Device, &image_create_info, nullptr,
+                      &image.Handle) != VK_SUCCESS) {
+      std::cout << "Could not create offscreen render target!" << std::endl;
+      created = false;
+      break;
+    }
+    if (!allocator_.AllocateForImage(image.Handle, VK_IMAGE_TILING_OPTIMAL,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                                     &image.Memory)) {
+      std::cout << "Could not allocate memory for offscreen render target!"
+                << std::endl;
+      created = false;
+      break;
+    }
+  }
+  if (!created) {
+    // The destructor only treats images with memory as ours, the ones
+    // created so far are released here
+    for (ImageParameters &image : vulkan_.SwapChain.Images) {
+      if (image.Handle != VK_NULL_HANDLE) {
+        vkDestroyImage(vulkan_.Device, image.Handle, nullptr);
+      }
+      allocator_.Free(image.Memory);
+    }
+    vulkan_.SwapChain.Images.clear();
+    return false;
+  }
+  vulkan_.SwapChain.Usage = image_create_info.usage;
+  vulkan_.SwapChain.FinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  next_offscreen_image_ = 0;
+  images_in_flight_.assign(headless_image_count_, 0);
+  image_submit_times_.assign(headless_image_count_, 0);
+  if (!profiler_.SetSlotCount(headless_image_count_)) {
+    return false;
+  }
 
-  return CreateSwapChainImageViews();
+  if (!CreateSwapChainImageViews()) {
+    return false;
+  }
+  return UpdateReadbackTargets();
+}
+
+bool VulkanCommon::UpdateReadbackTargets() {
+  if ((vulkan_.GraphicsQueue.FamilyIndex != vulkan_.PresentQueue.FamilyIndex) ||
+      !(vulkan_.SwapChain.Usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    // Copies are recorded for the graphics queue after the frame and can't
+    // follow an ownership transfer to the present queue
+    readback_.SetCallback(nullptr);
+  }
+  std::vector<VkImage> images;
+  for (const ImageParameters &image : vulkan_.SwapChain.Images) {
+    images.push_back(image.Handle);
+  }
+  return readback_.SetTargets(images, vulkan_.SwapChain.Format,
+                              vulkan_.SwapChain.Extent,
+                              vulkan_.SwapChain.FinalLayout);
 }
 
 bool VulkanCommon::CreateSwapChainImageViews() {
@@ -634,24 +1003,551 @@ bool VulkanCommon::CreateSwapChainImageViews() {
 }
 
 bool VulkanCommon::PrepareVulkan(GLFWwindow *window) {
+  TraceZone zone("PrepareVulkan");
+  headless_ = false;
   if (!CreateInstance()) {
     return false;
   }
   if (!CreatePresentationSurface(window)) {
     return false;
   }
+  return PrepareDevice();
+}
+
+bool VulkanCommon::PrepareVulkanHeadless(uint32_t width, uint32_t height,
+                                         VkFormat format,
+                                         uint32_t image_count) {
+  TraceZone zone("PrepareVulkanHeadless");
+  headless_ = true;
+  headless_image_count_ = image_count > 0 ? image_count : 1;
+  vulkan_.SwapChain.Format = format;
+  vulkan_.SwapChain.Extent = {width, height};
+  if (!CreateInstance()) {
+    return false;
+  }
+  return PrepareDevice();
+}
+
+bool VulkanCommon::IsHeadless() const { return headless_; }
+
+bool VulkanCommon::PrepareDevice() {
   if (!CreateDevice()) {
     return false;
   }
   if (!GetDeviceQueue()) {
     return false;
   }
+  if (!allocator_.Create(vulkan_.PhysicalDevice, vulkan_.Device)) {
+    return false;
+  }
+  if (!graphics_timeline_.Create(vulkan_.Device)) {
+    return false;
+  }
+  if (!transfer_timeline_.Create(vulkan_.Device)) {
+    return false;
+  }
+  if (!upload_service_.Create(vulkan_.Device, &allocator_, &graphics_timeline_,
+                              vulkan_.GraphicsQueue.Handle,
+                              vulkan_.GraphicsQueue.FamilyIndex)) {
+    return false;
+  }
+  if (!async_upload_engine_.Create(
+          vulkan_.Device, &allocator_, &transfer_timeline_,
+          vulkan_.TransferQueue.Handle, vulkan_.TransferQueue.FamilyIndex,
+          &graphics_timeline_, vulkan_.GraphicsQueue.Handle,
+          vulkan_.GraphicsQueue.FamilyIndex)) {
+    return false;
+  }
+  if (!pipeline_cache_.Create(vulkan_.PhysicalDevice, vulkan_.Device,
+                              pipeline_cache_filename_)) {
+    return false;
+  }
+  if (!pipeline_compiler_.Create(vulkan_.Device,
+                                 pipeline_cache_.GetHandle())) {
+    return false;
+  }
+  if (!shader_library_.Create(vulkan_.Device)) {
+    return false;
+  }
+  if (!pipeline_layout_cache_.Create(vulkan_.Device)) {
+    return false;
+  }
+  if (!pipeline_registry_.Create(vulkan_.Device, &shader_library_,
+                                 &pipeline_layout_cache_, &pipeline_compiler_,
+                                 &graphics_timeline_,
+                                 graphics_pipeline_library_)) {
+    return false;
+  }
+  if (!render_graph_.Create(vulkan_.Device, &allocator_, &graphics_timeline_,
+                            vulkan_.GraphicsQueue.FamilyIndex)) {
+    return false;
+  }
+  if (!profiler_.Create(vulkan_.PhysicalDevice, vulkan_.Device,
+                        vulkan_.GraphicsQueue.FamilyIndex, &graphics_timeline_,
+                        0)) {
+    return false;
+  }
+  if (!readback_.Create(vulkan_.PhysicalDevice, vulkan_.Device, &allocator_,
+                        &graphics_timeline_,
+                        vulkan_.GraphicsQueue.FamilyIndex)) {
+    return false;
+  }
   if (!CreateSwapChain()) {
     return false;
   }
+  if (!CreateFrameResources()) {
+    return false;
+  }
+  if (!recorder_.Create(vulkan_.Device, vulkan_.GraphicsQueue.FamilyIndex,
+                        static_cast<uint32_t>(vulkan_.Frames.size()))) {
+    return false;
+  }
+  return true;
+}
+
+bool VulkanCommon::CreateFrameResources() {
+  // There is no point in running further ahead than the number of images the
+  // swap chain lets us hold at once
+  uint32_t image_count = static_cast<uint32_t>(vulkan_.SwapChain.Images.size());
+  if ((image_count > 0) && (frames_in_flight_ > image_count)) {
+    frames_in_flight_ = image_count;
+  }
+  vulkan_.Frames.resize(frames_in_flight_);
+  current_frame_ = 0;
+
+  // Binary semaphores are still needed as swap chain acquire and present
+  // can't wait on or signal timeline semaphores
+  VkSemaphoreCreateInfo semaphore_create_info = {};
+  semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkCommandPoolCreateInfo cmd_pool_create_info = {};
+  cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmd_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  cmd_pool_create_info.queueFamilyIndex = vulkan_.GraphicsQueue.FamilyIndex;
+
+  for (FrameResources &frame : vulkan_.Frames) {
+    if ((vkCreateSemaphore(vulkan_.Device, &semaphore_create_info, nullptr,
+                           &frame.ImageAvailableSemaphore) != VK_SUCCESS) ||
+        (vkCreateSemaphore(vulkan_.Device, &semaphore_create_info, nullptr,
+                           &frame.RenderingFinishedSemaphore) != VK_SUCCESS)) {
+      std::cout << "Could not create semaphores!" << std::endl;
+      return false;
+    }
+
+    if (vkCreateCommandPool(vulkan_.Device, &cmd_pool_create_info, nullptr,
+                            &frame.CommandPool) != VK_SUCCESS) {
+      std::cout << "Could not create command pool!" << std::endl;
+      return false;
+    }
+
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.commandPool = frame.CommandPool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(vulkan_.Device, &command_buffer_allocate_info,
+                                 &frame.CommandBuffer) != VK_SUCCESS) {
+      std::cout << "Could not allocate command buffers!" << std::endl;
+      return false;
+    }
+
+    if (!CreateTransientAllocator(frame.TransientAllocator)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool VulkanCommon::CreateTransientAllocator(
+    TransientAllocatorParameters &allocator) {
+  VkBufferCreateInfo buffer_create_info = {};
+  buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_create_info.size = kTransientBufferSize;
+  buffer_create_info.usage =
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(vulkan_.Device, &buffer_create_info, nullptr,
+                     &allocator.Buffer.Handle) != VK_SUCCESS) {
+    std::cout << "Could not create a transient buffer!" << std::endl;
+    return false;
+  }
+  allocator.Buffer.Size = kTransientBufferSize;
+
+  // Coherent memory lets the CPU write without explicit flushes
+  if (!allocator_.AllocateForBuffer(allocator.Buffer.Handle,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                    0, &allocator.Buffer.Memory)) {
+    std::cout << "Could not allocate memory for a transient buffer!"
+              << std::endl;
+    return false;
+  }
+  allocator.Mapped = allocator.Buffer.Memory.Mapped;
+  allocator.Offset = 0;
+  return true;
+}
+
+void VulkanCommon::DestroyFrameResources() {
+  for (FrameResources &frame : vulkan_.Frames) {
+    if (frame.TransientAllocator.Buffer.Handle != VK_NULL_HANDLE) {
+      vkDestroyBuffer(vulkan_.Device, frame.TransientAllocator.Buffer.Handle,
+                      nullptr);
+    }
+    allocator_.Free(frame.TransientAllocator.Buffer.Memory);
+    if (frame.CommandPool != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(vulkan_.Device, frame.CommandPool, nullptr);
+    }
+    if (frame.ImageAvailableSemaphore != VK_NULL_HANDLE) {
+      vkDestroySemaphore(vulkan_.Device, frame.ImageAvailableSemaphore,
+                         nullptr);
+    }
+    if (frame.RenderingFinishedSemaphore != VK_NULL_HANDLE) {
+      vkDestroySemaphore(vulkan_.Device, frame.RenderingFinishedSemaphore,
+                         nullptr);
+    }
+  }
+  vulkan_.Frames.clear();
+}
+
+void VulkanCommon::SetFramesInFlight(uint32_t count) {
+  frames_in_flight_ = count > 0 ? count : 1;
+}
+
+uint32_t VulkanCommon::GetFramesInFlight() const {
+  return static_cast<uint32_t>(vulkan_.Frames.size());
+}
+
+FrameResources &VulkanCommon::GetCurrentFrame() {
+  return vulkan_.Frames[current_frame_];
+}
+
+uint32_t VulkanCommon::GetCurrentFrameIndex() const { return current_frame_; }
+
+TimelineScheduler &VulkanCommon::GetGraphicsTimeline() {
+  return graphics_timeline_;
+}
+
+GpuAllocator &VulkanCommon::GetAllocator() { return allocator_; }
+
+UploadService &VulkanCommon::GetUploadService() { return upload_service_; }
+
+AsyncUploadEngine &VulkanCommon::GetAsyncUploadEngine() {
+  return async_upload_engine_;
+}
+
+TimelineScheduler &VulkanCommon::GetTransferTimeline() {
+  return transfer_timeline_;
+}
+
+GpuProfiler &VulkanCommon::GetProfiler() { return profiler_; }
+
+bool VulkanCommon::SetReadbackCallback(ReadbackCallback callback) {
+  readback_.SetCallback(callback);
+  if (vulkan_.SwapChain.Images.empty()) {
+    return true;
+  }
+  if (!UpdateReadbackTargets()) {
+    return false;
+  }
+  if (callback && !readback_.IsEnabled()) {
+    std::cout << "Frame readback is not supported by the swap chain!"
+              << std::endl;
+    return false;
+  }
   return true;
 }
 
+bool VulkanCommon::FlushReadbacks() { return readback_.WaitAll(); }
+
+ParallelRecorder &VulkanCommon::GetParallelRecorder() { return recorder_; }
+
+bool VulkanCommon::CreateDeviceLocalBuffer(const void *data, VkDeviceSize size,
+                                           VkBufferUsageFlags usage,
+                                           BufferParameters *buffer) {
+  VkBufferCreateInfo buffer_create_info = {};
+  buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_create_info.size = size;
+  buffer_create_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(vulkan_.Device, &buffer_create_info, nullptr,
+                     &buffer->Handle) != VK_SUCCESS) {
+    std::cout << "Could not create a buffer!" << std::endl;
+    return false;
+  }
+  buffer->Size = size;
+
+  if (!allocator_.AllocateForBuffer(buffer->Handle,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                                    &buffer->Memory)) {
+    std::cout << "Could not allocate memory for a buffer!" << std::endl;
+    vkDestroyBuffer(vulkan_.Device, buffer->Handle, nullptr);
+    buffer->Handle = VK_NULL_HANDLE;
+    buffer->Size = 0;
+    return false;
+  }
+  return upload_service_.Upload(buffer->Handle, 0, data, size);
+}
+
+void VulkanCommon::SetPipelineCacheFilename(const std::string &filename) {
+  pipeline_cache_filename_ = filename;
+}
+
+VkPipelineCache VulkanCommon::GetPipelineCache() const {
+  return pipeline_cache_.GetHandle();
+}
+
+PipelineCompiler &VulkanCommon::GetPipelineCompiler() {
+  return pipeline_compiler_;
+}
+
+ShaderLibrary &VulkanCommon::GetShaderLibrary() { return shader_library_; }
+
+bool VulkanCommon::EnableShaderHotReload(const std::string &source_directory,
+                                         const std::string &prefix,
+                                         const std::string &compiler) {
+  return shader_watcher_.Start(source_directory, prefix, compiler);
+}
+
+void VulkanCommon::ApplyShaderReloads() {
+  std::vector<CompiledShader> shaders;
+  shader_watcher_.Collect(&shaders);
+  std::vector<std::string> names;
+  for (CompiledShader &shader : shaders) {
+    if (shader_library_.Reload(shader.Name, std::move(shader.Code))) {
+      names.push_back(shader.Name);
+    }
+  }
+  if (!names.empty()) {
+    ChildOnShadersReloaded(names);
+  }
+}
+
+void VulkanCommon::CalibrateGpuClock(uint32_t image_index) {
+  if (get_calibrated_timestamps_ != nullptr) {
+    VkCalibratedTimestampInfoEXT timestamp_infos[2] = {};
+    timestamp_infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    timestamp_infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+    timestamp_infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    timestamp_infos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+    uint64_t timestamps[2] = {};
+    uint64_t max_deviation = 0;
+    if (get_calibrated_timestamps_(vulkan_.Device, 2, timestamp_infos,
+                                   timestamps,
+                                   &max_deviation) == VK_SUCCESS) {
+      Tracer::Get().CalibrateGpu(profiler_.GetNanoseconds(timestamps[0]),
+                                 Tracer::Get().FromClock(timestamps[1]));
+      return;
+    }
+  }
+
+  // Otherwise the submission of the image's frame bounds its timestamps
+  const std::vector<GpuProfileNode> &nodes = profiler_.GetLastResults().Nodes;
+  if (nodes.empty()) {
+    return;
+  }
+  uint64_t gpu_start = nodes[0].StartNanoseconds;
+  for (const GpuProfileNode &node : nodes) {
+    gpu_start = std::min(gpu_start, node.StartNanoseconds);
+  }
+  Tracer::Get().BoundGpu(gpu_start, image_submit_times_[image_index]);
+}
+
+PipelineLayoutCache &VulkanCommon::GetPipelineLayoutCache() {
+  return pipeline_layout_cache_;
+}
+
+PipelineRegistry &VulkanCommon::GetPipelineRegistry() {
+  return pipeline_registry_;
+}
+
+RenderGraph &VulkanCommon::GetRenderGraph() { return render_graph_; }
+
+bool VulkanCommon::AllocateTransient(VkDeviceSize size, VkDeviceSize alignment,
+                                     VkDeviceSize *offset, void **data) {
+  TransientAllocatorParameters &allocator =
+      GetCurrentFrame().TransientAllocator;
+  VkDeviceSize aligned_offset = allocator.Offset;
+  if (alignment > 1) {
+    aligned_offset = (aligned_offset + alignment - 1) / alignment * alignment;
+  }
+  if (aligned_offset + size > allocator.Buffer.Size) {
+    std::cout << "Transient buffer of the current frame is exhausted!"
+              << std::endl;
+    return false;
+  }
+
+  allocator.Offset = aligned_offset + size;
+  *offset = aligned_offset;
+  *data = static_cast<char *>(allocator.Mapped) + aligned_offset;
+  return true;
+}
+
+VkResult VulkanCommon::AcquireFrame(uint32_t *image_index) {
+  TraceZone zone("Acquire");
+  FrameResources &frame = GetCurrentFrame();
+
+  // Only block when the GPU is still busy with the frame submitted
+  // frames_in_flight_ frames ago
+  if (!graphics_timeline_.Wait(frame.TimelineValue)) {
+    std::cout << "Waiting for a frame slot failed!" << std::endl;
+    return VK_ERROR_DEVICE_LOST;
+  }
+  frame.TransientAllocator.Offset = 0;
+  graphics_timeline_.CollectReleases();
+  readback_.Collect();
+  if (shader_watcher_.IsRunning()) {
+    ApplyShaderReloads();
+  }
+  // Everything recorded for this slot last time is reset at once instead of
+  // per command buffer
+  if ((vkResetCommandPool(vulkan_.Device, frame.CommandPool, 0) !=
+       VK_SUCCESS) ||
+      !recorder_.BeginSlot(current_frame_)) {
+    std::cout << "Could not reset command pools of a frame slot!" << std::endl;
+    return VK_ERROR_OUT_OF_HOST_MEMORY;
+  }
+
+  VkResult result = VK_SUCCESS;
+  if (headless_) {
+    // Offscreen targets are simply used in turn
+    *image_index = next_offscreen_image_;
+    next_offscreen_image_ =
+        (next_offscreen_image_ + 1) % vulkan_.SwapChain.Images.size();
+  } else {
+    result = vkAcquireNextImageKHR(vulkan_.Device, vulkan_.SwapChain.Handle,
+                                   UINT64_MAX, frame.ImageAvailableSemaphore,
+                                   VK_NULL_HANDLE, image_index);
+  }
+  switch (result) {
+    case VK_SUCCESS:
+    case VK_SUBOPTIMAL_KHR:
+      break;
+    case VK_ERROR_OUT_OF_DATE_KHR:
+      return result;
+    default:
+      std::cout << "Problem occurred during swap chain image acquisition!"
+                << std::endl;
+      return result;
+  }
+
+  // The image may have been acquired out of order and still be rendered by
+  // another frame slot
+  if (!graphics_timeline_.Wait(images_in_flight_[*image_index])) {
+    std::cout << "Waiting for a swap chain image failed!" << std::endl;
+    return VK_ERROR_DEVICE_LOST;
+  }
+  // Its readback buffer is overwritten by this frame, so the previous frame
+  // rendered into it has to be delivered first; timeline values grow with
+  // submission order, so every frame before it is complete as well
+  readback_.Collect();
+  if ((images_in_flight_[*image_index] != 0) &&
+      profiler_.CollectResults(*image_index) && Tracer::Get().IsEnabled()) {
+    CalibrateGpuClock(*image_index);
+    for (const GpuProfileNode &node : profiler_.GetLastResults().Nodes) {
+      Tracer::Get().RecordGpuZone(node.Name.c_str(), node.StartNanoseconds,
+                                  node.EndNanoseconds);
+    }
+  }
+  return VK_SUCCESS;
+}
+
+VkResult VulkanCommon::SubmitFrame(uint32_t image_index,
+                                   VkCommandBuffer command_buffer) {
+  FrameResources &frame = GetCurrentFrame();
+
+  // Uploads staged while recording go first on the same queue so the frame
+  // sees their results; transfer queue uploads finished by now are acquired
+  // by the graphics queue ahead of the frame as well
+  if (!upload_service_.Flush() || !async_upload_engine_.Flush() ||
+      !async_upload_engine_.SubmitAcquires()) {
+    return VK_ERROR_OUT_OF_HOST_MEMORY;
+  }
+
+  VkPipelineStageFlags wait_dst_stage_mask =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+  // Binary semaphore for presentation plus the next graphics timeline value;
+  // the value paired with the binary semaphore is ignored. Headless frames
+  // are neither acquired nor presented so only the timeline is signaled
+  uint64_t timeline_value = graphics_timeline_.GetNextSubmitValue();
+  VkSemaphore signal_semaphores[] = {frame.RenderingFinishedSemaphore,
+                                     graphics_timeline_.GetSemaphore()};
+  uint64_t signal_values[] = {0, timeline_value};
+  uint32_t first_signal = headless_ ? 1 : 0;
+
+  // The frame's readback copy runs right after it in the same submission
+  VkCommandBuffer command_buffers[] = {
+      command_buffer, readback_.GetCommandBuffer(image_index)};
+
+  VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {};
+  timeline_submit_info.sType =
+      VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_submit_info.signalSemaphoreValueCount = 2 - first_signal;
+  timeline_submit_info.pSignalSemaphoreValues = &signal_values[first_signal];
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_submit_info;
+  submit_info.waitSemaphoreCount = headless_ ? 0 : 1;
+  submit_info.pWaitSemaphores = &frame.ImageAvailableSemaphore;
+  submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
+  submit_info.commandBufferCount =
+      command_buffers[1] != VK_NULL_HANDLE ? 2 : 1;
+  submit_info.pCommandBuffers = command_buffers;
+  submit_info.signalSemaphoreCount = 2 - first_signal;
+  submit_info.pSignalSemaphores = &signal_semaphores[first_signal];
+
+  // The GPU can't start on the frame before it is submitted
+  uint64_t submit_time = Tracer::Get().Now();
+  VkResult result;
+  {
+    TraceZone zone("Submit");
+    result = vkQueueSubmit(vulkan_.GraphicsQueue.Handle, 1, &submit_info,
+                           VK_NULL_HANDLE);
+  }
+  if (result != VK_SUCCESS) {
+    std::cout << "Could not submit a frame!" << std::endl;
+    return result;
+  }
+  graphics_timeline_.OnSubmitted(timeline_value);
+  frame.TimelineValue = timeline_value;
+  images_in_flight_[image_index] = timeline_value;
+  image_submit_times_[image_index] = submit_time;
+  readback_.OnSubmitted(image_index, timeline_value);
+  current_frame_ = (current_frame_ + 1) % vulkan_.Frames.size();
+  if (headless_) {
+    return VK_SUCCESS;
+  }
+
+  VkPresentInfoKHR present_info = {};
+  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  present_info.waitSemaphoreCount = 1;
+  present_info.pWaitSemaphores = &frame.RenderingFinishedSemaphore;
+  present_info.swapchainCount = 1;
+  present_info.pSwapchains = &vulkan_.SwapChain.Handle;
+  present_info.pImageIndices = &image_index;
+
+  {
+    TraceZone zone("Present");
+    result = vkQueuePresentKHR(vulkan_.PresentQueue.Handle, &present_info);
+  }
+  switch (result) {
+    case VK_SUCCESS:
+    case VK_ERROR_OUT_OF_DATE_KHR:
+    case VK_SUBOPTIMAL_KHR:
+      break;
+    default:
+      std::cout << "Problem occurred during image presentation!" << std::endl;
+      break;
+  }
+  return result;
+}
+
 bool VulkanCommon::CreatePresentationSurface(GLFWwindow *window) {
   if (glfwCreateWindowSurface(vulkan_.Instance, window, nullptr,
                               &vulkan_.PresentationSurface) != VK_SUCCESS) {
@@ -669,11 +1565,15 @@ const QueueParameters VulkanCommon::GetPresentQueue() const {
   return vulkan_.PresentQueue;
 }
 
-bool VulkanCommon::OnWindowSizeChanged() {
-  if (vulkan_.Device != VK_NULL_HANDLE) {
-    vkDeviceWaitIdle(vulkan_.Device);
-  }
+const QueueParameters VulkanCommon::GetTransferQueue() const {
+  return vulkan_.TransferQueue;
+}
+
+const QueueParameters VulkanCommon::GetComputeQueue() const {
+  return vulkan_.ComputeQueue;
+}
 
+bool VulkanCommon::OnWindowSizeChanged() {
   ChildClear();
 
   if (CreateSwapChain()) {
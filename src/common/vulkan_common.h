@@ -6,8 +6,25 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
 
+#include <string>
 #include <vector>
 
+#include "async_upload_engine.h"
+#include "frame_readback.h"
+#include "gpu_allocator.h"
+#include "gpu_profiler.h"
+#include "parallel_recorder.h"
+#include "pipeline_cache.h"
+#include "pipeline_compiler.h"
+#include "pipeline_layout_cache.h"
+#include "pipeline_registry.h"
+#include "render_graph.h"
+#include "shader_library.h"
+#include "shader_watcher.h"
+#include "timeline_scheduler.h"
+#include "tracer.h"
+#include "upload_service.h"
+
 // ************************************************************ //
 // QueueParameters                                              //
 //                                                              //
@@ -29,13 +46,14 @@ struct ImageParameters {
   VkImage Handle;
   VkImageView View;
   VkSampler Sampler;
-  VkDeviceMemory Memory;
+  // Empty for images owned by someone else, i.e. the swap chain
+  GpuAllocation Memory;
 
   ImageParameters()
       : Handle(VK_NULL_HANDLE),
         View(VK_NULL_HANDLE),
         Sampler(VK_NULL_HANDLE),
-        Memory(VK_NULL_HANDLE) {}
+        Memory() {}
 };
 
 // ************************************************************ //
@@ -44,16 +62,72 @@ struct ImageParameters {
 // Vulkan SwapChain's parameters container class                //
 // ************************************************************ //
 struct SwapChainParameters {
+  // VK_NULL_HANDLE in headless mode where Images are offscreen targets
   VkSwapchainKHR Handle;
   VkFormat Format;
   std::vector<ImageParameters> Images;
   VkExtent2D Extent;
+  VkImageUsageFlags Usage;
+  // Layout images have to be left in once a frame is rendered
+  VkImageLayout FinalLayout;
 
   SwapChainParameters()
       : Handle(VK_NULL_HANDLE),
         Format(VK_FORMAT_UNDEFINED),
         Images(),
-        Extent() {}
+        Extent(),
+        Usage(0),
+        FinalLayout(VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) {}
+};
+
+// ************************************************************ //
+// BufferParameters                                             //
+//                                                              //
+// Vulkan Buffer's parameters container class                   //
+// ************************************************************ //
+struct BufferParameters {
+  VkBuffer Handle;
+  GpuAllocation Memory;
+  VkDeviceSize Size;
+
+  BufferParameters() : Handle(VK_NULL_HANDLE), Memory(), Size(0) {}
+};
+
+// ************************************************************ //
+// TransientAllocatorParameters                                 //
+//                                                              //
+// Linear allocator over a persistently mapped, host visible    //
+// buffer; rewound each time its frame slot is reused           //
+// ************************************************************ //
+struct TransientAllocatorParameters {
+  BufferParameters Buffer;
+  void *Mapped;
+  VkDeviceSize Offset;
+
+  TransientAllocatorParameters() : Buffer(), Mapped(nullptr), Offset(0) {}
+};
+
+// ************************************************************ //
+// FrameResources                                               //
+//                                                              //
+// Resources owned by a single frame-in-flight slot             //
+// ************************************************************ //
+struct FrameResources {
+  VkSemaphore ImageAvailableSemaphore;
+  VkSemaphore RenderingFinishedSemaphore;
+  // Graphics timeline value signaled by the last submission of this slot
+  uint64_t TimelineValue;
+  VkCommandPool CommandPool;
+  VkCommandBuffer CommandBuffer;
+  TransientAllocatorParameters TransientAllocator;
+
+  FrameResources()
+      : ImageAvailableSemaphore(VK_NULL_HANDLE),
+        RenderingFinishedSemaphore(VK_NULL_HANDLE),
+        TimelineValue(0),
+        CommandPool(VK_NULL_HANDLE),
+        CommandBuffer(VK_NULL_HANDLE),
+        TransientAllocator() {}
 };
 
 // ************************************************************ //
@@ -67,8 +141,12 @@ struct VulkanCommonParameters {
   VkDevice Device;
   QueueParameters GraphicsQueue;
   QueueParameters PresentQueue;
+  // Fall back to the graphics queue when the device has no dedicated family
+  QueueParameters TransferQueue;
+  QueueParameters ComputeQueue;
   VkSurfaceKHR PresentationSurface;
   SwapChainParameters SwapChain;
+  std::vector<FrameResources> Frames;
 
   VulkanCommonParameters()
       : Instance(VK_NULL_HANDLE),
@@ -76,8 +154,11 @@ struct VulkanCommonParameters {
         Device(VK_NULL_HANDLE),
         GraphicsQueue(),
         PresentQueue(),
+        TransferQueue(),
+        ComputeQueue(),
         PresentationSurface(VK_NULL_HANDLE),
-        SwapChain() {}
+        SwapChain(),
+        Frames() {}
 };
 
 class VulkanCommon {
@@ -87,10 +168,84 @@ class VulkanCommon {
   VkDevice GetDevice() const;
   const SwapChainParameters &GetSwapChain() const;
   bool PrepareVulkan(GLFWwindow *window);
+  // Renders into a ring of offscreen images instead of a swap chain; needs
+  // neither a window nor a device with presentation support
+  bool PrepareVulkanHeadless(uint32_t width, uint32_t height,
+                             VkFormat format = VK_FORMAT_R8G8B8A8_UNORM,
+                             uint32_t image_count = 3);
+  bool IsHeadless() const;
   const QueueParameters GetGraphicsQueue() const;
   const QueueParameters GetPresentQueue() const;
+  const QueueParameters GetTransferQueue() const;
+  const QueueParameters GetComputeQueue() const;
   VkPhysicalDevice GetPhysicalDevice() const;
   bool OnWindowSizeChanged();
+  // Number of frames the CPU may record ahead of the GPU; must be set before
+  // PrepareVulkan() and is clamped to the number of swap chain images
+  void SetFramesInFlight(uint32_t count);
+  uint32_t GetFramesInFlight() const;
+  FrameResources &GetCurrentFrame();
+  uint32_t GetCurrentFrameIndex() const;
+  TimelineScheduler &GetGraphicsTimeline();
+  // Sub-allocator all device memory should come from; valid after
+  // PrepareVulkan()
+  GpuAllocator &GetAllocator();
+  // Staged copies are submitted ahead of the next frame by SubmitFrame()
+  UploadService &GetUploadService();
+  // Streams large uploads on the transfer queue; SubmitFrame() flushes it
+  // and hands finished uploads over to the graphics queue
+  AsyncUploadEngine &GetAsyncUploadEngine();
+  TimelineScheduler &GetTransferTimeline();
+  // Has one slot per swap chain image; AcquireFrame() collects results of
+  // the acquired image's slot once its previous frame has completed
+  GpuProfiler &GetProfiler();
+  // Copies every submitted frame to host memory and passes it to callback
+  // from AcquireFrame() once the GPU finished it; an empty callback stops
+  // readback. Needs graphics and present on the same queue family
+  bool SetReadbackCallback(ReadbackCallback callback);
+  // Waits for frames still in flight and delivers them, e.g. before exiting
+  bool FlushReadbacks();
+  // Records secondary command buffers on worker threads; slots are frames in
+  // flight, pass GetCurrentFrameIndex(). AcquireFrame() resets the current
+  // slot's pools
+  ParallelRecorder &GetParallelRecorder();
+  // Creates a DEVICE_LOCAL buffer and stages data for it; the buffer can be
+  // used by any frame submitted afterwards
+  bool CreateDeviceLocalBuffer(const void *data, VkDeviceSize size,
+                               VkBufferUsageFlags usage,
+                               BufferParameters *buffer);
+  // File the pipeline cache is loaded from and saved to; must be set before
+  // PrepareVulkan()
+  void SetPipelineCacheFilename(const std::string &filename);
+  VkPipelineCache GetPipelineCache() const;
+  // Builds pipelines on worker threads through the pipeline cache
+  PipelineCompiler &GetPipelineCompiler();
+  // Shader modules live as long as the device, so pipelines can be rebuilt
+  // without recreating them
+  ShaderLibrary &GetShaderLibrary();
+  // Development mode recompiling GLSL sources of source_directory when they
+  // change; shaders are named "<prefix>/<file name>" and swapped into the
+  // shader library by AcquireFrame(), which then calls
+  // ChildOnShadersReloaded()
+  bool EnableShaderHotReload(const std::string &source_directory,
+                             const std::string &prefix,
+                             const std::string &compiler);
+  // Pipeline layouts derived from shader reflection; owned by the cache
+  PipelineLayoutCache &GetPipelineLayoutCache();
+  // Shared pipelines deduplicated by description; owned by the registry
+  PipelineRegistry &GetPipelineRegistry();
+  // Passes of the frame on the graphics queue; described by the demo
+  RenderGraph &GetRenderGraph();
+  // Sub-allocates host visible memory valid until the current frame slot
+  // comes around again
+  bool AllocateTransient(VkDeviceSize size, VkDeviceSize alignment,
+                         VkDeviceSize *offset, void **data);
+  // Waits for the current frame slot and acquires a swap chain image;
+  // VK_ERROR_OUT_OF_DATE_KHR means the swap chain must be recreated
+  VkResult AcquireFrame(uint32_t *image_index);
+  // Submits command buffer for the acquired image, presents it and advances
+  // to the next frame slot
+  VkResult SubmitFrame(uint32_t image_index, VkCommandBuffer command_buffer);
   virtual bool Draw() = 0;
   virtual bool ReadyToDraw() const final { return can_render_; }
 
@@ -102,13 +257,39 @@ class VulkanCommon {
       VkPhysicalDevice physical_device,
       uint32_t &selected_graphics_queue_family_index,
       uint32_t &selected_present_queue_family_index);
+  // Optional VK_EXT_graphics_pipeline_library with fast linking; pipelines
+  // are created monolithically without it
+  bool CheckGraphicsPipelineLibrarySupport(VkPhysicalDevice physical_device);
+  // Optional VK_EXT_calibrated_timestamps with device and CLOCK_MONOTONIC
+  // domains, the latter being the tracer's clock; only checked on Linux
+  bool CheckCalibratedTimestampSupport(VkPhysicalDevice physical_device);
+  void SelectAuxiliaryQueueFamilies(
+      VkPhysicalDevice physical_device, uint32_t graphics_queue_family_index,
+      uint32_t &selected_transfer_queue_family_index,
+      uint32_t &selected_compute_queue_family_index);
   virtual bool ChildOnWindowSizeChanged() = 0;
+  // Called at a frame boundary with the names of reloaded shaders; pipelines
+  // using them should be rebuilt without blocking Draw()
+  virtual void ChildOnShadersReloaded(
+      const std::vector<std::string> & /*names*/) {}
+  // Releases swap chain dependent objects; called without waiting for the
+  // device so objects still in use must go through GetGraphicsTimeline()
   virtual void ChildClear() = 0;
   bool CreateInstance();
   bool CreateDevice();
   bool CreatePresentationSurface(GLFWwindow *window);
+  bool PrepareDevice();
   bool CreateSwapChain();
+  bool CreateOffscreenTargets();
+  bool UpdateReadbackTargets();
+  void ApplyShaderReloads();
+  // Maps the GPU timestamps collected for image_index onto the tracer's
+  // clock before they are recorded
+  void CalibrateGpuClock(uint32_t image_index);
   bool CreateSwapChainImageViews();
+  bool CreateFrameResources();
+  bool CreateTransientAllocator(TransientAllocatorParameters &allocator);
+  void DestroyFrameResources();
   bool GetDeviceQueue();
   
   std::vector<const char *> GetRequiredExtensions();
@@ -126,6 +307,35 @@ class VulkanCommon {
       std::vector<VkPresentModeKHR> &present_modes);
   bool can_render_;
   VulkanCommonParameters vulkan_;
+  bool headless_ = false;
+  bool graphics_pipeline_library_ = false;
+  // Null without calibrated timestamps
+  PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps_ = nullptr;
+  uint32_t headless_image_count_ = 3;
+  uint32_t next_offscreen_image_ = 0;
+  uint32_t frames_in_flight_ = 2;
+  uint32_t current_frame_ = 0;
+  GpuAllocator allocator_;
+  TimelineScheduler graphics_timeline_;
+  TimelineScheduler transfer_timeline_;
+  UploadService upload_service_;
+  AsyncUploadEngine async_upload_engine_;
+  GpuProfiler profiler_;
+  FrameReadback readback_;
+  ParallelRecorder recorder_;
+  PipelineCache pipeline_cache_;
+  PipelineCompiler pipeline_compiler_;
+  ShaderLibrary shader_library_;
+  PipelineLayoutCache pipeline_layout_cache_;
+  PipelineRegistry pipeline_registry_;
+  RenderGraph render_graph_;
+  ShaderWatcher shader_watcher_;
+  std::string pipeline_cache_filename_ = "pipeline_cache.bin";
+  // Timeline value of the last submission rendering into each swap chain image
+  std::vector<uint64_t> images_in_flight_;
+  // Tracer time right before the last submission rendering into each swap
+  // chain image; none of its GPU timestamps can be earlier
+  std::vector<uint64_t> image_submit_times_;
 };
 
 #endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "window.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 Window::Window() {
@@ -31,19 +33,50 @@ GLFWwindow *Window::GetWindow() { return window_; }
 void Window::ProcessInput() {
   if (glfwGetKey(window_, GLFW_KEY_ESCAPE) == GLFW_PRESS)
     glfwSetWindowShouldClose(window_, true);
+
+  // Dump the running capture on demand
+  bool trace_key_pressed = glfwGetKey(window_, GLFW_KEY_F12) == GLFW_PRESS;
+  if (trace_key_pressed && !trace_key_pressed_ && Tracer::Get().IsEnabled())
+    Tracer::Get().Write();
+  trace_key_pressed_ = trace_key_pressed;
 }
 
-bool Window::RenderingLoop(VulkanCommon &vulkan_common) {
+bool Window::RenderingLoop(VulkanCommon &vulkan_common,
+                           bool resize_every_frame) {
+  uint32_t frame_count = 0;
+  double total_milliseconds = 0.0;
+  double worst_milliseconds = 0.0;
   while (!glfwWindowShouldClose(window_)) {
-    // input
-    // -----
-    ProcessInput();
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved
-    // etc.)
-    // -------------------------------------------------------------------------------
-    
-    vulkan_common.Draw();
-    glfwPollEvents();
+    auto frame_start = std::chrono::steady_clock::now();
+    {
+      TraceZone zone("Frame");
+      // input
+      // -----
+      ProcessInput();
+      // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved
+      // etc.)
+      // -------------------------------------------------------------------------------
+
+      if (resize_every_frame && !vulkan_common.OnWindowSizeChanged()) {
+        return false;
+      }
+      vulkan_common.Draw();
+      glfwPollEvents();
+    }
+    Tracer::Get().EndFrame();
+
+    double frame_milliseconds = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    frame_start)
+                                    .count();
+    ++frame_count;
+    total_milliseconds += frame_milliseconds;
+    worst_milliseconds = std::max(worst_milliseconds, frame_milliseconds);
+  }
+  if (resize_every_frame && (frame_count > 0)) {
+    std::cout << frame_count << " frames resized every frame, "
+              << total_milliseconds / frame_count << " ms per frame (worst "
+              << worst_milliseconds << " ms)" << std::endl;
   }
   return true;
 }
\ No newline at end of file
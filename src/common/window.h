@@ -11,10 +11,14 @@ class Window {
 
   bool Create(const char *title, int width, int height);
   GLFWwindow *GetWindow();
-  bool RenderingLoop(VulkanCommon &vulkan_common);
+  // resize_every_frame recreates the swap chain before every frame as a
+  // stress test and reports the average and worst frame time on exit
+  bool RenderingLoop(VulkanCommon &vulkan_common,
+                     bool resize_every_frame = false);
 
  private:
   GLFWwindow *window_ = nullptr;
+  bool trace_key_pressed_ = false;
   void ProcessInput();
 };
 